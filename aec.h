@@ -0,0 +1,231 @@
+/*
+ * aec.h -- Acoustic echo cancellers
+ *
+ * Removes the echo of the rendered signal from the captured signal. The rendered frames are
+ * given to the canceller after every processed block; capture sample m is aligned with
+ * render sample m - delay, where the bulk delay must exceed the device block size plus the
+ * canceller block size (the capture of a block is processed before its own render).
+ *
+ * Nlms   time domain normalized LMS, for short echo paths
+ * Pbfdaf partitioned block frequency domain adaptive filter, for echo tails of hundreds of ms
+ *
+ * The kind and the bulk delay are chosen before the streaming (MyAudio::SetEchoPath()).
+ */
+
+#pragma once
+#include <windows.h>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "fft.h"
+
+using namespace std;
+
+#define AEC_DELAY	1024	// default bulk delay between the render and capture streams (in samples)
+
+enum aec_kind {pbfdaf_aec, nlms_aec};
+
+
+class EchoCanceller {
+public:
+	EchoCanceller(UINT32 delay, UINT32 span): delay_(delay), mic_(0), refCount_(0) {
+		size_ = 1;
+		while (size_ < 2*(delay + span)) size_ <<= 1;
+		ring_ = new float[size_];
+		memset(ring_, 0, size_*sizeof(float));
+	}
+
+	virtual ~EchoCanceller() {
+		delete [] ring_;
+	}
+
+	/* append the rendered frames to the reference signal, zeros if render is NULL (a block
+	   which the device plays as silence) */
+	void reference(const pcm_frame *render, UINT32 n) {
+		if (render == NULL) {
+			for (UINT32 i = 0; i < n; i++)
+				ring_[(refCount_++) & (size_-1)] = 0.0f;
+			return;
+		}
+		for (UINT32 i = 0; i < n; i++)
+			ring_[(refCount_++) & (size_-1)] = 0.5f*((float)render[i].left + (float)render[i].right);
+	}
+
+	/* remove the echo from the captured frames (left channel) */
+	virtual void process(const pcm_frame *capture, pcm_frame *output, UINT32 n) = 0;
+
+	virtual void reset() {
+		memset(ring_, 0, size_*sizeof(float));
+		mic_ = refCount_ = 0;
+	}
+
+	/* block size of a frequency domain canceller, 0 for a sample by sample one */
+	virtual UINT32 block() const { return 0; }
+
+	UINT32 delay() const { return delay_; }
+
+protected:
+	/* reference sample aligned with the capture sample m, zero if it is not (or no longer) available */
+	inline float ref(INT64 m) {
+		INT64 j = m - delay_;
+
+		return (j >= 0 && j < refCount_ && j >= refCount_ - (INT64)size_) ? ring_[j & (size_-1)] : 0.0f;
+	}
+
+	INT64 mic_;				// index of the next capture sample
+
+private:
+	UINT32 delay_, size_;
+	INT64  refCount_;
+	float *ring_;
+};
+
+
+class Nlms: public EchoCanceller {
+public:
+	Nlms(UINT32 taps, float mu = 0.5f, UINT32 delay = AEC_DELAY): EchoCanceller(delay, taps), L((taps+3) & ~3), mu_(mu) {
+		w_ = (float *)_aligned_malloc(L*sizeof(float), 16);
+		x_ = (float *)_aligned_malloc(2*L*sizeof(float), 16);		// history twice, so the window is always contiguous
+		reset();
+	}
+
+	~Nlms() {
+		_aligned_free(w_);
+		_aligned_free(x_);
+	}
+
+	void process(const pcm_frame *capture, pcm_frame *output, UINT32 n) {
+		for (UINT32 i = 0; i < n; i++) {
+			// newest reference sample to the front of the window x_[pos_..pos_+L-1]
+			float xn = ref(mic_++);
+			pos_ = (pos_ == 0) ? L-1 : pos_-1;
+			energy_ += xn*xn - x_[pos_]*x_[pos_];
+			if (energy_ < 0.0f) energy_ = 0.0f;
+			x_[pos_] = x_[pos_+L] = xn;
+
+			// echo estimate
+			const float *x = &x_[pos_];
+			__m128 acc = _mm_setzero_ps();
+			for (UINT32 j = 0; j < L; j += 4)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(&w_[j]), _mm_loadu_ps(&x[j])));
+			acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+			acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+
+			float e = (float)capture[i].left - _mm_cvtss_f32(acc);
+			output[i].left = output[i].right = sat16(e);
+
+			// normalized coefficient update
+			__m128 g = _mm_set1_ps(mu_*e / (energy_ + 1e4f));
+			for (UINT32 j = 0; j < L; j += 4)
+				_mm_store_ps(&w_[j], _mm_add_ps(_mm_load_ps(&w_[j]), _mm_mul_ps(g, _mm_loadu_ps(&x[j]))));
+		}
+	}
+
+	void reset() {
+		EchoCanceller::reset();
+		memset(w_, 0, L*sizeof(float));
+		memset(x_, 0, 2*L*sizeof(float));
+		pos_    = 0;
+		energy_ = 0.0f;
+	}
+
+private:
+	UINT32 L, pos_;
+	float  mu_, energy_;
+	float *w_, *x_;
+};
+
+
+class Pbfdaf: public EchoCanceller {
+public:
+	Pbfdaf(UINT32 taps, UINT32 block = 128, float mu = 0.5f, UINT32 delay = AEC_DELAY):
+	  EchoCanceller(delay, taps + 2*block), B(block), P((taps + block-1)/block), K(block+1), fft_(2*block), mu_(mu) {
+		X_  = new cfloat[P*K]; W_ = new cfloat[P*K];
+		Y_  = new cfloat[K];   E_ = new cfloat[K];
+		pw_ = new float[K];
+		t_  = new float[2*B];  y_ = new float[B]; e_ = new float[B];
+		reset();
+	}
+
+	~Pbfdaf() {
+		delete [] X_; delete [] W_; delete [] Y_; delete [] E_;
+		delete [] pw_; delete [] t_; delete [] y_; delete [] e_;
+	}
+
+	void process(const pcm_frame *capture, pcm_frame *output, UINT32 n) {
+		for (UINT32 i = 0; i < n; i++) {
+			// echo estimate of the whole block is known when the block starts, so there is no extra latency
+			if (pos_ == 0)
+				predict();
+
+			float e = (float)capture[i].left - y_[pos_];
+			e_[pos_] = e;
+			output[i].left = output[i].right = sat16(e);
+
+			mic_++;
+			if (++pos_ == B) {
+				adapt();
+				pos_ = 0;
+			}
+		}
+	}
+
+	UINT32 block() const { return B; }
+
+	void reset() {
+		EchoCanceller::reset();
+		memset(X_, 0, P*K*sizeof(cfloat));
+		memset(W_, 0, P*K*sizeof(cfloat));
+		for (UINT32 k = 0; k < K; k++)
+			pw_[k] = 0.0f;
+		pos_ = head_ = constr_ = 0;
+	}
+
+private:
+	/* spectrum of the newest reference block and the echo estimate of the coming block (overlap-save) */
+	void predict() {
+		head_ = (head_ + P-1) % P;
+		for (UINT32 j = 0; j < 2*B; j++)
+			t_[j] = ref(mic_ - B + j);
+		fft_.forward(t_, &X_[head_*K]);
+
+		// smoothed power spectrum of the reference for the step size normalization
+		cfloat *x = &X_[head_*K];
+		for (UINT32 k = 0; k < K; k++)
+			pw_[k] = 0.9f*pw_[k] + 0.1f*(x[k].re*x[k].re + x[k].im*x[k].im);
+
+		memset(Y_, 0, K*sizeof(cfloat));
+		for (UINT32 p = 0; p < P; p++)
+			cmac(&W_[p*K], &X_[((head_+p) % P)*K], Y_, K);
+		fft_.inverse(Y_, t_);
+		memcpy(y_, &t_[B], B*sizeof(float));
+	}
+
+	/* coefficient update with the error of the completed block */
+	void adapt() {
+		memset(t_, 0, B*sizeof(float));
+		memcpy(&t_[B], e_, B*sizeof(float));
+		fft_.forward(t_, E_);
+
+		float delta = 2.0f*B*100.0f;		// regularization, about 10 LSB rms noise floor
+		for (UINT32 k = 0; k < K; k++) {
+			float s = mu_ / (P*pw_[k] + delta);
+			E_[k].re *= s; E_[k].im *= s;
+		}
+		for (UINT32 p = 0; p < P; p++)
+			cmac(&X_[((head_+p) % P)*K], E_, &W_[p*K], K, true);
+
+		// gradient constraint (no circular wrap-around) for one partition per block in turn
+		fft_.inverse(&W_[constr_*K], t_);
+		memset(&t_[B], 0, B*sizeof(float));
+		fft_.forward(t_, &W_[constr_*K]);
+		constr_ = (constr_ + 1) % P;
+	}
+
+	UINT32  B, P, K;				// block size, number of partitions, number of bins
+	RealFft fft_;
+	float   mu_;
+	cfloat *X_, *W_, *Y_, *E_;
+	float  *pw_, *t_, *y_, *e_;
+	UINT32  pos_, head_, constr_;
+};
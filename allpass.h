@@ -3,13 +3,14 @@
 #include <math.h>
 #include "wavIO.h"
 #include "cirbuffer.h"
+#include "node.h"
 
 using namespace std;
 
 
-class Allpass: private CircularBuffer {
+class Allpass: public DspNode, private CircularBuffer {
 public:
-	Allpass(size_t capacity, float rvt): CircularBuffer(capacity) {
+	Allpass(size_t capacity, float rvt): CircularBuffer(capacity), rvt_(rvt) {
 		g = (INT16)(pow(0.001f, ((float)capacity/FS) / rvt) * 32767.0f);
 	}
 
@@ -18,7 +19,7 @@ public:
 			INT16 delayedInput, out;
 
 			delayedInput = read();
-			out = saturate(input[i].left + mpy(delayedInput, -g));
+			out = saturate(input[i].left + mpyz(delayedInput, -g));
 			write(out);
 
 			out = saturate(mpy(out, g) + delayedInput);
@@ -28,7 +29,35 @@ public:
 		}
 	}
 
+	void reset() {
+		clear();
+	}
+
+	const char *name() const { return "allpass"; }
+
+	/* round trips for a full scale state to decay to 1/(1-g) LSB with the loop gain g, and then
+	   by at least 1 LSB per round trip (see Comb) to 0 */
+	UINT32 tail() const {
+		return g > 0 ? ((UINT32)ceil(log(1.0/32768.0)/log(g/32768.0)) + (UINT32)ceil(1.0/(1.0 - g/32768.0)) + 1)*(UINT32)capacity() : (UINT32)capacity();
+	}
+
+	/* the feedback decays by 60 dB in rvt seconds */
+	UINT32 preroll(double decayDb) const { return (UINT32)ceil(rvt_*FS*decayDb/60.0) + (UINT32)capacity(); }
+
+	/* the rounding adds up to 1/(1-g) LSB of the state (see Comb), at the output g times it
+	   truncated plus the delayed state */
+	double limitCycle() const {
+		double g1 = g/32768.0;
+
+		return (1.0 + g1)/(1.0 - g1) + 1.0;
+	}
+
+	/* sum of the magnitudes of the impulse response, g + (1-g^2)(1 + g + g^2 ...), the largest
+	   gain of the filter for any signal */
+	double peakGain() const { return 1.0 + 2.0*g/32768.0; }
+
 private:
 	INT16 g;
+	float rvt_;
 };
 
@@ -0,0 +1,179 @@
+/*
+ * analyzer.h -- Frequency response analyzer for any DSP node or chain of nodes
+ *
+ * Drives the node with an impulse, an exponential sine sweep or a maximum length sequence,
+ * recovers the impulse response by a regularized FFT deconvolution and derives
+ * magnitude, phase, group delay and latency from it.
+ */
+
+#pragma once
+#include <windows.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdio.h>
+#include "cirbuffer.h"
+#include "node.h"
+#include "fft.h"
+
+using namespace std;
+
+
+enum stimulus_type {impulse_stimulus, sweep_stimulus, mls_stimulus};
+
+class Analyzer {
+public:
+	/* length is the analysed impulse response length (power of two) */
+	Analyzer(UINT32 length): L(length), M(2*length), fftL(length), fftM(2*length), latency_(0) {
+		x    = new float[M];   y  = new float[M];   h = new float[L];   nh = new float[L];
+		X    = new cfloat[M/2+1]; Y = new cfloat[M/2+1]; H = new cfloat[L/2+1]; NH = new cfloat[L/2+1];
+		io   = new pcm_frame[M]; out = new pcm_frame[M];
+		mag  = new float[L/2+1]; phase = new float[L/2+1]; gd = new float[L/2+1];
+	}
+
+	~Analyzer() {
+		delete [] x;   delete [] y;   delete [] h;  delete [] nh;
+		delete [] X;   delete [] Y;   delete [] H;  delete [] NH;
+		delete [] io;  delete [] out;
+		delete [] mag; delete [] phase; delete [] gd;
+	}
+
+	/* measure the response of the given node (its state is cleared first) */
+	HRESULT measure(DspNode *node, stimulus_type type) {
+		UINT32 S = stimulus(type);
+
+		// drive the node with the stimulus followed by silence long enough to capture the response
+		for (UINT32 i = 0; i < M; i++)
+			io[i].left = io[i].right = (INT16)(i < S ? x[i] : 0.0f);
+		for (UINT32 i = S; i < M; i++)
+			x[i] = 0.0f;
+
+		node->reset();
+		node->process(io, out, M);
+		for (UINT32 i = 0; i < M; i++)
+			y[i] = out[i].left;
+
+		// deconvolve: H = Y X* / (|X|^2 + eps)
+		fftM.forward(x, X);
+		fftM.forward(y, Y);
+		float pmax = 0.0f;
+		for (UINT32 k = 0; k <= M/2; k++)
+			pmax = max(pmax, X[k].re*X[k].re + X[k].im*X[k].im);
+		for (UINT32 k = 0; k <= M/2; k++) {
+			float  p = X[k].re*X[k].re + X[k].im*X[k].im + 1e-6f*pmax;
+			cfloat r;
+
+			r.re = (Y[k].re*X[k].re + Y[k].im*X[k].im) / p;
+			r.im = (Y[k].im*X[k].re - Y[k].re*X[k].im) / p;
+			Y[k] = r;
+		}
+		fftM.inverse(Y, y);
+
+		// latency is the position of the impulse response peak
+		latency_ = 0;
+		for (UINT32 i = 0; i < L; i++) {
+			h[i]  = y[i];
+			nh[i] = i*y[i];
+			if (fabs(h[i]) > fabs(h[latency_])) latency_ = i;
+		}
+
+		// magnitude, unwrapped phase and group delay (Re{FFT(n h[n]) / FFT(h[n])})
+		fftL.forward(h, H);
+		fftL.forward(nh, NH);
+		float prev = 0.0f, offset = 0.0f;
+		for (UINT32 k = 0; k <= L/2; k++) {
+			float p = H[k].re*H[k].re + H[k].im*H[k].im, ph = atan2f(H[k].im, H[k].re);
+
+			mag[k] = 10.0f*log10f(p + 1e-30f);
+			if (k > 0) {
+				if (ph + offset - prev >  (float)M_PI) offset -= 2.0f*(float)M_PI;
+				if (ph + offset - prev < -(float)M_PI) offset += 2.0f*(float)M_PI;
+			}
+			phase[k] = prev = ph + offset;
+			gd[k] = p > 0.0f ? (NH[k].re*H[k].re + NH[k].im*H[k].im) / p : 0.0f;
+		}
+
+		return S_OK;
+	}
+
+	UINT32       length() const    { return L; }
+	UINT32       bins() const      { return L/2+1; }
+	UINT32       latency() const   { return latency_; }
+	const float *impulse() const   { return h; }
+	const float *magnitude() const { return mag; }
+
+	/* store the results, CSV if the file name ends with .csv, otherwise in a compact binary format */
+	HRESULT save(LPCWSTR filename) {
+		size_t  len  = wcslen(filename);
+		bool    fCsv = len > 4 && _wcsicmp(&filename[len-4], L".csv") == 0;
+		FILE   *fp;
+
+		if (_wfopen_s(&fp, filename, fCsv ? L"w" : L"wb") != 0)
+			return E_FAIL;
+
+		if (fCsv) {
+			fprintf(fp, "# latency %u samples\n", latency_);
+			fprintf(fp, "frequency,magnitude_db,phase_rad,group_delay_samples\n");
+			for (UINT32 k = 0; k <= L/2; k++)
+				fprintf(fp, "%.2f,%.3f,%.5f,%.3f\n", (double)k*FS/L, mag[k], phase[k], gd[k]);
+		} else {
+			// header: "DSPA", version, sampling rate, number of bins, latency; followed by the float arrays
+			UINT32 hdr[5] = { 0x41505344, 1, FS, L/2+1, latency_ };
+
+			fwrite(hdr, sizeof(hdr), 1, fp);
+			fwrite(mag, sizeof(float), L/2+1, fp);
+			fwrite(phase, sizeof(float), L/2+1, fp);
+			fwrite(gd, sizeof(float), L/2+1, fp);
+			fwrite(h, sizeof(float), L, fp);
+		}
+		fclose(fp);
+
+		return S_OK;
+	}
+
+private:
+	/* generate the stimulus into x[], returns its length */
+	UINT32 stimulus(stimulus_type type) {
+		switch (type) {
+		case sweep_stimulus: {
+			// exponential sine sweep from 20 Hz to 0.95*FS/2, -12 dBFS, with short fades at the ends
+			double f1 = 20.0, f2 = 0.95*FS/2, r = log(f2/f1), T = (double)L/FS;
+
+			for (UINT32 i = 0; i < L; i++) {
+				double t = (double)i/FS, fade = 1.0;
+
+				if (i < 64)    fade = i/64.0;
+				if (i >= L-64) fade = (L-1-i)/64.0;
+				x[i] = (float)(8192.0*fade*sin(2.0*M_PI*f1*T/r*(exp(t/T*r) - 1.0)));
+			}
+			return L;
+		}
+
+		case mls_stimulus: {
+			// maximum length sequence of order log2(L) from a Galois LFSR, -12 dBFS
+			static const UINT32 taps[] = { 0, 0, 0x3, 0x6, 0xC, 0x14, 0x30, 0x60, 0xB8, 0x110, 0x240,
+										   0x500, 0x829, 0x100D, 0x2015, 0x6000, 0xD008, 0x12000, 0x20400, 0x40023, 0x90000 };
+			UINT32 m = 0, s = 1;
+
+			while ((1u << (m+1)) <= L && m+1 < sizeof(taps)/sizeof(taps[0])) m++;
+			for (UINT32 i = 0; i < (1u << m)-1; i++) {
+				x[i] = (s & 1) ? 8192.0f : -8192.0f;
+				s = (s >> 1) ^ ((s & 1) ? taps[m] : 0);
+			}
+			return (1u << m)-1;
+		}
+
+		case impulse_stimulus:
+		default:
+			x[0] = 32767.0f;
+			return 1;
+		}
+	}
+
+	UINT32     L, M;			// response length, deconvolution FFT length
+	RealFft    fftL, fftM;
+	float     *x, *y, *h, *nh;
+	cfloat    *X, *Y, *H, *NH;
+	pcm_frame *io, *out;
+	float     *mag, *phase, *gd;
+	UINT32     latency_;
+};
@@ -0,0 +1,162 @@
+/*
+ * apitest.cpp -- Checks of the C interface of the processing blocks (dsplib.lib)
+ *
+ * A client of the library as a user would write it, which compares the output of the
+ * chains against the blocks run directly: interleaved and planar buffers, the whole
+ * stream at once and in batches of different sizes. The example module (plugindelay.dll,
+ * built next to the test) is loaded and run through the module ABI as well. Prints the
+ * failed checks and exits with 1 if there were any.
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "dsp.h"
+#include "dspapi.h"
+
+using namespace std;
+
+#define TEST_FRAMES		50000	// length of the stimulus (in frames)
+
+static int failures = 0;
+
+
+static void check(bool fOk, const char *what) {
+	printf("%-60s %s\n", what, fOk ? "ok" : "FAILED");
+	if (!fOk)
+		failures++;
+}
+
+static bool equal(const vector<pcm_frame> &a, const vector<pcm_frame> &b) {
+	return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()*sizeof(pcm_frame)) == 0;
+}
+
+/* reference: the block run directly on separate buffers */
+static vector<pcm_frame> direct(const char *name, const vector<pcm_frame> &in) {
+	vector<pcm_frame> out(in.size());
+	DspNode          *node = MyAudio::MakeNode(name);
+
+	node->process(in.data(), out.data(), (UINT32)in.size());
+	delete node;
+	return out;
+}
+
+/* the whole stream by the interleaved interface, in batches of the given sizes (cycled) */
+static vector<pcm_frame> interleaved(const char *blocks, const vector<pcm_frame> &in, const size_t *sizes, size_t nSizes, uint32_t maxFrames = 0) {
+	vector<pcm_frame> buf(in);
+	int               error;
+	dsp_chain        *chain = dsp_create(blocks, maxFrames, &error);
+
+	if (chain == NULL)
+		return vector<pcm_frame>();
+	for (size_t j = 0, k = 0, n; j < buf.size(); j += n, k++) {
+		n = min(sizes[k % nSizes], buf.size() - j);
+		dsp_process_interleaved(chain, (int16_t *)&buf[j], n);
+	}
+	dsp_destroy(chain);
+	return buf;
+}
+
+/* the same by the planar interface */
+static vector<pcm_frame> planar(const char *blocks, const vector<pcm_frame> &in, const size_t *sizes, size_t nSizes) {
+	vector<pcm_frame> out(in.size());
+	vector<int16_t>   left(in.size()), right(in.size());
+	int               error;
+	dsp_chain        *chain = dsp_create(blocks, 0, &error);
+
+	if (chain == NULL)
+		return vector<pcm_frame>();
+	for (size_t i = 0; i < in.size(); i++) {
+		left[i]  = in[i].left;
+		right[i] = in[i].right;
+	}
+	for (size_t j = 0, k = 0, n; j < in.size(); j += n, k++) {
+		n = min(sizes[k % nSizes], in.size() - j);
+		dsp_process_planar(chain, &left[j], &right[j], n);
+	}
+	for (size_t i = 0; i < in.size(); i++) {
+		out[i].left  = left[i];
+		out[i].right = right[i];
+	}
+	dsp_destroy(chain);
+	return out;
+}
+
+int wmain() {
+	const size_t      whole[]  = {TEST_FRAMES};
+	const size_t      split[]  = {1, 7, 441, 4096, 5000, 64};
+	vector<pcm_frame> in(TEST_FRAMES);
+	UINT32            s = 12345;
+	int               error;
+	dsp_chain        *chain;
+
+	// stimulus: pseudo-random noise and a linear chirp, different on the two channels
+	for (UINT32 i = 0; i < TEST_FRAMES; i++) {
+		s = s*1664525 + 1013904223;
+		in[i].left  = i < TEST_FRAMES/2 ? (INT16)(s >> 16) / 2 : (INT16)(16384.0*sin(1e-4*i*(double)i));
+		in[i].right = (INT16)(s >> 8);
+	}
+
+	vector<pcm_frame> fir = direct("fir", in);
+
+	check(dsp_version() == DSP_API_VERSION, "version");
+	check(equal(interleaved("fir", in, whole, 1), fir), "fir interleaved == Fir::process");
+	check(equal(planar("fir", in, whole, 1), fir), "fir planar == Fir::process");
+	check(equal(interleaved("fir", in, split, 6), fir), "fir interleaved, batches of 1..5000 frames");
+	check(equal(planar("fir", in, split, 6), fir), "fir planar, batches of 1..5000 frames");
+	check(equal(interleaved("fir", in, split, 6, 100), fir), "fir interleaved, internal block of 100 frames");
+
+	vector<pcm_frame> chained = interleaved("fir,reverb", in, whole, 1);
+	check(!chained.empty() && equal(interleaved("fir,reverb", in, split, 6), chained), "fir,reverb interleaved, batches of 1..5000 frames");
+	check(!chained.empty() && equal(planar("fir,reverb", in, split, 6), chained), "fir,reverb planar == interleaved");
+
+	// latency, reset and the errors
+	if ((chain = dsp_create("fir", 0, &error)) != NULL) {
+		DspNode          *node = MyAudio::MakeNode("fir");
+		vector<pcm_frame> buf(in);
+
+		check(dsp_latency(chain) == node->latency(), "latency of fir");
+		dsp_process_interleaved(chain, (int16_t *)buf.data(), buf.size());
+		dsp_reset(chain);
+		buf = in;
+		dsp_process_interleaved(chain, (int16_t *)buf.data(), buf.size());
+		check(equal(buf, fir), "fir after dsp_reset() == new chain");
+		dsp_destroy(chain);
+		delete node;
+	} else
+		check(false, "dsp_create(\"fir\")");
+
+	string longList(300, 'x');
+	check(dsp_create(longList.c_str(), 0, &error) == NULL && error == DSP_E_INVALIDARG, "block list over 255 characters");
+	check(dsp_create(NULL, 0, &error) == NULL && error == DSP_E_INVALIDARG, "no block list");
+	check(dsp_create("fir,nosuch", 0, &error) == NULL && error == DSP_E_NOTFOUND, "unknown block");
+	check(dsp_create_filter(L"nosuch.txt", NULL, 0, &error) == NULL && error == DSP_E_NOTFOUND, "missing coefficient file");
+	check(dsp_process_interleaved(NULL, NULL, 0) == DSP_E_INVALIDARG, "no chain");
+
+	// the example module delays both channels by its latency
+	PluginNode plugin;
+	if (plugin.load(L"plugindelay.dll") == S_OK) {
+		vector<pcm_frame> out(in.size());
+		UINT32            d = plugin.latency();
+		bool              fOk = true;
+
+		check(strcmp(plugin.name(), "delay") == 0 && d == 32 && plugin.tail() == 32, "plugindelay.dll descriptor");
+		for (int pass = 0; pass < 2; pass++) {
+			plugin.reset();
+			for (size_t j = 0, k = 0, n; j < in.size(); j += n, k++) {
+				n = min(split[k % 6], in.size() - j);
+				plugin.process(&in[j], &out[j], (UINT32)n);
+			}
+			for (size_t i = 0; i < in.size(); i++)
+				fOk = fOk && out[i].left == (i < d ? 0 : in[i-d].left) && out[i].right == (i < d ? 0 : in[i-d].right);
+		}
+		check(fOk, "plugindelay.dll output, batches of 1..5000 frames, reset");
+	} else
+		check(false, "plugindelay.dll loaded");
+
+	printf("%d failures\n", failures);
+	return failures != 0 ? 1 : 0;
+}
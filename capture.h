@@ -0,0 +1,295 @@
+/*
+ * capture.h -- Recording of the live input blocks for a deterministic replay
+ *
+ * The audio thread appends every block it is given (the capture frames, their count, the
+ * device flags and a timestamp), every dropped block of the overrun path and every parameter
+ * change with the stream frame at which it took effect to a lock-free byte ring. A background
+ * thread moves the ring to the file, so the audio thread only copies the block and never
+ * waits for the disk. If the ring is full the records are lost and the next one is marked.
+ *
+ * The file is a CaptureHeader followed by CaptureRecord entries, each followed by its frames
+ * (a block), by a CaptureParam (a parameter change) or by nothing (an overrun). The changes
+ * applied while a block was processed precede the record of the block. The header holds the
+ * setup made before the streaming (the planned kernels, the echo canceller, the loaded module
+ * and coefficients), which a replay restores before the first block.
+ */
+
+#pragma once
+#include <windows.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include "wavIO.h"
+
+using namespace std;
+
+#define CAPTURE_MAGIC	0x43505344		// 'DSPC'
+#define CAPTURE_VERSION	3
+#define CAPTURE_RING	(1 << 23)		// bytes between the audio thread and the writer (power of two, abt. 47 s of audio)
+#define CAPTURE_POLL	20				// largest wait of the writer between the writes (ms)
+
+#define CAPTURE_OVERRUN	0x80000000		// record flags: the block was dropped by the device loop, no frames follow
+#define CAPTURE_LOST	0x40000000		// record flags: records before this one were lost, the ring was full
+#define CAPTURE_PARAM	0x20000000		// record flags: a parameter change, a CaptureParam follows
+#define CAPTURE_RECORD	0xE0000000		// the record flags, the rest are device capture flags
+
+
+/* state of the processing set up before the streaming, which the blocks and the changes do not tell */
+struct CaptureSetup {
+	INT32  firKernel[3];				// planned kernels of fir, fir1 and fir2 (fir_kernel)
+	UINT32 aecPartition;				// planned echo canceller partition (in samples), 0 for the time domain NLMS
+	UINT32 aecDelay;					// bulk delay of the echo canceller (in samples)
+	UINT32 chainFade;					// crossfade of the chain swaps (in blocks)
+	WCHAR  plugin[MAX_PATH];			// processing module, empty if none
+	WCHAR  coefs[MAX_PATH];				// coefficient file of the chain mode, empty if none
+};
+
+struct CaptureHeader {
+	UINT32 magic, version;
+	UINT32 rate;						// sampling rate (Hz)
+	UINT32 frameSize;					// bytes per frame
+	UINT64 ticksPerSecond;				// timestamp unit
+	CaptureSetup setup;
+};
+
+struct CaptureRecord {
+	UINT64 time;						// performance counter ticks since the start of the recording
+	UINT32 frames;						// frames of the block
+	UINT32 flags;						// device capture flags and the record flags
+	UINT32 padding;						// render buffer frames in use (overrun), 0 otherwise
+	UINT32 reserved;
+};
+
+struct CaptureParam {
+	UINT64 frame;						// stream time at which the change took effect
+	double value;
+	UINT32 id;							// dsp_param
+	UINT32 reserved;
+};
+
+
+class CaptureRecorder {
+public:
+	CaptureRecorder(): fp_(NULL), hThread_(NULL), hEvent_(NULL), ring_(NULL), head_(0), tail_(0),
+	  fOpen_(false), fStop_(false), fLost_(false), lost_(0), written_(0) {
+	}
+
+	~CaptureRecorder() {
+		close();
+	}
+
+	/* creates the file and starts the writer thread */
+	HRESULT open(LPCWSTR filename, const CaptureSetup &setup) {
+		CaptureHeader hdr = { CAPTURE_MAGIC, CAPTURE_VERSION, FS, sizeof(pcm_frame) };
+		LARGE_INTEGER freq;
+
+		hdr.setup = setup;
+
+		close();
+		if (_wfopen_s(&fp_, filename, L"wb") != 0) {
+			fp_ = NULL;
+			return E_FAIL;
+		}
+		QueryPerformanceFrequency(&freq);
+		hdr.ticksPerSecond = freq.QuadPart;
+		if (fwrite(&hdr, sizeof(hdr), 1, fp_) != 1) {
+			close();
+			return E_FAIL;
+		}
+
+		ring_ = new BYTE[CAPTURE_RING];
+		head_.store(0, memory_order_relaxed);
+		tail_.store(0, memory_order_relaxed);
+		lost_    = 0;
+		fLost_   = false;
+		written_ = sizeof(hdr);
+		fStop_   = false;
+		QueryPerformanceCounter(&t0_);
+		if ((hEvent_ = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL ||
+			(hThread_ = CreateThread(NULL, 0, writer, this, 0, NULL)) == NULL) {
+			close();
+			return E_FAIL;
+		}
+		fOpen_.store(true, memory_order_release);
+
+		return S_OK;
+	}
+
+	/* stops the writer after it has written the rest of the ring (not while the audio thread records) */
+	void close() {
+		fOpen_.store(false, memory_order_release);
+		if (hThread_ != NULL) {
+			fStop_ = true;
+			SetEvent(hEvent_);
+			WaitForSingleObject(hThread_, INFINITE);
+			CloseHandle(hThread_);
+			hThread_ = NULL;
+		}
+		if (hEvent_ != NULL)
+			CloseHandle(hEvent_);
+		hEvent_ = NULL;
+		if (fp_ != NULL)
+			fclose(fp_);
+		fp_ = NULL;
+		delete [] ring_;
+		ring_ = NULL;
+	}
+
+	bool opened() const { return fOpen_.load(memory_order_acquire); }
+
+	/* audio thread: a block given to the processing, t its performance counter time at the start */
+	void block(LARGE_INTEGER t, const pcm_frame *frames, UINT32 n, DWORD flags) {
+		CaptureRecord r = { (UINT64)(t.QuadPart - t0_.QuadPart), n, flags, 0, 0 };
+
+		put(r, frames, n*sizeof(pcm_frame));
+	}
+
+	/* audio thread: a block the device loop dropped because there was no room for the rendering */
+	void overrun(UINT32 n, UINT32 padding) {
+		LARGE_INTEGER t;
+
+		QueryPerformanceCounter(&t);
+		CaptureRecord r = { (UINT64)(t.QuadPart - t0_.QuadPart), n, CAPTURE_OVERRUN, padding, 0 };
+		put(r, NULL, 0);
+	}
+
+	/* audio thread: a parameter change which took effect at the given stream frame */
+	void param(UINT32 id, double value, UINT64 frame) {
+		LARGE_INTEGER t;
+		CaptureParam  p = { frame, value, id, 0 };
+
+		QueryPerformanceCounter(&t);
+		CaptureRecord r = { (UINT64)(t.QuadPart - t0_.QuadPart), 0, CAPTURE_PARAM, 0, 0 };
+		put(r, &p, sizeof(p));
+	}
+
+	/* records lost because the writer fell behind */
+	UINT32 lost() const { return lost_; }
+
+	/* bytes written to the file so far */
+	UINT64 written() const { return written_.load(memory_order_relaxed); }
+
+private:
+	/* appends the record and its data, or counts it lost if they do not fit */
+	bool put(CaptureRecord &r, const void *data, size_t bytes) {
+		UINT64 h = head_.load(memory_order_relaxed), t = tail_.load(memory_order_acquire);
+		size_t total = sizeof(r) + bytes;
+
+		if (CAPTURE_RING - (h - t) < total) {
+			lost_++;
+			fLost_ = true;
+			return false;
+		}
+		if (fLost_) {
+			r.flags |= CAPTURE_LOST;
+			fLost_ = false;
+		}
+
+		copy(h, &r, sizeof(r));
+		copy(h + sizeof(r), data, bytes);
+		head_.store(h + total, memory_order_release);
+
+		// wake up the writer early when the ring fills up, otherwise it polls
+		if (h + total - t > CAPTURE_RING/2)
+			SetEvent(hEvent_);
+
+		return true;
+	}
+
+	void copy(UINT64 pos, const void *data, size_t bytes) {
+		size_t k = (size_t)pos & (CAPTURE_RING-1), m = min(bytes, (size_t)CAPTURE_RING - k);
+
+		memcpy(&ring_[k], data, m);
+		memcpy(ring_, (const BYTE *)data + m, bytes - m);
+	}
+
+	static DWORD WINAPI writer(LPVOID pContext) {
+		CaptureRecorder *p = (CaptureRecorder *)pContext;
+		bool             fStop;
+
+		do {
+			WaitForSingleObject(p->hEvent_, CAPTURE_POLL);
+			fStop = p->fStop_;
+			p->flush();
+		} while (!fStop);
+
+		return 0;
+	}
+
+	/* writer thread: the ring up to the current write position to the file */
+	void flush() {
+		UINT64 h = head_.load(memory_order_acquire), t = tail_.load(memory_order_relaxed);
+
+		while (t < h) {
+			size_t k = (size_t)t & (CAPTURE_RING-1), m = (size_t)min(h - t, (UINT64)(CAPTURE_RING - k));
+
+			fwrite(&ring_[k], 1, m, fp_);
+			t += m;
+			tail_.store(t, memory_order_release);
+			written_.fetch_add(m, memory_order_relaxed);
+		}
+		fflush(fp_);
+	}
+
+	FILE          *fp_;
+	HANDLE         hThread_, hEvent_;
+	BYTE          *ring_;
+	atomic<UINT64> head_, tail_;			// bytes written by the audio thread and by the writer
+	atomic<bool>   fOpen_, fStop_;
+	bool           fLost_;					// the next record follows lost ones
+	UINT32         lost_;
+	atomic<UINT64> written_;
+	LARGE_INTEGER  t0_;
+};
+
+
+class CaptureReader {
+public:
+	CaptureReader(): fp_(NULL) {
+	}
+
+	~CaptureReader() {
+		if (fp_ != NULL)
+			fclose(fp_);
+	}
+
+	HRESULT open(LPCWSTR filename) {
+		if (_wfopen_s(&fp_, filename, L"rb") != 0) {
+			fp_ = NULL;
+			return E_FAIL;
+		}
+		if (fread(&hdr_, sizeof(hdr_), 1, fp_) != 1 || hdr_.magic != CAPTURE_MAGIC)
+			return E_FAIL;
+		if (hdr_.version != CAPTURE_VERSION || hdr_.rate != FS || hdr_.frameSize != sizeof(pcm_frame))
+			return E_NOTIMPL;
+
+		return S_OK;
+	}
+
+	/* the next record, false at the end of the file; its frames are in frames(), its change in param() */
+	bool next(CaptureRecord &r) {
+		if (fread(&r, sizeof(r), 1, fp_) != 1)
+			return false;
+
+		if (r.flags & CAPTURE_PARAM)
+			return fread(&param_, sizeof(param_), 1, fp_) == 1;
+		if (r.flags & CAPTURE_OVERRUN)
+			return true;
+		if (frames_.size() < r.frames)
+			frames_.resize(r.frames);
+		return r.frames == 0 || fread(&frames_[0], sizeof(pcm_frame), r.frames, fp_) == r.frames;
+	}
+
+	pcm_frame *frames() { return frames_.data(); }
+	const CaptureParam &param() const { return param_; }
+	const CaptureSetup &setup() const { return hdr_.setup; }
+
+	/* seconds of a record time */
+	double seconds(UINT64 time) const { return (double)time/hdr_.ticksPerSecond; }
+
+private:
+	FILE             *fp_;
+	CaptureHeader     hdr_;
+	CaptureParam      param_;
+	vector<pcm_frame> frames_;
+};
@@ -2,7 +2,9 @@
 #include <windows.h>
 #include <math.h>
 #include "wavIO.h"
+#include "simd.h"
 #include "cirbuffer.h"
+#include "node.h"
 
 using namespace std;
 
@@ -10,7 +12,7 @@ using namespace std;
 #define TCH		0.005f	// chorus delay change (in s)
 
 
-class Chorus: private CircularBuffer {
+class Chorus: public DspNode, private CircularBuffer {
 public:
 	Chorus(size_t capacity, float lfo, float g): CircularBuffer(capacity) {
 		this->g = g;
@@ -21,29 +23,47 @@ public:
 	}
 
 	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
-		for (UINT32 i = 0; i < samples; i++) {
-			// assemble mono input value and store it in circular buffer
-			write(input[i].left);
-
-			// build the two read pointers and do linear interpolation
-			int   ep1, ep2;
-			float w1, w2, outval;
-			w2 = modf(sweep_, &outval); ep1 = (int)outval;
-			ep2 = ep1 + 1;
-			w1  = 1.0f - w2;
-			outval = w1*(float)readpos(ep1) + w2*(float)readpos(ep2);
-
-			// develop output mix
-			output[i].left  = saturate((float)input[i].left + g*outval);
-			output[i].right = saturate((float)input[i].left + g*outval);
-
-			// increment the sweep
-			sweep_ += step_;
-			if (sweep_ >= maxSweepSamples_ || sweep_ <= minSweepSamples_)
-				step_ = -step_;
+		__declspec(align(16)) float mix[SIMD_BLOCK];
+
+		for (UINT32 i0 = 0, n; i0 < samples; i0 += n) {
+			n = min(samples - i0, (UINT32)SIMD_BLOCK);
+
+			for (UINT32 i = 0; i < n; i++) {
+				// assemble mono input value and store it in circular buffer
+				write(input[i0+i].left);
+
+				// build the two read pointers and do linear interpolation
+				int   ep1, ep2;
+				float w1, w2, outval;
+				w2 = modf(sweep_, &outval); ep1 = (int)outval;
+				ep2 = ep1 + 1;
+				w1  = 1.0f - w2;
+				outval = w1*(float)readpos(ep1) + w2*(float)readpos(ep2);
+
+				// develop output mix
+				mix[i] = (float)input[i0+i].left + g*outval;
+
+				// increment the sweep
+				sweep_ += step_;
+				if (sweep_ >= maxSweepSamples_ || sweep_ <= minSweepSamples_)
+					step_ = -step_;
+			}
+
+			simd().f32ToPcm(mix, mix, &output[i0], n);
 		}
 	}
 
+	void reset() {
+		clear();
+		sweep_ = (minSweepSamples_ + maxSweepSamples_) / 2.0f;
+		step_  = fabs(step_);
+	}
+
+	const char *name() const { return "chorus"; }
+
+	/* the dry signal passes undelayed, the modulated delay of the wet signal is the effect itself */
+	UINT32 latency() const { return 0; }
+
 private:
 	float g;
 	float sweep_, step_;
@@ -1,17 +1,19 @@
 #pragma once
 #include <windows.h>
+#include "simd.h"
 
 using namespace std;
 
 #define FS          44100	// Fs
+#define CB_RESERVE  15		// samples mirrored after the buffer end for vector loads (up to 256-bit)
 
 
 class CircularBuffer {
 public:
 	CircularBuffer(size_t capacity): capacity_(capacity) {
-		data_ = new INT16[capacity+7];	// additional reserve for 128-bit load at circular buffer boundary
+		data_ = new INT16[capacity+CB_RESERVE];	// additional reserve for vector loads at circular buffer boundary
 		beg_ = data_; end_ = &data_[capacity-1];
-		memset(data_, 0, (capacity+7)*sizeof(INT16));
+		memset(data_, 0, (capacity+CB_RESERVE)*sizeof(INT16));
 		wr_ = (INT16 *)end_;
 	}
 
@@ -21,11 +23,17 @@ public:
 
 	size_t capacity() const { return capacity_; }
 
+	/* clear the delay line */
+	void clear() {
+		memset(data_, 0, (capacity_+CB_RESERVE)*sizeof(INT16));
+		wr_ = (INT16 *)end_;
+	}
+
 	/* write a new sample to the delay line */
 	inline void write(INT16 data) {
 		if (--wr_ < beg_) {
 			wr_ = (INT16 *)end_;
-			memcpy((INT16 *)end_+1, beg_, 7*sizeof(INT16));	// ensure that 128-bit read work in wrapround case
+			memcpy((INT16 *)end_+1, beg_, CB_RESERVE*sizeof(INT16));	// ensure that vector reads work in wrapround case
 		}
 	
 		*wr_ = data;
@@ -59,34 +67,34 @@ protected:
 		if (ptr > end_) ptr = (INT16 *)beg_;
 	}
 
+	/* check the circular buffer beginning boundary when walking towards the newer samples */
+	inline void ptrCheckBack(INT16* &ptr) {
+		if (ptr < beg_) ptr = (INT16 *)end_;
+	}
+
 	/* check the circular buffer ending boundary */
 	inline void ptrCheck(__m128i* &ptr) {
 		if ((INT16 *)ptr > end_) ptr = (__m128i *)((INT16 *)ptr - capacity_);
 	}
 
+	/* check the circular buffer ending boundary */
+	inline void ptrCheck(__m256i* &ptr) {
+		if ((INT16 *)ptr > end_) ptr = (__m256i *)((INT16 *)ptr - capacity_);
+	}
+
 	/* convert 32-bit integer sample to 16-bit integer sample with saturation */
 	inline INT16 saturate(INT32 x) {
-		return (x > 32767) ? 32767 : ((x < -32768) ? -32768 : x);
+		return sat16(x);
 	}
 
 	/* convert floating point sample to 16-bit integer sample with saturation and rounding */
 	inline INT16 saturate(double x) {
-		if (x >= 0.0)
-			if (x > 32767.0)  return (32767);
-			else              return ((INT16)(x+0.5));
-		else
-			if (x < -32768.0) return (-32768);
-			else			  return ((INT16)(x-0.5));
+		return sat16(x);
 	}
 
 	/* convert floating point sample to 16-bit integer sample with saturation and rounding */
 	inline INT16 saturate(float x) {
-		if (x >= 0.0f)
-			if (x > 32767.0f)  return (32767);
-			else              return ((INT16)(x+0.5f));
-		else
-			if (x < -32768.0f) return (-32768);
-			else			  return ((INT16)(x-0.5f));
+		return sat16(x);
 	}
 
 	/* multiply to Q15 numbers */
@@ -94,6 +102,14 @@ protected:
 		return ((INT32)x * c) >> 15;
 	}
 
+	/* multiply to Q15 numbers, rounded toward zero: a feedback loop with |c| < 1 then dies out
+	   instead of sticking at -1 LSB */
+	inline INT32 mpyz(INT16 x, INT16 c) {
+		INT32 p = (INT32)x * c;
+
+		return p >= 0 ? p >> 15 : -(-p >> 15);
+	}
+
 private:
 	size_t       capacity_;
 	INT16       *data_;
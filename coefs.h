@@ -0,0 +1,346 @@
+/*
+ * coefs.h -- FIR coefficients loaded at run time, with their kernel layouts
+ *
+ * Reads a filter from
+ *  - the C header export of the Filter Design and Analysis Tool (.h, the initializer of the
+ *    first array, like fdacoefs.h)
+ *  - the text export of the tool (.txt, .fcf) or CSV (.csv): numbers separated by commas,
+ *    semicolons or white space, lines starting with '%' or '#' and words are skipped
+ *  - the binary format (.coef): UINT32 magic COEF_MAGIC, version 1, count, type (0 double,
+ *    1 INT16), followed by the count values, little endian
+ * Integer values are taken as Q15 as they are, fractional ones are scaled by 32768.
+ *
+ * The layouts the kernels use are prepared at load time: the Q15 taps zero padded to whole
+ * AVX-512 vectors and aligned for the Fir kernels (whose delay line runs from the newest
+ * sample, so the taps are in filter order), the first half of a symmetric filter for the
+ * folded kernel, and for long filters the spectra of the partitions for FftFir. All of them
+ * are stored in a cache file keyed by a hash of the source file, so a filter bank which
+ * has been loaded once starts without parsing or transforms. The cache file is written under
+ * a temporary name and renamed, so a reader never sees a partly written one.
+ */
+
+#pragma once
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "simd.h"
+#include "fft.h"
+
+using namespace std;
+
+#define COEF_MAGIC		0x454F4346			// 'FCOE', binary coefficient file
+#define COEF_CACHEMAGIC	0x48434346			// 'FCCH', cache file
+#define COEF_VERSION	1					// of the cache layout, older caches are rebuilt
+#define COEF_ALIGN		64					// bytes
+#define COEF_PAD		32					// taps, one AVX-512 vector of Q15 values
+#define COEF_FFTMIN		512					// filters at least this long get the FFT layout
+#define COEF_PART		256					// partition length of the FFT layout (in samples)
+#define COEF_CACHE		L"coefcache"		// default cache directory
+
+
+class FilterCoefs {
+public:
+	FilterCoefs(): q15_(NULL), fold_(NULL), spectra_(NULL), fSymmetric_(false), fCached_(false), partitions_(0) {
+		cache_[0] = L'\0';
+	}
+
+	/* from the Q15 arrays compiled in (fdacoefs*.h) */
+	FilterCoefs(const INT16 *h, size_t n): q15_(NULL), fold_(NULL), spectra_(NULL), fSymmetric_(false), fCached_(false), partitions_(0) {
+		cache_[0] = L'\0';
+		for (size_t i = 0; i < n; i++)
+			taps_.push_back(h[i]/32768.0);
+		prepare();
+	}
+
+	~FilterCoefs() {
+		free();
+	}
+
+	/* reads the filter, taking the layouts from the cache directory (if not NULL) when it has them */
+	HRESULT load(LPCWSTR filename, LPCWSTR cacheDir = COEF_CACHE) {
+		vector<char> file;
+
+		free();
+		if (!readFile(filename, file))
+			return E_FAIL;
+
+		// FNV-1a of the contents and the layout parameters
+		UINT64 key = 14695981039346656037ull;
+		for (size_t i = 0; i < file.size(); i++)
+			key = (key ^ (BYTE)file[i]) * 1099511628211ull;
+		key = (key ^ (COEF_VERSION << 24 | COEF_PAD << 16 | COEF_PART)) * 1099511628211ull;
+
+		if (cacheDir != NULL) {
+			swprintf(cache_, MAX_PATH, L"%ls\\%016llx.fcc", cacheDir, key);
+			if (readCache(cache_, key))
+				return S_OK;
+		}
+
+		HRESULT hr = parse(filename, file);
+		if (hr != S_OK)
+			return hr;
+
+		if (cacheDir != NULL) {
+			CreateDirectoryW(cacheDir, NULL);
+			writeCache(cache_, key);							// without a cache only the next start is slower
+		}
+
+		return S_OK;
+	}
+
+	size_t        length() const { return taps_.size(); }
+	const double *taps() const { return &taps_[0]; }
+
+	/* Q15 taps, padded() values zero padded to COEF_PAD and COEF_ALIGN aligned */
+	const INT16  *q15() const { return q15_; }
+	size_t        padded() const { return (length() + COEF_PAD-1) & ~(COEF_PAD-1); }
+
+	/* h[0..(length+1)/2-1] of a symmetric filter, padded and aligned like q15(), NULL if not symmetric */
+	bool          symmetric() const { return fSymmetric_; }
+	const INT16  *folded() const { return fold_; }
+	size_t        foldedLength() const { return (length() + 1)/2; }
+
+	/* constant group delay (in samples) of a linear phase filter, symmetric or antisymmetric
+	   apart from leading and trailing zero taps, -1 if the phase is not linear */
+	double groupDelay() const {
+		size_t a = 0, b = length();
+
+		while (a < b && q15_[a] == 0) a++;
+		while (b > a && q15_[b-1] == 0) b--;
+		if (a == b)
+			return 0.0;
+
+		bool fSym = true, fAnti = true;
+		for (size_t i = 0; i < (b-a+1)/2; i++) {
+			fSym  = fSym  && q15_[a+i] == q15_[b-1-i];
+			fAnti = fAnti && q15_[a+i] == -q15_[b-1-i];
+		}
+		return fSym || fAnti ? (a + b-1)/2.0 : -1.0;
+	}
+
+	/* partitions() spectra of COEF_PART+1 bins (FFT of COEF_PART taps and as many zeros), NULL if short */
+	const cfloat *spectra() const { return spectra_; }
+	UINT32        partitions() const { return partitions_; }
+
+	/* the layouts came from the cache */
+	bool          cached() const { return fCached_; }
+
+	/* cache file of the last load(), empty without a cache */
+	LPCWSTR       cacheFile() const { return cache_; }
+
+private:
+	void free() {
+		_aligned_free(q15_);
+		_aligned_free(fold_);
+		_aligned_free(spectra_);
+		q15_      = fold_ = NULL;
+		spectra_  = NULL;
+		taps_.clear();
+		cache_[0] = L'\0';
+		fCached_  = false;
+		fSymmetric_ = false;
+		partitions_ = 0;
+	}
+
+	static bool readFile(LPCWSTR filename, vector<char> &data) {
+		FILE *fp;
+		char  buf[4096];
+		size_t n;
+
+		if (_wfopen_s(&fp, filename, L"rb") != 0)
+			return false;
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+			data.insert(data.end(), buf, buf + n);
+		fclose(fp);
+
+		return true;
+	}
+
+	HRESULT parse(LPCWSTR filename, vector<char> &file) {
+		const wchar_t *ext = wcsrchr(filename, L'.');
+
+		if (ext != NULL && _wcsicmp(ext, L".coef") == 0) {
+			// binary
+			UINT32 hdr[4];
+
+			if (file.size() < sizeof(hdr))
+				return E_INVALIDARG;
+			memcpy(hdr, &file[0], sizeof(hdr));
+			size_t size = hdr[3] == 0 ? sizeof(double) : sizeof(INT16);
+			if (hdr[0] != COEF_MAGIC || hdr[1] != 1 || hdr[3] > 1 || hdr[2] == 0 || file.size() < sizeof(hdr) + hdr[2]*size)
+				return E_INVALIDARG;
+			for (UINT32 i = 0; i < hdr[2]; i++) {
+				if (hdr[3] == 0) {
+					double v;
+					memcpy(&v, &file[sizeof(hdr) + i*size], size);
+					taps_.push_back(v);
+				} else {
+					INT16 v;
+					memcpy(&v, &file[sizeof(hdr) + i*size], size);
+					taps_.push_back(v/32768.0);
+				}
+			}
+		} else {
+			bool fInteger = true;
+
+			file.push_back('\0');
+			char *p = &file[0], *end;
+
+			// C header: the initializer of the first array only
+			if (ext != NULL && _wcsicmp(ext, L".h") == 0) {
+				char *b = strchr(p, '{'), *e = b != NULL ? strchr(b, '}') : NULL;
+				if (e == NULL)
+					return E_INVALIDARG;
+				*e = '\0';
+				p  = b+1;
+			}
+
+			bool fLineStart = true;
+			while (*p != '\0') {
+				if (*p == '\n' || *p == '\r') {
+					fLineStart = true;
+					p++;
+				} else if (fLineStart && (*p == '%' || *p == '#')) {
+					while (*p != '\0' && *p != '\n')
+						p++;
+				} else if (strchr(" \t,;", *p) != NULL) {
+					p++;
+				} else {
+					double v = strtod(p, &end);
+
+					if (end == p) {
+						// a word (e.g. "Numerator:"), skip it
+						while (*p != '\0' && strchr(" \t,;\r\n", *p) == NULL)
+							p++;
+					} else {
+						taps_.push_back(v);
+						fInteger = fInteger && v == floor(v);
+						p = end;
+					}
+					fLineStart = false;
+				}
+			}
+			if (taps_.empty())
+				return E_INVALIDARG;
+
+			// all integers: Q15 values (a filter of only 0, 1 and -1 taps is taken as fractional)
+			double peak = 0.0;
+			for (size_t i = 0; i < taps_.size(); i++)
+				peak = max(peak, fabs(taps_[i]));
+			fInteger = fInteger && peak > 1.0;
+			if (fInteger)
+				for (size_t i = 0; i < taps_.size(); i++)
+					taps_[i] /= 32768.0;
+		}
+
+		prepare();
+		return S_OK;
+	}
+
+	/* builds the layouts from the taps */
+	void prepare() {
+		size_t n = length();
+
+		q15_ = alloc<INT16>(padded());
+		for (size_t i = 0; i < n; i++)
+			q15_[i] = sat16(taps_[i]*32768.0);
+
+		fSymmetric_ = true;
+		for (size_t i = 0; i < n/2; i++)
+			fSymmetric_ = fSymmetric_ && q15_[i] == q15_[n-1-i];
+		if (fSymmetric_) {
+			fold_ = alloc<INT16>((foldedLength() + COEF_PAD-1) & ~(COEF_PAD-1));
+			memcpy(fold_, q15_, foldedLength()*sizeof(INT16));
+		}
+
+		if (n >= COEF_FFTMIN) {
+			RealFft fft(2*COEF_PART);
+			float  *t = new float[2*COEF_PART];
+
+			partitions_ = (UINT32)((n + COEF_PART-1)/COEF_PART);
+			spectra_    = alloc<cfloat>(partitions_*(COEF_PART+1));
+			for (UINT32 p = 0; p < partitions_; p++) {
+				memset(t, 0, 2*COEF_PART*sizeof(float));
+				for (size_t i = 0; i < COEF_PART && p*COEF_PART + i < n; i++)
+					t[i] = (float)taps_[p*COEF_PART + i];
+				fft.forward(t, &spectra_[p*(COEF_PART+1)]);
+			}
+			delete [] t;
+		}
+	}
+
+	struct CacheHeader {
+		UINT32 magic, version;
+		UINT64 key;
+		UINT32 length, partitions, fSymmetric, reserved;
+	};
+
+	bool readCache(LPCWSTR filename, UINT64 key) {
+		CacheHeader hdr;
+		FILE       *fp;
+
+		if (_wfopen_s(&fp, filename, L"rb") != 0)
+			return false;
+		bool fOk = fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == COEF_CACHEMAGIC && hdr.version == COEF_VERSION && hdr.key == key && hdr.length > 0;
+		if (fOk) {
+			taps_.resize(hdr.length);
+			fSymmetric_ = hdr.fSymmetric != 0;
+			partitions_ = hdr.partitions;
+			q15_        = alloc<INT16>(padded());
+			fOk = fread(&taps_[0], sizeof(double), length(), fp) == length() && fread(q15_, sizeof(INT16), padded(), fp) == padded();
+			if (fOk && fSymmetric_) {
+				fold_ = alloc<INT16>((foldedLength() + COEF_PAD-1) & ~(COEF_PAD-1));
+				fOk   = fread(fold_, sizeof(INT16), foldedLength(), fp) == foldedLength();
+			}
+			if (fOk && partitions_ > 0) {
+				spectra_ = alloc<cfloat>(partitions_*(COEF_PART+1));
+				fOk      = fread(spectra_, sizeof(cfloat), partitions_*(COEF_PART+1), fp) == partitions_*(COEF_PART+1);
+			}
+		}
+		fclose(fp);
+
+		if (!fOk)
+			free();
+		fCached_ = fOk;
+		return fOk;
+	}
+
+	/* under a name of this thread first, so that processes loading the same filter at the same
+	   time do not write over each other, then renamed to the cache file */
+	bool writeCache(LPCWSTR filename, UINT64 key) {
+		CacheHeader hdr = { COEF_CACHEMAGIC, COEF_VERSION, key, (UINT32)length(), partitions_, fSymmetric_, 0 };
+		wchar_t     tmp[MAX_PATH];
+		FILE       *fp;
+
+		swprintf(tmp, MAX_PATH, L"%ls.%lu.%lu.tmp", filename, GetCurrentProcessId(), GetCurrentThreadId());
+		if (_wfopen_s(&fp, tmp, L"wb") != 0)
+			return false;
+		bool fOk = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+			&& fwrite(&taps_[0], sizeof(double), length(), fp) == length()
+			&& fwrite(q15_, sizeof(INT16), padded(), fp) == padded()
+			&& (!fSymmetric_ || fwrite(fold_, sizeof(INT16), foldedLength(), fp) == foldedLength())
+			&& (partitions_ == 0 || fwrite(spectra_, sizeof(cfloat), partitions_*(COEF_PART+1), fp) == partitions_*(COEF_PART+1));
+		fOk = fclose(fp) == 0 && fOk;
+
+		if (fOk && MoveFileExW(tmp, filename, MOVEFILE_REPLACE_EXISTING))
+			return true;
+		DeleteFileW(tmp);
+		return false;
+	}
+
+	template <class T> static T *alloc(size_t n) {
+		T *p = (T *)_aligned_malloc(n*sizeof(T), COEF_ALIGN);
+		memset(p, 0, n*sizeof(T));
+		return p;
+	}
+
+	vector<double> taps_;							// full scale 1.0
+	INT16         *q15_, *fold_;
+	cfloat        *spectra_;
+	bool           fSymmetric_, fCached_;
+	UINT32         partitions_;
+	wchar_t        cache_[MAX_PATH];
+};
@@ -2,32 +2,68 @@
 #include <windows.h>
 #include <math.h>
 #include "wavIO.h"
+#include "simd.h"
 #include "cirbuffer.h"
+#include "node.h"
 
 using namespace std;
 
 
-class Comb: private CircularBuffer {
+class Comb: public DspNode, private CircularBuffer {
 public:
-	Comb(size_t capacity, float rvt): CircularBuffer(capacity) {
+	Comb(size_t capacity, float rvt): CircularBuffer(capacity), rvt_(rvt) {
 		g = (INT16)(pow(0.001f, ((float)capacity/FS) / rvt) * 32767.0f);
 	}
 
 	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
-		for (UINT32 i = 0; i < samples; i++) {
-			INT16 delayedInput;
-			INT32 out;
+		__declspec(align(16)) INT16     wet[SIMD_BLOCK];
+		__declspec(align(16)) pcm_frame mix[SIMD_BLOCK];
 
-			delayedInput = read();
-			out = saturate(input[i].left + mpy(delayedInput, g));
-			write(out);
+		for (UINT32 i0 = 0, n; i0 < samples; i0 += n) {
+			n = min(samples - i0, (UINT32)SIMD_BLOCK);
 
-			output[i].left  = saturate(output[i].left + (out >> 2));
-			output[i].right = saturate(output[i].right + (out >> 2));
+			// the feedback loop is recursive, the mix to the output is vectorized
+			for (UINT32 i = 0; i < n; i++) {
+				INT16 delayedInput;
+				INT32 out;
+
+				delayedInput = read();
+				out = saturate(input[i0+i].left + mpyz(delayedInput, g));
+				write(out);
+
+				wet[i] = out >> 2;
+			}
+
+			simd().interleave(wet, wet, mix, n);
+			simd().q15Add((INT16 *)&output[i0], (INT16 *)mix, (INT16 *)&output[i0], 2*n);
 		}
 	}
 
+	void reset() {
+		clear();
+	}
+
+	const char *name() const { return "comb"; }
+
+	/* round trips for a full scale state to decay to 1/(1-g) LSB with the loop gain g, and then
+	   by at least 1 LSB per round trip (the feedback rounds toward zero) to 0 */
+	UINT32 tail() const {
+		return g > 0 ? ((UINT32)ceil(log(1.0/32768.0)/log(g/32768.0)) + (UINT32)ceil(1.0/(1.0 - g/32768.0)) + 1)*(UINT32)capacity() : (UINT32)capacity();
+	}
+
+	/* the feedback decays by 60 dB in rvt seconds */
+	UINT32 preroll(double decayDb) const { return (UINT32)ceil(rvt_*FS*decayDb/60.0) + (UINT32)capacity(); }
+
+	/* the loop dies out, but the rounding of each round trip, up to 1 LSB, adds up to 1/(1-g)
+	   LSB of the state in two runs from different states; the output is the state / 4, truncated
+	   again */
+	double limitCycle() const { return 1.0/(1.0 - g/32768.0)/4.0 + 1.0; }
+
+	/* loop gain (Q15) */
+	INT16 gain() const { return g; }
+
 private:
 	INT16 g;
+	float rvt_;
 };
 
@@ -18,12 +18,20 @@
 
 #define FS			44100	// sampling rate (Hz)
 #define TIMINGS		100		// number of timing measurements taken
+#define GAINRAMP	512		// gain change smoothing time (in samples)
+#define MAXFRAMES	4096	// largest block handled in one pass by the crossfade and gain stages
+#define ECHOTAIL	8820	// longest echo path cancelled (in samples, 200 ms)
+#define AECBLOCK	128		// partition of the frequency domain canceller until it has been planned (in samples)
+#define NLMSTAPS	1024	// echo path of the time domain canceller (in samples, 23 ms)
+#define PLANFRAMES	8192	// length of the kernel timing runs (in frames)
+#define SWAPPOLL	10		// chain builder polling interval while the new chain fades in (in ms)
+
+static const float eqFreqs[] = { 60.0f, 250.0f, 1000.0f, 4000.0f, 12000.0f };	// default spectral EQ curve
+static const float eqGains[] = {  4.0f,   1.0f,    0.0f,   -2.0f,     3.0f };
 
 
 inline INT16 MyAudio::round(double x) {
-   //assert(x >= INT16_MIN-0.5);
-   //assert(x <= INT16_MAX+0.5);
-   return (int) (x >= 0 ? (x+0.5) : (x-0.5));
+	return sat16(x);
 }
 
 inline INT16 MyAudio::sinewave() {
@@ -35,11 +43,16 @@ inline INT16 MyAudio::sinewave() {
 	return round(32767*y);
 }
 
-MyAudio::MyAudio(): mode(filter_mode),
+MyAudio::MyAudio(): nPending(0), streamPos(0), outLatency(0), mode(filter_mode), prevMode(filter_mode), nextMode(filter_mode), xfadePos(XFADE),
+					gain(1.0f, GAINRAMP),
+					blockSize(0),
+					aec(new Pbfdaf(ECHOTAIL, AECBLOCK)), fAec(false), fAecReset(false),
+					fLimiter(false), fMeter(false),
 				    fir((void *)B, BL), fir1((void *)B1, BL12), fir2((void *)B2, BL12),
-					comb1(5239, 1.0f), comb2(6544, 1.0f), comb3(7250, 1.0f), comb4(7708, 1.0f),
-					ap1(220, 96.83e-3f), ap2(75, 32.92e-3f),
 					chorus(1600, 2.0f, 0.9f),
+					fdn(1.0f),
+					eq(eqFreqs, eqGains, sizeof(eqFreqs)/sizeof(eqFreqs[0])),
+					bandmix("bandmix", MAXFRAMES, true), chain(SWAP_FADE, MAXFRAMES), fBuilding(false), fClosing(false), buildVariant(0), swapVariant(0),
 					frame_cnt(0),
 					frames(0), state(wait),
 					wavfile(NULL),
@@ -48,9 +61,32 @@ MyAudio::MyAudio(): mode(filter_mode),
 
 	y2 = sin(2.0*M_PI/40*0);
 	y1 = sin(2.0*M_PI/40*1);
+
+	scratch  = new pcm_frame[MAXFRAMES];
+	ramp     = new float[MAXFRAMES];
+	echoFree = new pcm_frame[MAXFRAMES];
+	dynL     = new float[MAXFRAMES];
+	dynR     = new float[MAXFRAMES];
+
+	MakeBandmix(&bandmix);
+
+	chain.publish(MakeChain(0));
+	chain.update();
+	pluginFile[0] = coefsFile[0] = L'\0';
 }
 
 MyAudio::~MyAudio() {
+	// let a running chain builder finish before the chain is deleted
+	fClosing = true;
+	while (fBuilding)
+		Sleep(SWAPPOLL);
+
+	delete [] scratch;
+	delete [] ramp;
+	delete [] echoFree;
+	delete [] dynL;
+	delete [] dynR;
+	delete aec;
 }
 
 HRESULT MyAudio::GetFormat(WAVEFORMATEX **pwfx) {
@@ -84,15 +120,23 @@ HRESULT MyAudio::ProcessData(UINT32 bufferFrameCount, BYTE *pCaptureData, DWORD
 	pcm_frame *pInput  = (pcm_frame *)pCaptureData,
  		      *pOutput = (pcm_frame *)pRenderData;
 	bool fSample = false;
+	LARGE_INTEGER t;
+
+	if (recorder.opened())
+		QueryPerformanceCounter(&t);
 
 	if (wavfile != NULL)
 		wavfile->LoadData(bufferFrameCount, pCaptureData, captureFlags);
 
-	switch (mode) {
-	case filter_mode:
-	case test_mode:
-		*renderFlags = 0;
+	// take the parameter changes given by the user interface thread, they are applied at their frames
+	drainParams();
+	UINT64 pos = streamPos.load(memory_order_relaxed);
+
+	// a newly built chain starts at a block boundary, also while the chain mode is not on
+	if (chain.update() && recorder.opened())
+		recorder.param(chain_param, swapVariant.load(memory_order_relaxed), pos);
 
+	if (mode == filter_mode || mode == test_mode || mode == reverb_mode || mode == chain_mode) {
 		// timing measurements
 		switch (state) {
 		case wait:
@@ -123,41 +167,133 @@ HRESULT MyAudio::ProcessData(UINT32 bufferFrameCount, BYTE *pCaptureData, DWORD
 		default:
 			break;
 		}
+	}
 
-		// then process all frames
-		if (fSample) time.Start();
-		if (mode == filter_mode) {
-			float d = 0.0f;
-			UINT32 i;
-
-			fir1.process(pInput, pOutput, bufferFrameCount);
-			for (i = 0; i < bufferFrameCount; i++)
-				d += fabs((pOutput[i].left + pOutput[i].right) / 32768.0f);
-
-			fir2.process(pInput, pOutput, bufferFrameCount);
-			for (i = 0; i < bufferFrameCount; i++)
-				d -= fabs((pOutput[i].left + pOutput[i].right) / 32768.0f);
-
-			//printf("Value %f\n", fabs(d));
-			if (fabs(d) > 24.0f)
-				*renderFlags = AUDCLNT_BUFFERFLAGS_SILENT;
-			//fir.process(pInput, pOutput, bufferFrameCount);
-			//chorus.process(pInput, pOutput, bufferFrameCount);
-	    } else {
-			memset(pOutput, 0, bufferFrameCount*sizeof(pcm_frame));
-			comb1.process(pInput, pOutput, bufferFrameCount);
-			comb2.process(pInput, pOutput, bufferFrameCount);
-			comb3.process(pInput, pOutput, bufferFrameCount);
-			comb4.process(pInput, pOutput, bufferFrameCount);
-
-			ap1.process(pOutput, pOutput, bufferFrameCount);
-			ap2.process(pOutput, pOutput, bufferFrameCount);
+	// then process all frames
+	if (fSample) time.Start();
+	UINT32 refFrom = 0;									// first frame of the echo reference
+	for (UINT32 j = 0, n; j < bufferFrameCount; j += n, pos += n) {
+		// the block is split only where a scheduled change takes effect
+		n = applyParams(pos, min(bufferFrameCount - j, (UINT32)MAXFRAMES));
+
+		// a mode change waits for the end of an ongoing crossfade, so that the fade stays continuous
+		if (xfadePos == XFADE && nextMode != mode) {
+			prevMode = mode;
+			mode     = nextMode;
+			xfadePos = 0;
+		} else if (xfadePos < XFADE && nextMode != mode) {
+			n = min(n, (UINT32)(XFADE - xfadePos));		// the next one starts where this one ends
 		}
-		if (fSample) {
-			time.Stop();
-			frames += bufferFrameCount;
-			state = measureA;
+		pcm_frame *pIn  = &pInput[j],
+			      *pOut = &pOutput[j];
+		DWORD      flags;
+
+		if (fAecReset) {
+			refFrom   = j;
+			fAecReset = false;
 		}
+
+		// remove the echo of the earlier rendered frames from the capture
+		if (fAec) {
+			aec->process(pIn, echoFree, n);
+			pIn = echoFree;
+		}
+
+		flags = render(mode, n, pIn, pOut);
+
+		// crossfade from the previous mode output to the current one
+		if (xfadePos < XFADE) {
+			render(prevMode, n, pIn, scratch);
+			UINT32 m = min(n, (UINT32)(XFADE - xfadePos));
+			simd().rampFill(ramp, 0.0f, 1.0f/XFADE, xfadePos, m);		// t = xfadePos/XFADE, xfadePos+1..
+			for (UINT32 i = m; i < n; i++)
+				ramp[i] = 1.0f;
+			xfadePos += m;
+			simd().xfade(pOut, scratch, ramp, pOut, n);
+			if (xfadePos < XFADE)
+				flags &= ~AUDCLNT_BUFFERFLAGS_SILENT;	// stop only after the fade out has been played
+		}
+
+		// output gain, followed by the limiter or by clipping
+		if (fLimiter) {
+			gain.ramp(ramp, n);
+			for (UINT32 i = 0; i < n; i++) {
+				dynL[i] = ramp[i]*pOut[i].left;
+				dynR[i] = ramp[i]*pOut[i].right;
+			}
+			limiter.apply(dynL, dynR, n);
+			simd().f32ToPcm(dynL, dynR, pOut, n);
+		} else if (gain.isSmoothing() || gain.value() != 1.0f) {
+			gain.ramp(ramp, n);
+			simd().applyGain(pOut, ramp, pOut, n);
+		}
+
+		if (fMeter)
+			meter.process(pOut, pOut, n);
+
+		if (tap.opened())
+			tap.write(pOut, n);
+
+		if (j == 0)
+			*renderFlags = flags;
+		else
+			*renderFlags |= flags;
+	}
+	// the echo reference is what the device plays, silence if any part of the block asked for it
+	if (fAec && bufferFrameCount != 0)
+		aec->reference((*renderFlags & AUDCLNT_BUFFERFLAGS_SILENT) != 0 ? NULL : &pOutput[refFrom], bufferFrameCount - refFrom);
+
+	// after the changes applied in the block, so that a replay posts them before the block
+	if (recorder.opened())
+		recorder.block(t, pInput, bufferFrameCount, *captureFlags);
+
+	streamPos.store(pos, memory_order_relaxed);
+	outLatency.store(modeLatency(mode) + (fLimiter ? limiter.latency() : 0), memory_order_relaxed);
+	if (fSample) {
+		time.Stop();
+		frames += bufferFrameCount;
+		state = measureA;
+	}
+
+	return S_OK;
+}
+
+/* process one block with the given mode, returns the render flags of the block */
+DWORD MyAudio::render(dsp_mode mode, UINT32 bufferFrameCount, pcm_frame *pInput, pcm_frame *pOutput) {
+	DWORD renderFlags = 0;
+
+	switch (mode) {
+	case filter_mode: {
+		float d = 0.0f;
+
+		fir1Idle.process(&fir1, pInput, pOutput, bufferFrameCount);
+		d += simd().absSum(pOutput, bufferFrameCount) / 32768.0f;
+
+		fir2Idle.process(&fir2, pInput, pOutput, bufferFrameCount);
+		d -= simd().absSum(pOutput, bufferFrameCount) / 32768.0f;
+
+		//printf("Value %f\n", fabs(d));
+		if (fabs(d) > DETECT_LIMIT)
+			renderFlags = AUDCLNT_BUFFERFLAGS_SILENT;
+		//fir.process(pInput, pOutput, bufferFrameCount);
+		//chorus.process(pInput, pOutput, bufferFrameCount);
+		break;
+	}
+
+	case test_mode:
+		reverbIdle.process(&reverb, pInput, pOutput, bufferFrameCount);
+		break;
+
+	case reverb_mode:
+		fdn.process(pInput, pOutput, bufferFrameCount);
+		break;
+
+	case plugin_mode:
+		plugin.process(pInput, pOutput, bufferFrameCount);
+		break;
+
+	case chain_mode:
+		chain.process(pInput, pOutput, bufferFrameCount);
 		break;
 
 	case passthru_mode:
@@ -175,28 +311,160 @@ HRESULT MyAudio::ProcessData(UINT32 bufferFrameCount, BYTE *pCaptureData, DWORD
 		break;
 
 	default:
-		*renderFlags = AUDCLNT_BUFFERFLAGS_SILENT;
+		memset(pOutput, 0, bufferFrameCount*sizeof(pcm_frame));
+		renderFlags = AUDCLNT_BUFFERFLAGS_SILENT;
 		break;
 	}
 
-	return S_OK;
+	return renderFlags;
 }
 
-HRESULT MyAudio::SetMode(dsp_mode mode) {
-	this->mode = mode;
+/* delay of the output of the given mode (in samples) as reported by its blocks */
+UINT32 MyAudio::modeLatency(dsp_mode mode) const {
+	switch (mode) {
+	case filter_mode:	return fir2.latency();
+	case test_mode:		return reverb.latency();
+	case reverb_mode:	return fdn.latency();
+	case plugin_mode:	return plugin.latency();
+	case chain_mode:	return chain.latency();
+	default:			return 0;
+	}
+}
 
-	return S_OK;
+/* called by the audio thread at the block boundary, moves the posted changes to the pending
+   list in time order (the changes of the same frame in the posting order) */
+void MyAudio::drainParams() {
+	ParamMsg msg;
+
+	while (nPending < PARAM_EVENTS && params.pop(msg)) {
+		UINT32 i = nPending++;
+
+		for (; i > 0 && pending[i-1].frame > msg.frame; i--)
+			pending[i] = pending[i-1];
+		pending[i] = msg;
+	}
+}
+
+/* applies the pending changes due at stream time pos (late ones at once), returns the number
+   of frames up to the next change, at most frames */
+UINT32 MyAudio::applyParams(UINT64 pos, UINT32 frames) {
+	UINT32 k = 0;
+
+	for (; k < nPending && pending[k].frame <= pos; k++) {
+		applyParam(pending[k]);
+		if (recorder.opened())
+			recorder.param(pending[k].id, pending[k].value, pos);
+	}
+	if (k > 0) {
+		nPending -= k;
+		memmove(pending, &pending[k], nPending*sizeof(ParamMsg));
+	}
+
+	return nPending > 0 ? (UINT32)min((UINT64)frames, pending[0].frame - pos) : frames;
+}
+
+void MyAudio::applyParam(const ParamMsg &msg) {
+	switch (msg.id) {
+	case mode_param:
+		nextMode = (dsp_mode)(int)msg.value;		// taken by ProcessData, see there
+		break;
+
+	case frequency_param:
+		retune(msg.value);
+		break;
+
+	case gain_param:
+		gain.set((float)pow(10.0, msg.value/20.0));
+		break;
+
+	case aec_param:
+		fAec = msg.value != 0.0;
+		if (fAec) {
+			aec->reset();	// render and capture streams are aligned from this frame on
+			fAecReset = true;
+		}
+		break;
+
+	case limiter_param:
+		if ((msg.value != 0.0) != fLimiter) {
+			fLimiter = msg.value != 0.0;
+			limiter.reset();
+		}
+		break;
+	}
+}
+
+/* change the resonator frequency without a phase or amplitude jump */
+void MyAudio::retune(double frq) {
+	double th0 = acos(w), th = 2.0*M_PI*(frq/FS);
+
+	if (fabs(sin(th0)) > 1e-9) {
+		double c = (y1*w - y2) / sin(th0);		// cosine of the current phase
+
+		w  = cos(th);
+		y2 = y1*w - c*sin(th);
+	} else {
+		// degenerate resonator (DC or Nyquist), restart it
+		w  = cos(th);
+		y2 = sin(th*0);
+		y1 = sin(th*1);
+	}
+}
+
+/* the changes take effect at the given stream time (see GetPosition()), PARAM_NOW or a past
+   time at the next block; changes for the future must be posted before their block is processed */
+HRESULT MyAudio::postParam(dsp_param id, double value, UINT64 frame) {
+	ParamMsg msg = { id, value, frame };
+
+	return params.push(msg) ? S_OK : E_FAIL;
+}
+
+HRESULT MyAudio::SetMode(dsp_mode mode, UINT64 frame) {
+	return postParam(mode_param, (double)mode, frame);
+}
+
+HRESULT MyAudio::SetSineWaveFrequency(double frq, UINT64 frame) {
+	return postParam(frequency_param, frq, frame);
+}
+
+HRESULT MyAudio::SetGain(double dB, UINT64 frame) {
+	return postParam(gain_param, dB, frame);
 }
 
-HRESULT MyAudio::SetSineWaveFrequency(double frq) {
-	w = cos(2.0*M_PI*(frq/FS));
+HRESULT MyAudio::SetEchoCanceller(bool fEnable, UINT64 frame) {
+	return postParam(aec_param, fEnable ? 1.0 : 0.0, frame);
+}
+
+/* kind of the echo canceller and the bulk delay between the render and the capture, before the
+   streaming; the delay must exceed the device block plus the canceller block */
+HRESULT MyAudio::SetEchoPath(aec_kind kind, UINT32 delay) {
+	if (delay == 0 || delay > FS)
+		return E_INVALIDARG;
+	UINT32 partition = aec->block() != 0 ? aec->block() : AECBLOCK;	// the planned one is kept
 
-	y2 = sin(2.0*M_PI*(frq/FS)*0);
-	y1 = sin(2.0*M_PI*(frq/FS)*1);
+	delete aec;
+	aec = MakeEcho(kind == nlms_aec ? 0 : partition, delay);
 
 	return S_OK;
 }
 
+/* the time domain canceller for partition 0, otherwise the frequency domain one */
+EchoCanceller *MyAudio::MakeEcho(UINT32 partition, UINT32 delay) {
+	if (partition == 0)
+		return new Nlms(NLMSTAPS, 0.5f, delay);
+	return new Pbfdaf(ECHOTAIL, partition, 0.5f, delay);
+}
+
+HRESULT MyAudio::SetLimiter(bool fEnable, UINT64 frame) {
+	return postParam(limiter_param, fEnable ? 1.0 : 0.0, frame);
+}
+
+/* latest reading of the output loudness meter, S_FALSE before the first 100 ms have been played
+   or if the meter is not enabled */
+HRESULT MyAudio::GetLoudness(LoudnessReading *reading) const {
+	return meter.reading(*reading) ? S_OK : S_FALSE;
+}
+
 HRESULT MyAudio::GetPerformance(double *period, double *dsptime, int *frames) {
 	if (this->frames != 0) {
 		*period  = this->period.Elapsed();
@@ -229,4 +497,262 @@ HRESULT MyAudio::SignalResponce(bool fStep, double *h, int *n) {
 	*n = len;
 
 	return S_OK;
-}
\ No newline at end of file
+}
+/* selects the fastest variant of every block which has alternatives, measured only if the plan has no choice yet */
+HRESULT MyAudio::Plan(Planner &planner) {
+	pcm_frame *in = new pcm_frame[PLANFRAMES], *out = new pcm_frame[PLANFRAMES];
+	UINT32     s  = 1;
+	char       key[32];
+
+	for (UINT32 i = 0; i < PLANFRAMES; i++) {
+		s = s*1664525 + 1013904223;
+		in[i].left = in[i].right = (INT16)(s >> 17);
+	}
+
+	// FIR kernels, the filters of the same length share a choice
+	static const int kernels[] = { fir_scalar, fir_ssse3, fir_avx2, fir_folded };
+	Fir *firs[] = { &fir, &fir1, &fir2 };
+	for (int f = 0; f < sizeof(firs)/sizeof(firs[0]); f++) {
+		Fir *p = firs[f];
+
+		sprintf_s(key, sizeof(key), "fir%u.kernel", (UINT32)p->length());
+		int k = planner.choose(key, kernels, sizeof(kernels)/sizeof(kernels[0]), [&](int i) {
+			if (!p->setKernel((fir_kernel)kernels[i]))
+				return -1.0;
+			return Planner::measure([&]() { p->process(in, out, PLANFRAMES); });
+		});
+		if (k < 0 || !p->setKernel((fir_kernel)k))
+			p->setKernel(fir_ssse3);						// planned on a wider instruction set than allowed now
+		p->reset();
+	}
+
+	// echo canceller partition size: longer partitions need fewer but larger transforms (the NLMS has none)
+	static const int partitions[] = { 64, 128, 256 };
+	if (aec->block() != 0) {
+		int b = planner.choose("aec.partition", partitions, sizeof(partitions)/sizeof(partitions[0]), [&](int i) {
+			Pbfdaf c(ECHOTAIL, partitions[i]);
+			return Planner::measure([&]() {
+				c.reference(in, PLANFRAMES);
+				c.process(in, out, PLANFRAMES);
+			});
+		});
+		if (b > 0 && (UINT32)b != aec->block()) {
+			UINT32 delay = aec->delay();
+			delete aec;
+			aec = MakeEcho(b, delay);
+		}
+	}
+
+	delete [] in;
+	delete [] out;
+	return S_OK;
+}
+
+/* device block used by the low latency stream, must be set before the streaming starts */
+HRESULT MyAudio::SetBlockSize(UINT32 frames) {
+	if (frames > MAXFRAMES)
+		return E_INVALIDARG;
+	blockSize = frames;
+
+	return S_OK;
+}
+
+/* loads a processing module (see dspplugin.h) for the plugin mode, before the streaming starts */
+HRESULT MyAudio::LoadPlugin(LPCWSTR filename) {
+	HRESULT hr = plugin.load(filename);
+
+	if (hr == S_OK && _wfullpath(pluginFile, filename, MAX_PATH) == NULL)
+		wcscpy_s(pluginFile, MAX_PATH, filename);
+	return hr;
+}
+
+/* makes the output available to other processes through the named shared memory transport, before the streaming starts */
+HRESULT MyAudio::Publish(LPCWSTR name) {
+	return tap.create(name, SHM_FRAMES, FS);
+}
+
+/* starts recording the input blocks and the parameter changes to the given file (before the streaming) */
+HRESULT MyAudio::Capture(LPCWSTR filename) {
+	CaptureSetup setup;
+
+	GetSetup(&setup);
+	return recorder.open(filename, setup);
+}
+
+/* the setup made before the streaming: the planned kernels and partition, the module, the coefficients */
+void MyAudio::GetSetup(CaptureSetup *setup) {
+	memset(setup, 0, sizeof(*setup));
+	setup->firKernel[0] = fir.kernel();
+	setup->firKernel[1] = fir1.kernel();
+	setup->firKernel[2] = fir2.kernel();
+	setup->aecPartition = aec->block();
+	setup->aecDelay     = aec->delay();
+	setup->chainFade    = chain.fade();
+	wcscpy_s(setup->plugin, MAX_PATH, pluginFile);
+	wcscpy_s(setup->coefs, MAX_PATH, coefsFile);
+}
+
+/* makes the setup of GetSetup() (of a recorded session) on a new object, before the streaming */
+HRESULT MyAudio::Setup(const CaptureSetup &setup) {
+	Fir *firs[] = { &fir, &fir1, &fir2 };
+	for (int f = 0; f < 3; f++)
+		if (!firs[f]->setKernel((fir_kernel)setup.firKernel[f]))
+			firs[f]->setKernel(fir_ssse3);				// all kernels give the same output
+	if (setup.aecPartition != aec->block() || setup.aecDelay != aec->delay()) {
+		delete aec;
+		aec = MakeEcho(setup.aecPartition, setup.aecDelay);
+	}
+	chain.setFade(setup.chainFade);
+
+	HRESULT hr;
+	if (setup.plugin[0] != L'\0' && (hr = LoadPlugin(setup.plugin)) != S_OK)
+		return hr;
+	if (setup.coefs[0] != L'\0' && (hr = LoadCoefficients(setup.coefs)) != S_OK)
+		return hr;
+
+	return S_OK;
+}
+
+/* a block dropped by the device loop, recorded so that a replay knows of it */
+void MyAudio::CaptureOverrun(UINT32 frames, UINT32 padding) {
+	if (recorder.opened())
+		recorder.overrun(frames, padding);
+}
+
+/* detector of the filter mode for many streams (see sessions.h) */
+DetectorBank *MyAudio::MakeDetectorBank(UINT32 capacity, UINT32 block) {
+	return new DetectorBank((const INT16 *)B1, (const INT16 *)B2, BL12, capacity, block);
+}
+
+/* builds the processing chain of the given variant, the band-pass filters alternate and every
+   other variant adds the oversampled waveshaper */
+DspNode *MyAudio::MakeChain(int variant) {
+	Chain *c = new Chain("chain", MAXFRAMES, true);
+
+	if (variant & 1)
+		c->add(new Fir((void *)B2, BL12));
+	else
+		c->add(new Fir((void *)B1, BL12));
+	if (variant & 2)
+		c->add(new Waveshaper(4, 6.0f, -3.0f));
+
+	return c;
+}
+
+/* the dry signal and the fir1 band, equally mixed */
+Parallel *MyAudio::MakeBandmix(Parallel *p) {
+	p->add(new Chain("dry"), 0.5f);
+	p->add(new Fir((void *)B1, BL12), 0.5f);
+
+	return p;
+}
+
+/* new instance of the named block for the offline processing (fir, fir1, fir2, reverb, bandmix
+   or chain), NULL if there is no such block */
+DspNode *MyAudio::MakeNode(const char *name) {
+	if (strcmp(name, "fir") == 0)
+		return new Fir((void *)B, BL);
+	if (strcmp(name, "fir1") == 0)
+		return new Fir((void *)B1, BL12);
+	if (strcmp(name, "fir2") == 0)
+		return new Fir((void *)B2, BL12);
+	if (strcmp(name, "reverb") == 0)
+		return new Reverb;
+	if (strcmp(name, "bandmix") == 0)
+		return MakeBandmix(new Parallel("bandmix", MAXFRAMES, true));
+	if (strcmp(name, "chain") == 0)
+		return MakeChain(0);
+
+	return NULL;
+}
+
+/* filter of the coefficients, by fast convolution if they have the FFT layout */
+DspNode *MyAudio::MakeFilter(const FilterCoefs &coefs) {
+	if (coefs.spectra() != NULL)
+		return new FftFir(coefs);
+	return new Fir(coefs);
+}
+
+/* replaces the chain of the chain mode, the old one fades out and is deleted by a later call (not on the audio thread) */
+HRESULT MyAudio::SwapChain(DspNode *chain, int variant) {
+	this->chain.collect();
+	swapVariant.store(variant, memory_order_relaxed);
+	this->chain.publish(chain);
+
+	return S_OK;
+}
+
+/* replaces the chain of the chain mode with the filter of the file (see coefs.h), long filters
+   by fast convolution, taps and fCached (if not NULL) tell its length and if the layouts came from the cache */
+HRESULT MyAudio::LoadCoefficients(LPCWSTR filename, size_t *taps, bool *fCached) {
+	FilterCoefs coefs;
+
+	HRESULT hr = coefs.load(filename);
+	if (hr != S_OK)
+		return hr;
+
+	Chain *c = new Chain("chain", MAXFRAMES, true);
+	c->add(MakeFilter(coefs));
+
+	if (taps != NULL)
+		*taps = coefs.length();
+	if (fCached != NULL)
+		*fCached = coefs.cached();
+	if (_wfullpath(coefsFile, filename, MAX_PATH) == NULL)
+		wcscpy_s(coefsFile, MAX_PATH, filename);
+
+	return SwapChain(c);
+}
+
+/* crossfade length of the following chain swaps (in blocks, 0 switches at once) */
+void MyAudio::SetChainFade(UINT32 blocks) {
+	chain.setFade(blocks);
+}
+
+/* builds the chain of the given variant on a background thread and swaps it in, E_PENDING if the previous build is still running */
+HRESULT MyAudio::BuildChain(int variant) {
+	bool fIdle = false;
+
+	if (!fBuilding.compare_exchange_strong(fIdle, true))
+		return E_PENDING;
+	buildVariant = variant;
+
+	HANDLE hThread = CreateThread(NULL, 0, ChainBuilder, this, 0, NULL);
+	if (hThread == NULL) {
+		fBuilding = false;
+		return E_FAIL;
+	}
+	CloseHandle(hThread);
+
+	return S_OK;
+}
+
+DWORD WINAPI MyAudio::ChainBuilder(LPVOID pContext) {
+	MyAudio *p = (MyAudio *)pContext;
+
+	p->SwapChain(MakeChain(p->buildVariant), p->buildVariant);
+
+	// the old chain is deleted here once the new one has faded in (at the next block if the chain is not heard)
+	while (p->chain.swapping() && !p->fClosing)
+		Sleep(SWAPPOLL);
+	p->chain.collect();
+
+	p->fBuilding = false;
+	return 0;
+}
+
+/* returns the processing block with the given name (for the analysis), NULL if there is no such block */
+DspNode *MyAudio::GetNode(const char *name) {
+	DspNode *nodes[] = { &fir, &fir1, &fir2, &reverb, &fdn, &chorus, &denoise, &gate, &eq, &compressor, &limiter, &waveshaper, &plugin, &chain, &bandmix };
+	const char *names[] = { "fir", "fir1", "fir2", "reverb", "fdn", "chorus", "denoise", "gate", "eq", "compressor", "limiter", "waveshaper", "plugin", "chain", "bandmix" };
+
+	// the offline processing has no blocks of the stream, the latest chain is taken at once
+	if (strcmp(name, "chain") == 0)
+		chain.update();
+
+	for (int i = 0; i < sizeof(nodes)/sizeof(nodes[0]); i++)
+		if (strcmp(name, names[i]) == 0)
+			return nodes[i];
+
+	return NULL;
+}
@@ -2,16 +2,43 @@
 #define _DSP_H
 #include <windows.h>
 #include "fir.h"
-#include "comb.h"
-#include "allpass.h"
+#include "fftfir.h"
+#include "reverb.h"
+#include "fdn.h"
 #include "chorus.h"
+#include "spectral.h"
+#include "dynamics.h"
+#include "waveshaper.h"
+#include "analyzer.h"
+#include "aec.h"
+#include "plugin.h"
+#include "swap.h"
+#include "shmring.h"
+#include "sessions.h"
+#include "segment.h"
+#include "loudness.h"
+#include "capture.h"
 #include "wavIO.h"
 #include "timer.h"
+#include "params.h"
+#include "planner.h"
 
 using namespace std;
 
 
-enum dsp_mode {passthru_mode, filter_mode, sinewave_mode, test_mode, stop_mode};
+enum dsp_mode {passthru_mode, filter_mode, sinewave_mode, test_mode, reverb_mode, plugin_mode, chain_mode, stop_mode};
+enum dsp_param {mode_param, frequency_param, gain_param, aec_param, limiter_param, chain_param};	// chain_param is only recorded
+
+#define PARAM_NOW		0		// event time of the changes which take effect at the next block
+#define PARAM_EVENTS	64		// scheduled changes waiting for their time
+#define XFADE			1024	// mode change crossfade length (in samples)
+
+// parameter change message from the user interface thread to the audio thread
+struct ParamMsg {
+	dsp_param id;
+	double    value;
+	UINT64    frame;		// stream time (in frames) at which the change takes effect
+};
 
 class MyAudio {
 public:
@@ -21,23 +48,94 @@ public:
 	HRESULT SetWavFileName(LPCWSTR name);
 	HRESULT GetFormat(WAVEFORMATEX **pwfx);
 	HRESULT ProcessData(UINT32 bufferFrameCount, BYTE *pCaptureData, DWORD *captureFlags, BYTE *pRenderData, DWORD *renderFlags);
-	HRESULT SetMode(dsp_mode mode);
+	HRESULT SetMode(dsp_mode mode, UINT64 frame = PARAM_NOW);
 	HRESULT SignalResponce(bool fStep, double *h, int *n);
-	HRESULT SetSineWaveFrequency(double frq);
+	DspNode *GetNode(const char *name);
+	HRESULT SetSineWaveFrequency(double frq, UINT64 frame = PARAM_NOW);
+	HRESULT SetGain(double dB, UINT64 frame = PARAM_NOW);
+	HRESULT SetEchoCanceller(bool fEnable, UINT64 frame = PARAM_NOW);
+	HRESULT SetEchoPath(aec_kind kind, UINT32 delay = AEC_DELAY);
+	HRESULT SetLimiter(bool fEnable, UINT64 frame = PARAM_NOW);
+	UINT64  GetPosition() const { return streamPos.load(memory_order_relaxed); }
+	UINT32  GetLatency() const { return outLatency.load(memory_order_relaxed); }
+	HRESULT GetLoudness(LoudnessReading *reading) const;
 	HRESULT GetPerformance(double *period, double *dsptime, int *frames);
+	HRESULT Plan(Planner &planner);
+	HRESULT SetBlockSize(UINT32 frames);
+	HRESULT LoadPlugin(LPCWSTR filename);
+	HRESULT Publish(LPCWSTR name);
+	HRESULT Capture(LPCWSTR filename);
+	void    GetSetup(CaptureSetup *setup);
+	HRESULT Setup(const CaptureSetup &setup);
+	void    CaptureOverrun(UINT32 frames, UINT32 padding);
+	UINT32  GetCaptureLost() const { return recorder.lost(); }
+	HRESULT BuildChain(int variant);
+	HRESULT SwapChain(DspNode *chain, int variant = -1);
+	void    SetChainFade(UINT32 blocks);
+	void    EnableMeter(bool fEnable) { fMeter = fEnable; }	// before the streaming
+	HRESULT LoadCoefficients(LPCWSTR filename, size_t *taps = NULL, bool *fCached = NULL);
+	static DspNode *MakeChain(int variant);
+	static DspNode *MakeNode(const char *name);
+	static DspNode *MakeFilter(const FilterCoefs &coefs);
+	static Parallel *MakeBandmix(Parallel *p);
+	static DetectorBank *MakeDetectorBank(UINT32 capacity, UINT32 block = SESSION_BLOCK);
+	static EchoCanceller *MakeEcho(UINT32 partition, UINT32 delay = AEC_DELAY);
+	UINT32  GetBlockSize() const { return blockSize; }
 
 	int error() const { return error_line; }
 
 private:
 	inline INT16 round(double x);
 	inline INT16 sinewave();
+	void  retune(double frq);
+	void  drainParams();
+	UINT32 applyParams(UINT64 pos, UINT32 frames);
+	void  applyParam(const ParamMsg &msg);
+	HRESULT postParam(dsp_param id, double value, UINT64 frame);
+	static DWORD WINAPI ChainBuilder(LPVOID pContext);
+	DWORD render(dsp_mode mode, UINT32 bufferFrameCount, pcm_frame *pInput, pcm_frame *pOutput);
+	UINT32 modeLatency(dsp_mode mode) const;
 
-	volatile dsp_mode  mode;
+	SpscQueue<ParamMsg, 64> params;
+	ParamMsg           pending[PARAM_EVENTS];	// drained changes in time order (audio thread)
+	UINT32             nPending;
+	atomic<UINT64>     streamPos;		// frames processed since the start
+	atomic<UINT32>     outLatency;		// processing latency of the output (in samples)
+	dsp_mode           mode, prevMode;	// owned by the audio thread
+	dsp_mode           nextMode;		// requested mode, taken when the crossfade has ended
+	UINT32             xfadePos;		// position in the mode crossfade
+	SmoothedParam      gain;
+	pcm_frame         *scratch;			// old mode output during the crossfade
+	float             *ramp;			// per-sample gain of the current block
+	UINT32             blockSize;		// planned device block (in frames), 0 for the device minimum
+	EchoCanceller     *aec;				// replaced only before the streaming starts
+	bool               fAec, fAecReset;	// on, reset in the current block (the reference starts at the reset)
+	pcm_frame         *echoFree;		// capture with the echo of the render removed
+	Limiter            limiter;
+	bool               fLimiter;
+	float             *dynL, *dynR;		// limiter input and output of the current block
 	WavFileForIO      *wavfile;
 	Fir                fir, fir1, fir2;
-	Comb			   comb1, comb2, comb3, comb4;
-	Allpass			   ap1, ap2;
+	Reverb             reverb;
+	SilenceGate        fir1Idle, fir2Idle, reverbIdle;	// skip the blocks while their input is silent
+	FdnReverb<8>       fdn;
 	Chorus             chorus;
+	NoiseSuppressor    denoise;
+	SpectralGate       gate;
+	SpectralEq         eq;
+	Compressor         compressor;
+	Waveshaper         waveshaper;
+	PluginNode         plugin;
+	ShmWriter          tap;				// output to the consumer processes
+	LoudnessMeter      meter;			// loudness of the output
+	bool               fMeter;			// metered, only the object which streams (not the test and planner ones)
+	CaptureRecorder    recorder;		// input blocks and parameter changes for a replay
+	Parallel           bandmix;			// dry signal and a band, lined up
+	SwapNode           chain;
+	atomic<bool>       fBuilding, fClosing;	// a chain builder thread is running, the object is being deleted
+	int                buildVariant;
+	atomic<int>        swapVariant;		// variant of the last published chain, -1 if it is not a MakeChain() one
+	WCHAR              pluginFile[MAX_PATH], coefsFile[MAX_PATH];	// loaded before the streaming, for a replay
 
 	Timer									 period, time;
 	UINT64                                   frame_cnt;
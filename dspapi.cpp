@@ -0,0 +1,136 @@
+/*
+ * dspapi.cpp -- C interface of the processing blocks (see dspapi.h)
+ *
+ * Built into the static and the dynamic library together with dsp.cpp and timer.cpp, the
+ * console application does not use it.
+ */
+
+#include <windows.h>
+#include <new>
+#include "dsp.h"
+#include "dspapi.h"
+
+#define API_FRAMES	4096	// default internal block (in frames)
+
+
+struct dsp_chain {
+	dsp_chain(UINT32 maxFrames): nodes("dspapi", maxFrames, true), maxFrames(maxFrames) {
+		scratch = new pcm_frame[maxFrames];
+	}
+
+	~dsp_chain() {
+		delete [] scratch;
+	}
+
+	Chain      nodes;
+	UINT32     maxFrames;
+	pcm_frame *scratch;				// block of the planar buffers interleaved
+};
+
+
+/* sets *error, the chain is deleted on failure */
+static dsp_chain *result(dsp_chain *chain, int r, int *error) {
+	if (r != DSP_OK) {
+		delete chain;
+		chain = NULL;
+	}
+	if (error != NULL)
+		*error = r;
+	return chain;
+}
+
+DSP_API uint32_t dsp_version(void) {
+	return DSP_API_VERSION;
+}
+
+/* the exceptions of the allocations must not cross the C interface */
+DSP_API dsp_chain *dsp_create(const char *blocks, uint32_t max_frames, int *error) {
+	char       buf[256], *name, *context = NULL;
+	dsp_chain *chain = NULL;
+	DspNode   *node  = NULL;							// made but not yet owned by the chain
+	int        r     = DSP_OK;
+
+	// strcpy_s would call the invalid parameter handler of the CRT on a long list
+	if (blocks == NULL || strlen(blocks) >= sizeof(buf))
+		return result(NULL, DSP_E_INVALIDARG, error);
+	memcpy(buf, blocks, strlen(blocks) + 1);
+
+	try {
+		chain = new dsp_chain(max_frames != 0 ? max_frames : API_FRAMES);
+		for (name = strtok_s(buf, ",", &context); name != NULL; name = strtok_s(NULL, ",", &context)) {
+			if ((node = MyAudio::MakeNode(name)) == NULL) {
+				r = DSP_E_NOTFOUND;
+				break;
+			}
+			chain->nodes.add(node);
+			node = NULL;
+		}
+	} catch (bad_alloc &) {
+		delete node;
+		r = DSP_E_OUTOFMEMORY;
+	}
+	return result(chain, r, error);
+}
+
+DSP_API dsp_chain *dsp_create_filter(const wchar_t *filename, const wchar_t *cache_dir, uint32_t max_frames, int *error) {
+	dsp_chain *chain = NULL;
+	DspNode   *node  = NULL;
+	int        r     = DSP_OK;
+
+	if (filename == NULL)
+		return result(NULL, DSP_E_INVALIDARG, error);
+
+	try {
+		FilterCoefs coefs;
+
+		if (coefs.load(filename, cache_dir) != S_OK)
+			return result(NULL, DSP_E_NOTFOUND, error);
+		chain = new dsp_chain(max_frames != 0 ? max_frames : API_FRAMES);
+		node  = MyAudio::MakeFilter(coefs);
+		chain->nodes.add(node);
+	} catch (bad_alloc &) {
+		delete node;
+		r = DSP_E_OUTOFMEMORY;
+	}
+	return result(chain, r, error);
+}
+
+DSP_API int dsp_process_interleaved(dsp_chain *chain, int16_t *frames, size_t n) {
+	pcm_frame *p = (pcm_frame *)frames;
+
+	if (chain == NULL || (frames == NULL && n > 0))
+		return DSP_E_INVALIDARG;
+
+	// the caller's buffer is the stream of the blocks as such
+	for (size_t j = 0, m; j < n; j += m) {
+		m = min(n - j, (size_t)0x40000000);
+		chain->nodes.process(&p[j], &p[j], (UINT32)m);
+	}
+	return DSP_OK;
+}
+
+DSP_API int dsp_process_planar(dsp_chain *chain, int16_t *left, int16_t *right, size_t n) {
+	if (chain == NULL || ((left == NULL || right == NULL) && n > 0))
+		return DSP_E_INVALIDARG;
+
+	for (size_t j = 0, m; j < n; j += m) {
+		m = min(n - j, (size_t)chain->maxFrames);
+		simd().interleave(&left[j], &right[j], chain->scratch, m);
+		chain->nodes.process(chain->scratch, chain->scratch, (UINT32)m);
+		simd().deinterleave(chain->scratch, &left[j], &right[j], m);
+	}
+	return DSP_OK;
+}
+
+DSP_API uint32_t dsp_latency(const dsp_chain *chain) {
+	return chain != NULL ? chain->nodes.latency() : 0;
+}
+
+DSP_API void dsp_reset(dsp_chain *chain) {
+	if (chain != NULL)
+		chain->nodes.reset();
+}
+
+DSP_API void dsp_destroy(dsp_chain *chain) {
+	delete chain;
+}
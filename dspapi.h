@@ -0,0 +1,75 @@
+/*
+ * dspapi.h -- C interface of the processing blocks for embedding (dsplib.lib, dspdll.dll)
+ *
+ * A chain of the processing blocks of the framework is created from their names and run
+ * in-process on caller-owned buffers of any length, in place. Interleaved stereo buffers are
+ * handed to the blocks as they are: the filters read and write them directly, without a copy,
+ * while the output of the other blocks (reverb) and the signal between two blocks go through
+ * buffers of the chain. Planar buffers are interleaved one block at a time through a scratch
+ * buffer of the chain that stays in the cache. This header is plain C and is the only file a
+ * user of the library needs.
+ *
+ * Samples are 16-bit at 44.1 kHz, the sampling rate of the blocks. A chain keeps the signal
+ * history from one call to the next, so a long stream may be processed in batches of any
+ * size. Different chains may be used on different threads at the same time, a single chain
+ * from one thread at a time.
+ *
+ * Link to dsplib.lib and define DSP_API_STATIC, or link to the import library of dspdll.dll.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_API_VERSION		0x00010000		/* major << 16 | minor */
+#define DSP_API_RATE		44100			/* sampling rate of the blocks (Hz) */
+
+/* return values */
+#define DSP_OK				0
+#define DSP_E_INVALIDARG	-1
+#define DSP_E_NOTFOUND		-2				/* unknown block name or unreadable coefficient file */
+#define DSP_E_OUTOFMEMORY	-3
+
+#if defined(DSP_API_STATIC)
+#define DSP_API
+#elif defined(DSP_API_EXPORTS)
+#define DSP_API				__declspec(dllexport)
+#else
+#define DSP_API				__declspec(dllimport)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dsp_chain dsp_chain;
+
+/* DSP_API_VERSION of the library */
+DSP_API uint32_t   dsp_version(void);
+
+/* chain of the comma separated blocks (fir, fir1, fir2, reverb, bandmix or chain, at most 255
+   characters), processed max_frames at a time internally (0 for the default), NULL and *error
+   set on failure */
+DSP_API dsp_chain *dsp_create(const char *blocks, uint32_t max_frames, int *error);
+
+/* chain of the filter of a coefficient file (see coefs.h), long filters by fast convolution;
+   the parsed coefficients are cached in the directory cache_dir, NULL for no cache */
+DSP_API dsp_chain *dsp_create_filter(const wchar_t *filename, const wchar_t *cache_dir, uint32_t max_frames, int *error);
+
+/* frames[0..2*n-1] (left and right interleaved) in place */
+DSP_API int        dsp_process_interleaved(dsp_chain *chain, int16_t *frames, size_t n);
+
+/* left[0..n-1] and right[0..n-1] in place */
+DSP_API int        dsp_process_planar(dsp_chain *chain, int16_t *left, int16_t *right, size_t n);
+
+/* delay of the output (in samples) */
+DSP_API uint32_t   dsp_latency(const dsp_chain *chain);
+
+/* clear the signal history, as if the chain were new */
+DSP_API void       dsp_reset(dsp_chain *chain);
+
+DSP_API void       dsp_destroy(dsp_chain *chain);
+
+#ifdef __cplusplus
+}
+#endif
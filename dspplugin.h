@@ -0,0 +1,70 @@
+/*
+ * dspplugin.h -- C ABI of the dynamically loaded DSP modules
+ *
+ * A module is a DLL exporting the function DSP_PLUGIN_ENTRY, which returns a static
+ * descriptor of the processing node. The host owns all memory: it allocates the state of
+ * the declared size once at load time and the planar channel buffers, and calls process()
+ * on them in place, so nothing is allocated, copied or marshalled per block across the
+ * boundary. This header is plain C and is the only file a module needs.
+ *
+ * Guarantees of the host:
+ *  - state is DSP_PLUGIN_ALIGN byte aligned and zeroed before init()
+ *  - every channel pointer is DSP_PLUGIN_ALIGN byte aligned and the buffer is readable and
+ *    writable up to frames rounded up to DSP_PLUGIN_PAD samples, so whole vectors may be
+ *    processed past the end (the extra samples are ignored)
+ *  - frames <= max_frames of init(), samples are float with full scale 1.0
+ *  - process() and reset() are called from one thread at a time; process() runs on the
+ *    real time audio thread and must not block or allocate
+ *
+ * A module built against an older minor version of the descriptor keeps working because
+ * the host reads only struct_size bytes of it; incompatible changes increase the major
+ * version in DSP_PLUGIN_ABI.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_PLUGIN_ABI		0x00010000		/* major << 16 | minor */
+#define DSP_PLUGIN_ENTRY	"dspPluginEntry"
+#define DSP_PLUGIN_ALIGN	64				/* bytes, enough for AVX-512 loads and stores */
+#define DSP_PLUGIN_PAD		16				/* samples, one AVX-512 vector of floats */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dsp_plugin {
+	uint32_t    abi_version;				/* DSP_PLUGIN_ABI the module was built with */
+	uint32_t    struct_size;				/* sizeof(dsp_plugin) of the module */
+	const char *name;
+	uint32_t    channels;					/* 1 (mono) or 2 (stereo) */
+	uint32_t    latency;					/* delay of the output (in samples) */
+	uint32_t    tail;						/* output length after the input has become silent (in samples) */
+	size_t      state_size;					/* bytes of state the host allocates */
+
+	/* prepare the state for the sample rate and the largest block, 0 on success */
+	int  (*init)(void *state, double fs, uint32_t max_frames);
+
+	/* clear the signal history, keep the parameters */
+	void (*reset)(void *state);
+
+	/* process channel[0..channels-1][0..frames-1] in place */
+	void (*process)(void *state, float *const *channel, uint32_t frames);
+
+	/* release the resources acquired by init() (may be NULL) */
+	void (*release)(void *state);
+} dsp_plugin;
+
+/* exported entry point, returns NULL if the host ABI (major version) is not supported */
+typedef const dsp_plugin *(*dsp_plugin_entry)(uint32_t host_abi);
+
+#ifdef _WIN32
+#define DSP_PLUGIN_EXPORT	__declspec(dllexport)
+#else
+#define DSP_PLUGIN_EXPORT	__attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
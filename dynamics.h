@@ -0,0 +1,289 @@
+/*
+ * dynamics.h -- Dynamic range processors
+ *
+ * Compressor  RMS detector, soft knee gain computer in the log domain, attack/release smoothing
+ * Limiter     lookahead peak limiter, the output never exceeds the ceiling
+ *
+ * The signal is processed in blocks: the detector inputs, level conversions, gain computer
+ * and gain application run four samples at a time, only the recursive envelope followers
+ * are per sample. The processors work on float stereo (apply()) so they can be used in
+ * the output stage before the conversion to 16-bit, or as a DspNode on pcm frames.
+ */
+
+#pragma once
+#include <windows.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "cirbuffer.h"
+#include "node.h"
+
+using namespace std;
+
+#define DYN_BLOCK	256		// internal processing block (in samples)
+
+
+/* log2(x) for x > 0, abt. 1e-3 dB error */
+static inline __m128 log2_ps(__m128 x) {
+	__m128i b = _mm_castps_si128(x);
+	__m128  e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(b, 23), _mm_set1_epi32(127)));
+	__m128  t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(b, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000))),
+						   _mm_set1_ps(1.0f));				// mantissa - 1, in [0, 1)
+	__m128  p = _mm_set1_ps(-0.0842946558f);
+
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.3236463076f));
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.6780894559f));
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.4385479301f));
+
+	return _mm_add_ps(e, _mm_mul_ps(p, t));
+}
+
+/* 2^x for -126 <= x <= 126, abt. 1e-5 relative error */
+static inline __m128 exp2_ps(__m128 x) {
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(126.0f));
+
+	__m128i i = _mm_cvttps_epi32(x);
+	__m128  f = _mm_cvtepi32_ps(i);
+	__m128  m = _mm_cmplt_ps(x, f);							// truncation rounded a negative value up
+	i = _mm_add_epi32(i, _mm_castps_si128(m));				// -1 where m is set
+	f = _mm_sub_ps(x, _mm_sub_ps(f, _mm_and_ps(m, _mm_set1_ps(1.0f))));		// fraction, in [0, 1)
+
+	__m128 p = _mm_set1_ps(0.0136765311f);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0516668774f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.2417102625f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.6929312892f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0000072833f));
+
+	return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23)));
+}
+
+
+/* common block processing and the lookahead delay of the dynamics processors */
+class Dynamics: public DspNode {
+public:
+	Dynamics(UINT32 delay): delay_(delay) {
+		hl_ = new float[delay + DYN_BLOCK]; hr_ = new float[delay + DYN_BLOCK];
+		xl_ = new float[DYN_BLOCK];         xr_ = new float[DYN_BLOCK];
+		g_  = new float[DYN_BLOCK];
+		Dynamics::reset();
+	}
+
+	virtual ~Dynamics() {
+		delete [] hl_; delete [] hr_;
+		delete [] xl_; delete [] xr_;
+		delete [] g_;
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			n = min(samples - i, (UINT32)DYN_BLOCK);
+
+			simd().pcmToF32(&input[i], xl_, xr_, n);
+			apply(xl_, xr_, n);
+			simd().f32ToPcm(xl_, xr_, &output[i], n);
+		}
+	}
+
+	/* process the stereo float signal (16-bit full scale) in place */
+	void apply(float *l, float *r, UINT32 samples) {
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			n = min(samples - i, (UINT32)DYN_BLOCK);
+
+			gains(&l[i], &r[i], g_, n);
+
+			// the gain of the newest sample applies to the sample leaving the lookahead delay
+			memcpy(&hl_[delay_], &l[i], n*sizeof(float));
+			memcpy(&hr_[delay_], &r[i], n*sizeof(float));
+			UINT32 j = 0;
+			for (; j+4 <= n; j += 4) {
+				__m128 g = _mm_loadu_ps(&g_[j]);
+				_mm_storeu_ps(&l[i+j], _mm_mul_ps(_mm_loadu_ps(&hl_[j]), g));
+				_mm_storeu_ps(&r[i+j], _mm_mul_ps(_mm_loadu_ps(&hr_[j]), g));
+			}
+			for (; j < n; j++) {
+				l[i+j] = hl_[j]*g_[j];
+				r[i+j] = hr_[j]*g_[j];
+			}
+			memmove(hl_, &hl_[n], delay_*sizeof(float));
+			memmove(hr_, &hr_[n], delay_*sizeof(float));
+		}
+	}
+
+	void reset() {
+		memset(hl_, 0, (delay_ + DYN_BLOCK)*sizeof(float));
+		memset(hr_, 0, (delay_ + DYN_BLOCK)*sizeof(float));
+	}
+
+	UINT32 latency() const { return delay_; }
+
+protected:
+	/* gain of every sample of the block l[0..n-1], r[0..n-1] */
+	virtual void gains(const float *l, const float *r, float *g, UINT32 n) = 0;
+
+private:
+	UINT32 delay_;
+	float *hl_, *hr_;				// lookahead delay lines followed by the current block
+	float *xl_, *xr_, *g_;
+};
+
+
+class Compressor: public Dynamics {
+public:
+	/* threshold (dBFS), ratio, soft knee width (dB), attack and release times (s), makeup gain (dB) */
+	Compressor(float threshold = -20.0f, float ratio = 4.0f, float knee = 6.0f, float attack = 0.005f, float release = 0.1f, float makeup = 0.0f):
+	  Dynamics(0), thr_(threshold), slope_(1.0f - 1.0f/ratio), knee_(max(knee, 0.01f)), makeup_(makeup) {
+		rms_ = 1.0f - expf(-1.0f/(0.01f*FS));		// 10 ms RMS window
+		att_ = 1.0f - expf(-1.0f/(attack*FS));
+		rel_ = 1.0f - expf(-1.0f/(release*FS));
+		lev_ = new float[DYN_BLOCK];
+		reset();
+	}
+
+	~Compressor() {
+		delete [] lev_;
+	}
+
+	void reset() {
+		Dynamics::reset();
+		ms_ = 0.0f;
+		gr_ = 0.0f;
+	}
+
+	const char *name() const { return "compressor"; }
+
+	/* current gain reduction (dB) */
+	float reduction() const { return gr_; }
+
+protected:
+	void gains(const float *l, const float *r, float *g, UINT32 n) {
+		const __m128 half = _mm_set1_ps(0.5f);
+		UINT32 i = 0;
+
+		// detector input: mean square of the channels
+		for (; i+4 <= n; i += 4) {
+			__m128 a = _mm_loadu_ps(&l[i]), b = _mm_loadu_ps(&r[i]);
+			_mm_storeu_ps(&lev_[i], _mm_mul_ps(half, _mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b))));
+		}
+		for (; i < n; i++)
+			lev_[i] = 0.5f*(l[i]*l[i] + r[i]*r[i]);
+
+		// RMS envelope
+		for (i = 0; i < n; i++)
+			lev_[i] = (ms_ += rms_*(lev_[i] - ms_));
+
+		// level (dBFS) and the soft knee gain computer: reduction = slope * (knee^2/2w + linear part)
+		const __m128 db = _mm_set1_ps(3.0103f), fs = _mm_set1_ps(90.309f + thr_ - 0.5f*knee_), zero = _mm_setzero_ps(),
+					 w = _mm_set1_ps(knee_), w2 = _mm_set1_ps(0.5f/knee_), slope = _mm_set1_ps(slope_), tiny = _mm_set1_ps(1e-10f);
+		for (i = 0; i+4 <= n; i += 4) {
+			__m128 x = _mm_sub_ps(_mm_mul_ps(db, log2_ps(_mm_add_ps(_mm_loadu_ps(&lev_[i]), tiny))), fs);	// level - threshold + w/2
+			__m128 k = _mm_min_ps(_mm_max_ps(x, zero), w);
+			__m128 o = _mm_max_ps(_mm_sub_ps(x, w), zero);
+			_mm_storeu_ps(&lev_[i], _mm_mul_ps(slope, _mm_add_ps(_mm_mul_ps(_mm_mul_ps(k, k), w2), o)));
+		}
+		for (; i < n; i++) {
+			float x = 10.0f*log10f(lev_[i] + 1e-10f) - 90.309f - thr_ + 0.5f*knee_;
+			float k = min(max(x, 0.0f), knee_), o = max(x - knee_, 0.0f);
+			lev_[i] = slope_*(k*k*0.5f/knee_ + o);
+		}
+
+		// attack and release smoothing of the gain reduction
+		for (i = 0; i < n; i++) {
+			float t = lev_[i];
+			gr_ += (t > gr_ ? att_ : rel_)*(t - gr_);
+			lev_[i] = gr_;
+		}
+
+		// dB -> linear gain
+		const __m128 m = _mm_set1_ps(makeup_/6.0206f), s = _mm_set1_ps(-1.0f/6.0206f);
+		for (i = 0; i+4 <= n; i += 4)
+			_mm_storeu_ps(&g[i], exp2_ps(_mm_add_ps(m, _mm_mul_ps(s, _mm_loadu_ps(&lev_[i])))));
+		for (; i < n; i++)
+			g[i] = powf(10.0f, (makeup_ - lev_[i])/20.0f);
+	}
+
+private:
+	float  thr_, slope_, knee_, makeup_;
+	float  rms_, att_, rel_;			// one-pole coefficients
+	float  ms_, gr_;					// mean square envelope, smoothed gain reduction (dB)
+	float *lev_;
+};
+
+
+class Limiter: public Dynamics {
+public:
+	/* ceiling (dBFS), lookahead and release times (s) */
+	Limiter(float ceiling = -0.3f, float lookahead = 0.0015f, float release = 0.05f):
+	  Dynamics((UINT32)(lookahead*FS)), W((UINT32)(lookahead*FS) + 1) {
+		ceil_ = 32767.0f*powf(10.0f, ceiling/20.0f);
+		rel_  = expf(-1.0f/(release*FS));
+		Q = 1;
+		while (Q < W) Q <<= 1;
+		qv_  = new float[Q]; qi_ = new UINT32[Q];
+		avg_ = new float[W];
+		req_ = new float[DYN_BLOCK];
+		reset();
+	}
+
+	~Limiter() {
+		delete [] qv_; delete [] qi_;
+		delete [] avg_; delete [] req_;
+	}
+
+	void reset() {
+		Dynamics::reset();
+		for (UINT32 j = 0; j < W; j++)
+			avg_[j] = 1.0f;
+		sum_  = W;
+		pos_  = 0;
+		head_ = tail_ = 0;
+		n_    = 0;
+		h_    = 1.0f;
+	}
+
+	const char *name() const { return "limiter"; }
+
+protected:
+	void gains(const float *l, const float *r, float *g, UINT32 n) {
+		const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)), c = _mm_set1_ps(ceil_), one = _mm_set1_ps(1.0f);
+		UINT32 i = 0;
+
+		// gain each sample requires on its own: min(1, ceiling/peak)
+		for (; i+4 <= n; i += 4) {
+			__m128 p = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(&l[i]), sign), _mm_and_ps(_mm_loadu_ps(&r[i]), sign));
+			_mm_storeu_ps(&req_[i], _mm_min_ps(one, _mm_div_ps(c, _mm_max_ps(p, c))));
+		}
+		for (; i < n; i++)
+			req_[i] = min(1.0f, ceil_/max(max(fabsf(l[i]), fabsf(r[i])), ceil_));
+
+		/* minimum over the lookahead window with a release, then averaged over the same window:
+		   every averaged value is below the requirement of the sample leaving the delay */
+		for (i = 0; i < n; i++, n_++) {
+			float v = req_[i];
+
+			while (head_ != tail_ && qv_[(tail_-1) & (Q-1)] >= v)
+				tail_--;
+			qv_[tail_ & (Q-1)] = v; qi_[tail_ & (Q-1)] = n_;
+			tail_++;
+			if (n_ - qi_[head_ & (Q-1)] >= W)
+				head_++;
+
+			h_ = min(qv_[head_ & (Q-1)], 1.0f - rel_*(1.0f - h_));
+
+			sum_ += (double)h_ - avg_[pos_];
+			avg_[pos_] = h_;
+			if (++pos_ == W) pos_ = 0;
+			g[i] = (float)(sum_/W);
+		}
+	}
+
+private:
+	UINT32  W, Q;					// window length (lookahead + 1), queue capacity
+	float   ceil_, rel_;
+	float  *qv_;					// monotonic queue of the window minimum (values and sample indices)
+	UINT32 *qi_, head_, tail_, n_;
+	float  *avg_, h_;				// moving average of the released minimum
+	double  sum_;
+	UINT32  pos_;
+	float  *req_;
+};
@@ -0,0 +1,142 @@
+/*
+ * fdn.h -- Feedback delay network reverberator
+ *
+ * N (8 or 16) delay lines with a normalized Hadamard feedback matrix, applied with a fast
+ * Walsh-Hadamard transform (log2(N) butterfly stages instead of a dense N x N product).
+ * Every line has its own RT60 gain and a first-order damping lowpass, and the lines are
+ * tapped with two orthogonal sign patterns for decorrelated left and right outputs.
+ *
+ * Because the shortest line is longer than the processing block, the line outputs of a
+ * whole block are known in advance. The block is processed four samples at a time, each
+ * line in its own SSE register, so all butterflies are plain vertical adds.
+ */
+
+#pragma once
+#include <windows.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "cirbuffer.h"
+#include "node.h"
+
+using namespace std;
+
+#define FDN_BLOCK	64		// processing block (must be shorter than the shortest line)
+
+
+template <int N> class FdnReverb: public DspNode {
+public:
+	/* rvt is the reverberation time (RT60 in s), damp the high frequency damping (0..0.5) */
+	FdnReverb(float rvt, float damp = 0.3f): a_(damp) {
+		static const int lengths[16] = { 1433, 1601, 1867, 2053, 2251, 2399, 2617, 2797,
+										 1291, 1511, 1733, 1979, 2179, 2341, 2539, 2707 };
+
+		// block buffers aligned for the SSE loads, the object itself may be on the heap
+		mem_  = (float *)_aligned_malloc((N*(FDN_BLOCK+4) + 3*FDN_BLOCK)*sizeof(float), 16);
+		for (int j = 0; j < N; j++)
+			d_[j] = &mem_[j*(FDN_BLOCK+4)];
+		in_   = &mem_[N*(FDN_BLOCK+4)];
+		outL_ = &in_[FDN_BLOCK];
+		outR_ = &outL_[FDN_BLOCK];
+
+		for (int j = 0; j < N; j++) {
+			len_[j]  = lengths[j];
+			line_[j] = new float[len_[j]+4];		// reserve for the 128-bit load at the line end
+			g_[j]    = powf(0.001f, ((float)len_[j]/FS) / rvt) / sqrtf((float)N);	// RT60 gain with Hadamard normalization
+		}
+		reset();
+	}
+
+	~FdnReverb() {
+		for (int j = 0; j < N; j++)
+			delete [] line_[j];
+		_aligned_free(mem_);
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		const __m128 scale = _mm_set1_ps(0.25f/N), a = _mm_set1_ps(a_), b = _mm_set1_ps(1.0f - a_);
+
+		for (UINT32 i0 = 0, n; i0 < samples; i0 += n) {
+			// block ends at the first line wrap-around
+			n = min(samples - i0, (UINT32)FDN_BLOCK);
+			for (int j = 0; j < N; j++)
+				n = min(n, (UINT32)(len_[j] - pos_[j]));
+
+			// line outputs of the block, preceded by the previous output for the damping filter
+			for (int j = 0; j < N; j++) {
+				memcpy(&d_[j][4], &line_[j][pos_[j]], ((n+3) & ~3)*sizeof(float));
+				d_[j][3] = prev_[j];
+				prev_[j] = d_[j][3+n];
+			}
+			for (UINT32 i = 0; i < n; i++)
+				in_[i] = 0.5f*((float)input[i0+i].left + (float)input[i0+i].right);
+
+			for (UINT32 i = 0; i < n; i += 4) {
+				__m128 x[N], l = _mm_setzero_ps(), r = _mm_setzero_ps();
+
+				for (int j = 0; j < N; j++) {
+					__m128 y = _mm_load_ps(&d_[j][4+i]);
+
+					// stereo output taps
+					l = (j & 1) ? _mm_sub_ps(l, y) : _mm_add_ps(l, y);
+					r = (j & 2) ? _mm_sub_ps(r, y) : _mm_add_ps(r, y);
+
+					// damping lowpass and RT60 gain
+					y    = _mm_add_ps(_mm_mul_ps(b, y), _mm_mul_ps(a, _mm_loadu_ps(&d_[j][3+i])));
+					x[j] = _mm_mul_ps(y, _mm_set1_ps(g_[j]));
+				}
+
+				// Hadamard feedback matrix
+				for (int h = N/2; h >= 1; h >>= 1) {
+					for (int k = 0; k < N; k += 2*h) {
+						for (int m = k; m < k+h; m++) {
+							__m128 p = x[m], q = x[m+h];
+							x[m]   = _mm_add_ps(p, q);
+							x[m+h] = _mm_sub_ps(p, q);
+						}
+					}
+				}
+
+				// feed the input and the feedback back to the lines
+				__m128 in = _mm_load_ps(&in_[i]);
+				if (i+4 <= n) {
+					for (int j = 0; j < N; j++)
+						_mm_storeu_ps(&line_[j][pos_[j]+i], _mm_add_ps(x[j], in));
+				} else {
+					// partial vector at the block end, do not overwrite samples which are still to be read
+					__declspec(align(16)) float t[4];
+					for (int j = 0; j < N; j++) {
+						_mm_store_ps(t, _mm_add_ps(x[j], in));
+						memcpy(&line_[j][pos_[j]+i], t, (n-i)*sizeof(float));
+					}
+				}
+
+				_mm_store_ps(&outL_[i], _mm_mul_ps(l, scale));
+				_mm_store_ps(&outR_[i], _mm_mul_ps(r, scale));
+			}
+			simd().f32ToPcm(outL_, outR_, &output[i0], n);
+
+			for (int j = 0; j < N; j++)
+				if ((pos_[j] += n) == len_[j]) pos_[j] = 0;
+		}
+	}
+
+	void reset() {
+		for (int j = 0; j < N; j++) {
+			memset(line_[j], 0, (len_[j]+4)*sizeof(float));
+			pos_[j]  = 0;
+			prev_[j] = 0.0f;
+		}
+	}
+
+	const char *name() const { return "fdn"; }
+
+private:
+	float *mem_;
+	float *d_[N];					// line outputs of the block, after the previous output (FDN_BLOCK+4)
+	float *in_, *outL_, *outR_;		// FDN_BLOCK each
+	float *line_[N];
+	int    len_[N], pos_[N];
+	float  g_[N], prev_[N], a_;
+};
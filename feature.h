@@ -0,0 +1,298 @@
+/*
+ * feature.h -- Streaming audio feature extraction
+ *
+ * Passes the signal through unchanged and computes, every hop, the RMS level, zero-crossing
+ * rate, log mel band energies and mel frequency cepstral coefficients of the latest frame.
+ * The mel filterbank is stored as a sparse matrix (only the nonzero bins of each triangle).
+ *
+ * The feature frames are posted to a lock-free ring. While a file is open a writer thread
+ * drains the ring to it, so the processing never waits for the disk; otherwise the ring is
+ * read by the caller of pop(). The file is a header of eight UINT32 values ("DSPF", version,
+ * sampling rate, frame length, hop size, mel bands, cepstral coefficients, record size)
+ * followed by FeatureFrame records.
+ */
+
+#pragma once
+#include <windows.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "cirbuffer.h"
+#include "node.h"
+#include "fft.h"
+#include "params.h"
+
+using namespace std;
+
+#define FEAT_SIZE	1024	// analysis frame length (in samples)
+#define FEAT_HOP	512		// default hop size (in samples)
+#define FEAT_MELS	40		// number of mel bands
+#define FEAT_MFCCS	13		// number of cepstral coefficients
+#define FEAT_RING	256		// feature frames between the processing and the writer (power of two, abt. 3 s)
+#define FEAT_POLL	20		// largest wait of the writer between the writes (ms)
+
+
+struct FeatureFrame {
+	UINT32 index;				// frame number, the frame ends at sample (index+1)*hop
+	float  rms;					// level (dBFS)
+	float  zcr;					// zero crossings per sample
+	float  mel[FEAT_MELS];		// natural log of the mel band energies (relative to a full scale sine)
+	float  mfcc[FEAT_MFCCS];
+};
+
+
+class FeatureExtractor: public DspNode {
+public:
+	FeatureExtractor(UINT32 hop = FEAT_HOP): N(FEAT_SIZE), H(hop), K(FEAT_SIZE/2+1), fft_(FEAT_SIZE), fp_(NULL),
+	  hThread_(NULL), hEvent_(NULL), fStop_(false), fWait_(false), fError_(false), dropped_(0) {
+		in_  = (float *)_aligned_malloc(N*sizeof(float), 16);
+		t_   = (float *)_aligned_malloc(N*sizeof(float), 16);
+		win_ = (float *)_aligned_malloc(N*sizeof(float), 16);
+		p_   = (float *)_aligned_malloc((K+3)*sizeof(float), 16);	// reserve for the padded bands
+		memset(p_, 0, (K+3)*sizeof(float));
+		X_   = new cfloat[K];
+
+		// periodic Hann window, power normalized so that a full scale sine gives 0 dB
+		double sum = 0.0;
+		for (UINT32 n = 0; n < N; n++) {
+			win_[n] = (float)(0.5 - 0.5*cos(2.0*M_PI*n/N));
+			sum += win_[n];
+		}
+		norm_ = (float)(1.0/(32768.0*sum/2.0 * 32768.0*sum/2.0));
+
+		melBank();
+		dct_ = (float (*)[FEAT_MELS])_aligned_malloc(FEAT_MFCCS*sizeof(*dct_), 16);
+		for (UINT32 i = 0; i < FEAT_MFCCS; i++)
+			for (UINT32 m = 0; m < FEAT_MELS; m++)
+				dct_[i][m] = (float)(sqrt((i == 0 ? 1.0 : 2.0)/FEAT_MELS) * cos(M_PI*i*(m + 0.5)/FEAT_MELS));
+
+		reset();
+	}
+
+	~FeatureExtractor() {
+		close();
+		_aligned_free(in_); _aligned_free(t_); _aligned_free(win_); _aligned_free(p_);
+		_aligned_free(w_); _aligned_free(dct_);
+		delete [] X_;
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		if (output != input)
+			memcpy(output, input, samples*sizeof(pcm_frame));
+
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			// up to the end of the current hop
+			n = min(samples - i, H - pos_);
+
+			float *x = &in_[N-H+pos_];
+			for (UINT32 j = 0; j < n; j++)
+				x[j] = 0.5f*((float)input[i+j].left + (float)input[i+j].right);
+
+			if ((pos_ += n) == H) {
+				analyze();
+				memmove(in_, &in_[H], (N-H)*sizeof(float));
+				pos_ = 0;
+			}
+		}
+	}
+
+	void reset() {
+		memset(in_, 0, N*sizeof(float));
+		pos_   = 0;
+		index_ = 0;
+	}
+
+	const char *name() const { return "features"; }
+
+	/* consumer side of the feature ring while no file is open, returns false if there is no new frame */
+	bool pop(FeatureFrame &f) {
+		return hThread_ == NULL && ring_.pop(f);
+	}
+
+	/* frames lost because the ring was full */
+	UINT32 dropped() const { return dropped_; }
+
+	/* starts the writer thread appending the features to the given binary file; with fWait the
+	   processing waits for room in the ring instead of dropping frames (offline, not the audio thread) */
+	HRESULT open(LPCWSTR filename, bool fWait = false) {
+		FeatureFrame f;
+
+		close();
+		if (_wfopen_s(&fp_, filename, L"wb") != 0) {
+			fp_ = NULL;
+			return E_FAIL;
+		}
+
+		UINT32 hdr[8] = { 0x46505344, 1, FS, N, H, FEAT_MELS, FEAT_MFCCS, sizeof(FeatureFrame) };
+		if (fwrite(hdr, sizeof(hdr), 1, fp_) != 1) {
+			close();
+			return E_FAIL;
+		}
+
+		while (ring_.pop(f))								// the file starts from the next frame
+			;
+		fWait_  = fWait;
+		fError_ = false;
+		fStop_  = false;
+		if ((hEvent_ = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL ||
+			(hThread_ = CreateThread(NULL, 0, writer, this, 0, NULL)) == NULL) {
+			close();
+			return E_FAIL;
+		}
+
+		return S_OK;
+	}
+
+	/* stops the writer after it has written the rest of the ring, E_FAIL if a write failed */
+	HRESULT close() {
+		if (hThread_ != NULL) {
+			fStop_ = true;
+			SetEvent(hEvent_);
+			WaitForSingleObject(hThread_, INFINITE);
+			CloseHandle(hThread_);
+			hThread_ = NULL;
+		}
+		if (hEvent_ != NULL)
+			CloseHandle(hEvent_);
+		hEvent_ = NULL;
+		if (fp_ != NULL) {
+			if (fclose(fp_) != 0)
+				fError_ = true;
+			fp_ = NULL;
+		}
+
+		return fError_ ? E_FAIL : S_OK;
+	}
+
+private:
+	/* triangular filters on the mel scale from 0 Hz to FS/2, each band padded to a multiple of four bins */
+	void melBank() {
+		double mmax = 2595.0*log10(1.0 + (FS/2.0)/700.0), edge[FEAT_MELS+2];
+		UINT32 total = 0;
+
+		for (UINT32 m = 0; m < FEAT_MELS+2; m++)
+			edge[m] = 700.0*(pow(10.0, mmax*m/(FEAT_MELS+1)/2595.0) - 1.0)*N/FS;	// in bins
+
+		for (UINT32 m = 0; m < FEAT_MELS; m++) {
+			int first = (int)ceil(edge[m]), last = min((int)floor(edge[m+2]), (int)K-1);
+
+			if (last < first)						// narrower than a bin: the bin nearest to the center
+				first = last = (int)floor(edge[m+1] + 0.5);
+			start_[m] = first;
+			len_[m]   = (last - first + 1 + 3) & ~3;
+			off_[m]   = total;
+			total    += len_[m];
+		}
+
+		w_ = (float *)_aligned_malloc(total*sizeof(float), 16);
+		for (UINT32 m = 0; m < FEAT_MELS; m++) {
+			float sum = 0.0f;
+
+			for (UINT32 j = 0; j < len_[m]; j++) {
+				double k = start_[m] + j, w;
+
+				if (k <= edge[m+1])
+					w = (k - edge[m]) / (edge[m+1] - edge[m]);
+				else
+					w = (edge[m+2] - k) / (edge[m+2] - edge[m+1]);
+				sum += w_[off_[m]+j] = (float)max(w, 0.0);
+			}
+			if (sum == 0.0f)
+				w_[off_[m]] = 1.0f;
+		}
+	}
+
+	static inline float hsum(__m128 a) {
+		a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+		return _mm_cvtss_f32(_mm_add_ss(a, _mm_shuffle_ps(a, a, 1)));
+	}
+
+	/* features of the frame in_[0..N-1] */
+	void analyze() {
+		FeatureFrame f;
+		const __m128 zero = _mm_setzero_ps();
+		__m128 acc = zero;
+		int    zc  = 0;
+
+		f.index = index_++;
+
+		// level and zero crossings (sign changes between the neighbouring samples)
+		for (UINT32 n = 0; n+4 < N; n += 4) {
+			__m128 s = _mm_xor_ps(_mm_cmplt_ps(_mm_load_ps(&in_[n]), zero), _mm_cmplt_ps(_mm_loadu_ps(&in_[n+1]), zero));
+			int    b = _mm_movemask_ps(s);
+			zc += (b & 1) + ((b >> 1) & 1) + ((b >> 2) & 1) + (b >> 3);
+		}
+		for (UINT32 n = N-4; n < N-1; n++)
+			zc += (in_[n] < 0.0f) != (in_[n+1] < 0.0f);
+		f.rms = 10.0f*log10f(simd().energy(in_, N)/N/(32768.0f*32768.0f) + 1e-12f);
+		f.zcr = (float)zc/(N-1);
+
+		// power spectrum and the sparse mel filterbank
+		vmul(in_, win_, t_, N);
+		fft_.forward(t_, X_);
+		cpower(X_, p_, K);
+		for (UINT32 m = 0; m < FEAT_MELS; m++) {
+			const float *p = &p_[start_[m]], *w = &w_[off_[m]];
+
+			acc = zero;
+			for (UINT32 j = 0; j < len_[m]; j += 4)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&p[j]), _mm_load_ps(&w[j])));
+			f.mel[m] = logf(hsum(acc)*norm_ + 1e-12f);
+		}
+
+		// cepstrum: orthonormal DCT-II of the log mel energies
+		for (UINT32 i = 0; i < FEAT_MFCCS; i++) {
+			acc = zero;
+			for (UINT32 m = 0; m < FEAT_MELS; m += 4)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&f.mel[m]), _mm_load_ps(&dct_[i][m])));
+			f.mfcc[i] = hsum(acc);
+		}
+
+		if (fWait_)
+			while (!ring_.push(f)) {
+				SetEvent(hEvent_);
+				Sleep(1);
+			}
+		else if (!ring_.push(f))
+			dropped_++;
+
+		// wake up the writer early when the ring fills up, otherwise it polls
+		if (hEvent_ != NULL && ring_.size() > FEAT_RING/2)
+			SetEvent(hEvent_);
+	}
+
+	static DWORD WINAPI writer(LPVOID pContext) {
+		FeatureExtractor *p = (FeatureExtractor *)pContext;
+		FeatureFrame      f;
+		bool              fStop;
+
+		do {
+			WaitForSingleObject(p->hEvent_, FEAT_POLL);
+			fStop = p->fStop_;
+			while (p->ring_.pop(f))
+				if (fwrite(&f, sizeof(f), 1, p->fp_) != 1)
+					p->fError_ = true;
+		} while (!fStop);
+
+		return 0;
+	}
+
+	UINT32  N, H, K;				// frame length, hop size, number of bins
+	RealFft fft_;
+	float  *in_, *t_, *win_, *p_;
+	cfloat *X_;
+	float   norm_;
+	UINT32  start_[FEAT_MELS], len_[FEAT_MELS], off_[FEAT_MELS];	// sparse filterbank: first bin, padded length, weight offset
+	float  *w_;
+	float (*dct_)[FEAT_MELS];		// DCT-II matrix, rows of FEAT_MELS (a multiple of four)
+	SpscQueue<FeatureFrame, FEAT_RING> ring_;
+	FILE   *fp_;
+	HANDLE  hThread_, hEvent_;
+	atomic<bool> fStop_;
+	bool    fWait_, fError_;			// the processing waits for room in the ring, a write failed (writer thread)
+	UINT32  pos_, index_, dropped_;
+};
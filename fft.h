@@ -0,0 +1,253 @@
+/*
+ * fft.h -- Radix-2 complex and real FFT
+ *
+ * Twiddle factors and bit-reversal permutation are computed at construction, so
+ * the transforms themselves do not allocate memory.
+ */
+
+#pragma once
+#include <windows.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <emmintrin.h>
+
+using namespace std;
+
+
+struct cfloat {
+	float re, im;
+};
+
+
+/* in-place complex FFT of size n (power of two) */
+class Fft {
+public:
+	Fft(size_t n): n_(n) {
+		tw_  = new cfloat[n/2 > 0 ? n/2 : 1];
+		rev_ = new UINT32[n];
+
+		for (size_t k = 0; k < n/2; k++) {
+			tw_[k].re = (float)cos(2.0*M_PI*k/n);
+			tw_[k].im = (float)-sin(2.0*M_PI*k/n);
+		}
+
+		int bits = 0;
+		while (((size_t)1 << bits) < n) bits++;
+		for (size_t k = 0; k < n; k++) {
+			UINT32 r = 0;
+			for (int b = 0; b < bits; b++)
+				if (k & ((size_t)1 << b)) r |= 1 << (bits-1-b);
+			rev_[k] = r;
+		}
+	}
+
+	~Fft() {
+		delete [] tw_;
+		delete [] rev_;
+	}
+
+	size_t size() const { return n_; }
+
+	/* forward transform, not normalized */
+	void forward(cfloat *x) {
+		transform(x, false);
+	}
+
+	/* inverse transform, normalized by 1/n */
+	void inverse(cfloat *x) {
+		transform(x, true);
+
+		float s = 1.0f/n_;
+		for (size_t k = 0; k < n_; k++) {
+			x[k].re *= s; x[k].im *= s;
+		}
+	}
+
+private:
+	void transform(cfloat *x, bool fInverse) {
+		// bit-reversal permutation
+		for (size_t k = 0; k < n_; k++) {
+			if (k < rev_[k]) {
+				cfloat t = x[k]; x[k] = x[rev_[k]]; x[rev_[k]] = t;
+			}
+		}
+
+		// butterflies
+		for (size_t len = 2; len <= n_; len <<= 1) {
+			size_t half = len/2, step = n_/len;
+
+			for (size_t i = 0; i < n_; i += len) {
+				for (size_t j = 0; j < half; j++) {
+					cfloat w = tw_[j*step], *a = &x[i+j], *b = &x[i+j+half], t;
+					if (fInverse) w.im = -w.im;
+
+					t.re = b->re*w.re - b->im*w.im;
+					t.im = b->re*w.im + b->im*w.re;
+					b->re = a->re - t.re; b->im = a->im - t.im;
+					a->re += t.re;        a->im += t.im;
+				}
+			}
+		}
+	}
+
+	size_t  n_;
+	cfloat *tw_;
+	UINT32 *rev_;
+};
+
+
+/* FFT of a real sequence of size n (power of two), computed with a complex FFT of size n/2 */
+class RealFft {
+public:
+	RealFft(size_t n): n_(n), fft_(n/2) {
+		z_  = new cfloat[n/2];
+		tw_ = new cfloat[n/2];
+		for (size_t k = 0; k < n/2; k++) {
+			tw_[k].re = (float)cos(2.0*M_PI*k/n);
+			tw_[k].im = (float)-sin(2.0*M_PI*k/n);
+		}
+	}
+
+	~RealFft() {
+		delete [] z_;
+		delete [] tw_;
+	}
+
+	size_t size() const { return n_; }
+	size_t bins() const { return n_/2+1; }
+
+	/* x[0..n-1] -> X[0..n/2] */
+	void forward(const float *x, cfloat *X) {
+		size_t h = n_/2;
+
+		// pack even samples to the real part and odd samples to the imaginary part
+		for (size_t k = 0; k < h; k++) {
+			z_[k].re = x[2*k];
+			z_[k].im = x[2*k+1];
+		}
+		fft_.forward(z_);
+
+		// separate the spectra of even and odd samples and combine them
+		for (size_t k = 0; k <= h; k++) {
+			cfloat a = z_[k % h], b = z_[(h-k) % h], e, o, w = k < h ? tw_[k] : cfloat();
+
+			e.re = 0.5f*(a.re + b.re); e.im = 0.5f*(a.im - b.im);		// (Z[k] + conj(Z[h-k]))/2
+			o.re = 0.5f*(a.im + b.im); o.im = 0.5f*(b.re - a.re);		// (Z[k] - conj(Z[h-k]))/2i
+			if (k == h) {
+				w.re = -1.0f; w.im = 0.0f;
+			}
+			X[k].re = e.re + w.re*o.re - w.im*o.im;
+			X[k].im = e.im + w.re*o.im + w.im*o.re;
+		}
+	}
+
+	/* X[0..n/2] -> x[0..n-1], normalized by 1/n */
+	void inverse(const cfloat *X, float *x) {
+		size_t h = n_/2;
+
+		for (size_t k = 0; k < h; k++) {
+			cfloat a = X[k], b = X[h-k], e, d, o, w = tw_[k];
+
+			e.re = 0.5f*(a.re + b.re); e.im = 0.5f*(a.im - b.im);		// (X[k] + conj(X[h-k]))/2
+			d.re = 0.5f*(a.re - b.re); d.im = 0.5f*(a.im + b.im);		// (X[k] - conj(X[h-k]))/2
+			o.re = d.re*w.re + d.im*w.im;								// divided by W^k
+			o.im = d.im*w.re - d.re*w.im;
+			z_[k].re = e.re - o.im;										// Fe + i*Fo
+			z_[k].im = e.im + o.re;
+		}
+		fft_.inverse(z_);
+
+		for (size_t k = 0; k < h; k++) {
+			x[2*k]   = z_[k].re;
+			x[2*k+1] = z_[k].im;
+		}
+	}
+
+private:
+	size_t  n_;
+	Fft     fft_;
+	cfloat *z_, *tw_;
+};
+
+
+/* acc[k] += a[k]*b[k] (or conj(a[k])*b[k]) for k = 0..n-1, two complex values per SSE register */
+inline void cmac(const cfloat *a, const cfloat *b, cfloat *acc, size_t n, bool fConjA = false) {
+	const __m128 sign = _mm_set_ps(1.0f, -1.0f, 1.0f, -1.0f), conj = _mm_set_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+	size_t k = 0;
+
+	for (; k+2 <= n; k += 2) {
+		__m128 x  = _mm_loadu_ps(&a[k].re), y = _mm_loadu_ps(&b[k].re);
+		if (fConjA) x = _mm_mul_ps(x, conj);
+		__m128 yr = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 0, 0));			// [br0 br0 br1 br1]
+		__m128 yi = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 1, 1));			// [bi0 bi0 bi1 bi1]
+		__m128 xs = _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1));			// [ai0 ar0 ai1 ar1]
+		__m128 p  = _mm_add_ps(_mm_mul_ps(x, yr), _mm_mul_ps(_mm_mul_ps(xs, yi), sign));	// [ar*br - ai*bi, ai*br + ar*bi]
+
+		_mm_storeu_ps(&acc[k].re, _mm_add_ps(_mm_loadu_ps(&acc[k].re), p));
+	}
+	for (; k < n; k++) {
+		float ai = fConjA ? -a[k].im : a[k].im;
+
+		acc[k].re += a[k].re*b[k].re - ai*b[k].im;
+		acc[k].im += a[k].re*b[k].im + ai*b[k].re;
+	}
+}
+
+/* out[k] = a[k]*b[k] */
+inline void cmul(const cfloat *a, const cfloat *b, cfloat *out, size_t n) {
+	const __m128 sign = _mm_set_ps(1.0f, -1.0f, 1.0f, -1.0f);
+	size_t k = 0;
+
+	for (; k+2 <= n; k += 2) {
+		__m128 x  = _mm_loadu_ps(&a[k].re), y = _mm_loadu_ps(&b[k].re);
+		__m128 yr = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 yi = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128 xs = _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1));
+
+		_mm_storeu_ps(&out[k].re, _mm_add_ps(_mm_mul_ps(x, yr), _mm_mul_ps(_mm_mul_ps(xs, yi), sign)));
+	}
+	for (; k < n; k++) {
+		cfloat r;
+
+		r.re = a[k].re*b[k].re - a[k].im*b[k].im;
+		r.im = a[k].re*b[k].im + a[k].im*b[k].re;
+		out[k] = r;
+	}
+}
+
+/* X[k] *= g[k] (real gain per bin) */
+inline void cscale(cfloat *X, const float *g, size_t n) {
+	size_t k = 0;
+
+	for (; k+2 <= n; k += 2) {
+		__m128 gg = _mm_castpd_ps(_mm_load_sd((const double *)&g[k]));	// [g0 g1 - -]
+		gg = _mm_unpacklo_ps(gg, gg);										// [g0 g0 g1 g1]
+		_mm_storeu_ps(&X[k].re, _mm_mul_ps(_mm_loadu_ps(&X[k].re), gg));
+	}
+	for (; k < n; k++) {
+		X[k].re *= g[k]; X[k].im *= g[k];
+	}
+}
+
+/* p[k] = |X[k]|^2 */
+inline void cpower(const cfloat *X, float *p, size_t n) {
+	size_t k = 0;
+
+	for (; k+4 <= n; k += 4) {
+		__m128 a = _mm_loadu_ps(&X[k].re), b = _mm_loadu_ps(&X[k+2].re);
+		a = _mm_mul_ps(a, a); b = _mm_mul_ps(b, b);
+		_mm_storeu_ps(&p[k], _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+	}
+	for (; k < n; k++)
+		p[k] = X[k].re*X[k].re + X[k].im*X[k].im;
+}
+
+/* y[k] = x[k]*w[k] */
+inline void vmul(const float *x, const float *w, float *y, size_t n) {
+	size_t k = 0;
+
+	for (; k+4 <= n; k += 4)
+		_mm_storeu_ps(&y[k], _mm_mul_ps(_mm_loadu_ps(&x[k]), _mm_loadu_ps(&w[k])));
+	for (; k < n; k++)
+		y[k] = x[k]*w[k];
+}
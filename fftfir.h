@@ -0,0 +1,92 @@
+/*
+ * fftfir.h -- Long FIR filter by uniformly partitioned fast convolution
+ *
+ * The filter is split into partitions of COEF_PART taps whose spectra FilterCoefs has
+ * prepared (and cached). Every COEF_PART input samples the newest block is transformed once
+ * and the output block is the inverse transform of the sum of the products of the partition
+ * spectra and the spectra of the last input blocks (overlap-save), so the cost per sample
+ * grows with the logarithm of the partition length instead of the filter length. The output
+ * is delayed by one partition in addition to the group delay of the filter.
+ */
+
+#pragma once
+#include <windows.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "fft.h"
+#include "node.h"
+#include "coefs.h"
+
+using namespace std;
+
+
+class FftFir: public DspNode {
+public:
+	/* coefs must have the FFT layout (spectra() not NULL), it is copied */
+	FftFir(const FilterCoefs &coefs): B(COEF_PART), P(coefs.partitions()), K(COEF_PART+1), fft_(2*COEF_PART) {
+		H_ = new cfloat[P*K]; X_ = new cfloat[P*K]; Y_ = new cfloat[K];
+		t_ = new float[2*B];  in_ = new float[2*B]; out_ = new float[B];
+		memcpy(H_, coefs.spectra(), P*K*sizeof(cfloat));
+		delay_ = coefs.groupDelay() > 0.0 ? (UINT32)coefs.groupDelay() : 0;
+		reset();
+	}
+
+	~FftFir() {
+		delete [] H_; delete [] X_; delete [] Y_;
+		delete [] t_; delete [] in_; delete [] out_;
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			n = min(samples - i, B - pos_);
+
+			// left channel in, the output of the previous block out on both channels
+			for (UINT32 j = 0; j < n; j++)
+				in_[B + pos_ + j] = input[i+j].left;
+			simd().f32ToPcm(&out_[pos_], &out_[pos_], &output[i], n);
+
+			if ((pos_ += n) == B) {
+				convolve();
+				pos_ = 0;
+			}
+		}
+	}
+
+	void reset() {
+		memset(X_, 0, P*K*sizeof(cfloat));
+		memset(in_, 0, 2*B*sizeof(float));
+		memset(out_, 0, B*sizeof(float));
+		pos_ = head_ = 0;
+	}
+
+	const char *name() const { return "fftfir"; }
+
+	UINT32 latency() const { return B + delay_; }
+
+	/* the filter and the output block */
+	UINT32 tail() const { return P*B + B; }
+
+	/* the input is copied to in_ before the output of the same frames is written */
+	bool inPlace() const { return true; }
+
+private:
+	/* spectrum of the last two input blocks, the output of the newer one */
+	void convolve() {
+		head_ = (head_ + P-1) % P;
+		fft_.forward(in_, &X_[head_*K]);
+		memcpy(in_, &in_[B], B*sizeof(float));
+
+		memset(Y_, 0, K*sizeof(cfloat));
+		for (UINT32 p = 0; p < P; p++)
+			cmac(&H_[p*K], &X_[((head_+p) % P)*K], Y_, K);
+		fft_.inverse(Y_, t_);
+		memcpy(out_, &t_[B], B*sizeof(float));
+	}
+
+	UINT32  B, P, K;				// partition length, number of partitions, number of bins
+	RealFft fft_;
+	cfloat *H_, *X_, *Y_;			// filter spectra, input spectra (newest at head_), output spectrum
+	float  *t_, *in_, *out_;		// transform buffer, previous and current input block, output block
+	UINT32  pos_, head_;
+	UINT32  delay_;					// group delay of a linear phase filter
+};
@@ -3,65 +3,90 @@
 #include <emmintrin.h>
 #include <tmmintrin.h>
 #include "wavIO.h"
+#include "simd.h"
 #include "cirbuffer.h"
+#include "node.h"
+#include "coefs.h"
 
 using namespace std;
 
+enum fir_kernel {fir_scalar, fir_ssse3, fir_avx2, fir_folded, fir_kernels};
 
-class Fir: private CircularBuffer {
+
+class Fir: public DspNode, private CircularBuffer {
 public:
-	Fir(void *pCoeffs, size_t capacity): pC(pCoeffs), pC_len(capacity), CircularBuffer(capacity) {
+	/* Q15 coefficients compiled in (fdacoefs*.h) */
+	Fir(void *pCoeffs, size_t capacity): Fir(FilterCoefs((const INT16 *)pCoeffs, capacity)) {
 	}
 
-#if 0
-	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
-		for (UINT32 i = 0; i < samples; i++) {
-			write(input[i].left);										// add sample to the delay line
+	/* copies the prepared layouts, the coefficients need not outlive the filter */
+	Fir(const FilterCoefs &coefs): pC_len(coefs.length()), fold_(NULL), CircularBuffer(coefs.length()) {
+		latency_ = coefs.groupDelay() > 0.0 ? (UINT32)coefs.groupDelay() : 0;
+		hv_ = (INT16 *)_aligned_malloc(coefs.padded()*sizeof(INT16), COEF_ALIGN);
+		memcpy(hv_, coefs.q15(), coefs.padded()*sizeof(INT16));
+		if (coefs.symmetric()) {
+			fold_ = (INT16 *)_aligned_malloc(coefs.foldedLength()*sizeof(INT16), COEF_ALIGN);
+			memcpy(fold_, coefs.folded(), coefs.foldedLength()*sizeof(INT16));
+		}
 
-			double  acc = 0;
-			INT16 *index = getPtr();
-			for (double *h = (double *)BR; h < &BR[BL]; h++) {
-				acc += (/*100.0**/(double)*index++/32768.0) * *h;		// MAC
-				ptrCheck(index);										// wrap around circular buffer end
-			};
+		setKernel(simdLevel() >= avx2_level ? fir_avx2 : fir_ssse3);
+	}
 
-			output[i].left = output[i].right = saturate(32768.0*acc);	// double -> Q15 format conversion with saturate and round
+	~Fir() {
+		_aligned_free(hv_);
+		_aligned_free(fold_);
+	}
+
+	/* all kernels give bit-exact results, they differ only in speed; the AVX2 kernel only when the
+	   selected instruction set (simdSelect()) has it */
+	bool setKernel(fir_kernel k) {
+		switch (k) {
+		case fir_scalar: dot_ = &Fir::dotScalar; break;
+		case fir_ssse3:  dot_ = &Fir::dotSsse3;  break;
+		case fir_folded:
+			if (fold_ == NULL)
+				return false;
+			dot_ = &Fir::dotFolded;
+			break;
+		case fir_avx2:
+			if (simdLevel() < avx2_level)
+				return false;
+			dot_ = &Fir::dotAvx2;
+			break;
+		default:
+			return false;
 		}
+		kernel_ = k;
+
+		return true;
 	}
-#elif 1
-	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
-		for (UINT32 i = 0; i < samples; i++) {
-			write(input[i].left);									// add sample to the delay line
 
-			INT32  acc = 0x4000;									// Q30 -> Q15 rounding constant
-			INT16 *index = getPtr();
-			for (INT16 *h = (INT16 *)pC; h < &((INT16 *)pC)[pC_len]; h++) {
-				acc += (INT32)*index++ * *h;						// Q15*Q15->Q30 MAC
-				ptrCheck(index);									// wrap around circular buffer end
-			};
+	fir_kernel kernel() const { return kernel_; }
 
-			output[i].left = output[i].right = saturate(acc >> 15);	// Q30 -> Q15 format conversion with rounding and saturation
-		}
+	static const char *kernelName(fir_kernel k) {
+		static const char *names[] = { "scalar", "ssse3", "avx2", "folded" };
+
+		return k < fir_kernels ? names[k] : "?";
 	}
-#elif 0
+
+	size_t length() const { return pC_len; }
+
 	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
-		for (UINT32 i = 0; i < samples; i++) {
-			write(input[i].left);																		// add sample to the delay line
-
-			__m128i acc    = _mm_set_epi32(0x0, 0x0, 0x0, 0x4000);										// Q30 -> Q15 rounding constant
-			__m128i *h     = (__m128i *)pC;
-			__m128i *index = (__m128i *)getPtr();
-			for (unsigned j = 0; j < (pC_len+7)/8; j++) {
-				acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128(index++), h[j]));				// Q15*Q15->Q30 MAC
-				ptrCheck(index);																		// wrap around circular buffer end
+		__declspec(align(16)) INT32 acc[SIMD_BLOCK];
+		__declspec(align(16)) INT16 y[SIMD_BLOCK];
+
+		for (UINT32 i0 = 0, n; i0 < samples; i0 += n) {
+			n = min(samples - i0, (UINT32)SIMD_BLOCK);
+
+			for (UINT32 i = 0; i < n; i++) {
+				write(input[i0+i].left);								// add sample to the delay line
+				acc[i] = (this->*dot_)() >> 15;
 			}
 
-			acc = _mm_hadd_epi32(acc, acc);																// accumulate four partial values to one result
-			acc = _mm_hadd_epi32(acc, acc);
-			output[i].left = output[i].right = saturate(_mm_cvtsi128_si32(_mm_srai_epi32(acc, 15)));	// Q30 -> Q15 format conversion
+			simd().i32ToI16(acc, y, n);									// Q30 -> Q15 format conversion with saturation
+			simd().interleave(y, y, &output[i0], n);
 		}
 	}
-#endif
 
 	void test(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
 		for (UINT32 i = 0; i < samples; i++) {
@@ -72,8 +97,89 @@ public:
 		}
 	}
 
+	void reset() {
+		clear();
+	}
+
+	const char *name() const { return "fir"; }
+
+	/* the delay line holds all the state, it is all zeros after as many zeros */
+	UINT32 tail() const { return (UINT32)pC_len; }
+
+	/* the delay line holds all the state */
+	UINT32 preroll(double decayDb) const { return (UINT32)pC_len - 1; }
+
+	/* whole samples of the group delay of a linear phase filter (47 of 47.5 for 96 taps), 0 otherwise */
+	UINT32 latency() const { return latency_; }
+
+	/* each input sample goes to the delay line before its output is written */
+	bool inPlace() const { return true; }
+
 private:
-	void  *pC;
+	/* Q30 dot product of the coefficients and the delay line, rounded */
+	INT32 dotScalar() {
+		INT32  acc = 0x4000;											// Q30 -> Q15 rounding constant
+		INT16 *index = getPtr();
+		for (INT16 *h = hv_; h < &hv_[pC_len]; h++) {
+			acc += (INT32)*index++ * *h;								// Q15*Q15->Q30 MAC
+			ptrCheck(index);											// wrap around circular buffer end
+		};
+
+		return acc;
+	}
+
+	/* symmetric filter: the samples sharing a coefficient are added first, half of the multiplies
+	   (the sum is the same modulo 2^32, so the result is bit-exact with the other kernels) */
+	INT32 dotFolded() {
+		INT32  acc = 0x4000;
+		INT16 *a   = getPtr(), *b = a-1;								// newest and oldest sample
+		ptrCheckBack(b);
+		for (size_t k = 0; k < pC_len/2; k++) {
+			acc += ((INT32)*a++ + *b--) * fold_[k];
+			ptrCheck(a);
+			ptrCheckBack(b);
+		}
+		if (pC_len & 1)
+			acc += (INT32)*a * fold_[pC_len/2];							// center tap
+
+		return acc;
+	}
+
+	INT32 dotSsse3() {
+		__m128i  acc   = _mm_set_epi32(0x0, 0x0, 0x0, 0x4000);			// Q30 -> Q15 rounding constant
+		__m128i *h     = (__m128i *)hv_;
+		__m128i *index = (__m128i *)getPtr();
+		for (unsigned j = 0; j < (pC_len+7)/8; j++) {
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128(index++), h[j]));	// Q15*Q15->Q30 MAC
+			ptrCheck(index);											// wrap around circular buffer end
+		}
+
+		acc = _mm_hadd_epi32(acc, acc);									// accumulate four partial values to one result
+		acc = _mm_hadd_epi32(acc, acc);
+
+		return _mm_cvtsi128_si32(acc);
+	}
+
+	SIMD_AVX2 INT32 dotAvx2() {
+		__m256i  acc   = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, 0x4000);
+		__m256i *h     = (__m256i *)hv_;
+		__m256i *index = (__m256i *)getPtr();
+		for (unsigned j = 0; j < (pC_len+15)/16; j++) {
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256(index++), _mm256_load_si256(&h[j])));
+			ptrCheck(index);
+		}
+
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		s = _mm_hadd_epi32(s, s);
+		s = _mm_hadd_epi32(s, s);
+
+		return _mm_cvtsi128_si32(s);
+	}
+
 	size_t pC_len;
+	INT16 *hv_;														// padded coefficients
+	INT16 *fold_;														// first half of a symmetric filter, or NULL
+	UINT32 latency_;
+	INT32 (Fir::*dot_)();
+	fir_kernel kernel_;
 };
-
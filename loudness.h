@@ -0,0 +1,367 @@
+/*
+ * loudness.h -- Loudness meter after ITU-R BS.1770-4 and EBU R128
+ *
+ * Passes the signal through unchanged and measures the momentary (400 ms), short-term (3 s)
+ * and integrated loudness, the loudness range (EBU Tech 3342) and the true peak. Both channels
+ * are K-weighted (high shelf and high-pass biquads) together in one SSE2 register pair and the
+ * weighted energy is summed over 100 ms steps, the overlapping 400 ms gating blocks and 3 s
+ * windows being sums of the last steps.
+ *
+ * The gating blocks and the short-term values go to histograms of 0.1 LU bins holding the
+ * number and the energy sum of the values in each bin, so the gated integrated loudness and
+ * the loudness range are found from the histograms at any time without keeping the history.
+ * The relative gates are thereby quantized to 0.1 LU.
+ *
+ * The true peak is the largest of the samples and of the 4 times oversampled signal, the
+ * interpolation filter (12 taps per phase) runs the four phases of a sample in one register.
+ *
+ * The reading of every 100 ms step is published to other threads through a sequence lock, so
+ * the processing thread never waits for a reader.
+ */
+
+#pragma once
+#include <windows.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "cirbuffer.h"
+#include "node.h"
+#include <atomic>
+
+using namespace std;
+
+#define LOUD_STEP		(FS/10)	// gating block step (in samples, 100 ms)
+#define LOUD_MOMENTARY	4		// steps of the momentary window (400 ms, also the gating block)
+#define LOUD_SHORT		30		// steps of the short-term window (3 s)
+#define LOUD_ABS_GATE	-70.0	// absolute gate (LUFS), the lower end of the histograms
+#define LOUD_REL_GATE	-10.0	// relative gate of the integrated loudness (LU)
+#define LRA_REL_GATE	-20.0	// relative gate of the loudness range (LU)
+#define LOUD_BINS		1000	// histogram bins of 0.1 LU from LOUD_ABS_GATE up
+#define TP_TAPS			12		// taps of each phase of the true peak interpolator
+
+
+/* meter reading at the end of a 100 ms step, -HUGE_VAL for silence */
+struct LoudnessReading {
+	UINT64 frame;				// stream time of the reading (in samples)
+	float  momentary;			// LUFS
+	float  shortTerm;			// LUFS
+	float  integrated;			// LUFS
+	float  range;				// LU
+	float  truePeak;			// dBTP
+};
+
+
+class LoudnessMeter: public DspNode {
+public:
+	LoudnessMeter(): seq_(0) {
+		// K-weighting stages from their analog prototypes, so that any sampling rate gives the BS.1770 response
+		double K  = tan(M_PI*1681.974450955533/FS), Q = 0.7071752369554196;
+		double Vh = pow(10.0, 3.999843853973347/20.0), Vb = pow(Vh, 0.4996667741545416), a0 = 1.0 + K/Q + K*K;
+
+		k_[0].b0 = (Vh + Vb*K/Q + K*K)/a0; k_[0].b1 = 2.0*(K*K - Vh)/a0; k_[0].b2 = (Vh - Vb*K/Q + K*K)/a0;
+		k_[0].a1 = 2.0*(K*K - 1.0)/a0;     k_[0].a2 = (1.0 - K/Q + K*K)/a0;
+
+		K  = tan(M_PI*38.13547087602444/FS); Q = 0.5003270373238773; a0 = 1.0 + K/Q + K*K;
+		k_[1].b0 = 1.0; k_[1].b1 = -2.0; k_[1].b2 = 1.0;
+		k_[1].a1 = 2.0*(K*K - 1.0)/a0;     k_[1].a2 = (1.0 - K/Q + K*K)/a0;
+
+		// true peak interpolator: Kaiser windowed sinc at the original Nyquist centered on tap 4*TP_TAPS/2
+		// (phase 0 gives the samples, the last tap is a zero of the sinc), phase p has the taps 4j+p,
+		// tp_[j] the four phases of tap j, each phase normalized to unity gain at DC
+		double h[4*TP_TAPS], sum[4] = { 0.0 }, c = 2*TP_TAPS;
+		tp_ = (float (*)[4])_aligned_malloc(TP_TAPS*sizeof(*tp_), 16);		// the meter itself may be on the heap
+		for (int n = 0; n < 4*TP_TAPS; n++) {
+			double t = (n - c)/4.0, r = (n - c)/(c + 1.0);
+
+			h[n] = (n == c ? 1.0 : sin(M_PI*t)/(M_PI*t)) * besselI0(8.0*sqrt(1.0 - r*r))/besselI0(8.0);
+			sum[n & 3] += h[n];
+		}
+		for (int j = 0; j < TP_TAPS; j++)
+			for (int p = 0; p < 4; p++)
+				tp_[j][p] = (float)(h[4*j+p]/sum[p]);
+
+		reset();
+	}
+
+	~LoudnessMeter() {
+		_aligned_free(tp_);
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		if (output != input)
+			memcpy(output, input, samples*sizeof(pcm_frame));
+
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			// up to the end of the current step
+			n = min(samples - i, (UINT32)LOUD_STEP - pos_);
+			weigh(&input[i], n);
+			peak(&input[i], n);
+
+			if ((pos_ += n) == LOUD_STEP) {
+				step();
+				pos_ = 0;
+			}
+		}
+	}
+
+	void reset() {
+		memset(s_, 0, sizeof(s_));
+		memset(x_, 0, sizeof(x_));
+		memset(e_, 0, sizeof(e_));
+		blocks_.clear();
+		shortTerms_.clear();
+		acc_   = 0.0;
+		peak_  = 0.0f;
+		maxM_  = maxS_ = -HUGE_VAL;
+		pos_   = xpos_ = 0;
+		steps_ = 0;
+	}
+
+	const char *name() const { return "loudness"; }
+
+	/* the readings of the last complete step (LUFS, LU and dBTP) */
+	double momentary() const { return lufs(window(LOUD_MOMENTARY)); }
+	double shortTerm() const { return lufs(window(LOUD_SHORT)); }
+	double integrated() const { return lufs(blocks_.gatedMean(LOUD_REL_GATE)); }
+	double truePeak() const { return 20.0*log10(peak_/32768.0); }
+	double maxMomentary() const { return maxM_; }
+	double maxShortTerm() const { return maxS_; }
+
+	/* spread of the short-term loudness: the 10th to the 95th percentile of the gated values */
+	double range() const {
+		double lo, hi;
+
+		if (!shortTerms_.percentiles(LRA_REL_GATE, 0.10, 0.95, &lo, &hi))
+			return 0.0;
+		return hi - lo;
+	}
+
+	/* any thread: the latest reading, false if there is none yet */
+	bool reading(LoudnessReading &r) const {
+		UINT32 s;
+
+		do {
+			while ((s = seq_.load(memory_order_acquire)) & 1)
+				;												// being written
+			if (s == 0)
+				return false;
+			r = last_;
+			atomic_thread_fence(memory_order_acquire);
+		} while (seq_.load(memory_order_relaxed) != s);
+
+		return true;
+	}
+
+private:
+	struct Biquad {
+		double b0, b1, b2, a1, a2;
+	};
+
+	/* values of the gated measures (energies of the blocks, the mean square of full scale being 1)
+	   counted in bins of 0.1 LU */
+	class Histogram {
+	public:
+		void clear() {
+			memset(count_, 0, sizeof(count_));
+			memset(energy_, 0, sizeof(energy_));
+			total_ = 0;
+			sum_   = 0.0;
+		}
+
+		/* values under the absolute gate are not counted */
+		void add(double e) {
+			double l = lufs(e);
+
+			if (l <= LOUD_ABS_GATE)
+				return;
+			int b = min((int)((l - LOUD_ABS_GATE)*10.0), LOUD_BINS-1);
+			count_[b]++;
+			energy_[b] += e;
+			total_++;
+			sum_ += e;
+		}
+
+		/* mean energy of the values above the relative gate (gate LU below the mean of all the values) */
+		double gatedMean(double gate) const {
+			UINT64 n = 0;
+			double e = 0.0;
+
+			if (total_ == 0)
+				return 0.0;
+			for (int b = bin(lufs(sum_/total_) + gate); b < LOUD_BINS; b++) {
+				n += count_[b];
+				e += energy_[b];
+			}
+			return n > 0 ? e/n : 0.0;
+		}
+
+		/* loudness of the lower and upper fractions of the values above the relative gate (bin centers) */
+		bool percentiles(double gate, double lower, double upper, double *lo, double *hi) const {
+			if (total_ == 0)
+				return false;
+			int    first = bin(lufs(sum_/total_) + gate);
+			UINT64 n = 0, k = 0;
+
+			for (int b = first; b < LOUD_BINS; b++)
+				n += count_[b];
+			if (n == 0)
+				return false;
+
+			UINT64 kLo = (UINT64)(lower*(n-1) + 0.5), kHi = (UINT64)(upper*(n-1) + 0.5);
+			for (int b = first; b < LOUD_BINS; b++) {
+				if (k <= kLo && kLo < k + count_[b])
+					*lo = LOUD_ABS_GATE + (b + 0.5)/10.0;
+				if (k <= kHi && kHi < k + count_[b])
+					*hi = LOUD_ABS_GATE + (b + 0.5)/10.0;
+				k += count_[b];
+			}
+			return true;
+		}
+
+	private:
+		static int bin(double l) {
+			return max(0, min((int)ceil((l - LOUD_ABS_GATE)*10.0), LOUD_BINS-1));
+		}
+
+		UINT32 count_[LOUD_BINS];
+		double energy_[LOUD_BINS];
+		UINT64 total_;
+		double sum_;
+	};
+
+	static double lufs(double e) {
+		return e > 0.0 ? -0.691 + 10.0*log10(e) : -HUGE_VAL;
+	}
+
+	static double besselI0(double x) {
+		double sum = 1.0, term = 1.0;
+
+		for (int k = 1; k < 32; k++) {
+			term *= (x/(2.0*k))*(x/(2.0*k));
+			sum  += term;
+		}
+		return sum;
+	}
+
+	/* mean square of the last steps (of full scale), 0 until the window is full */
+	double window(UINT32 n) const {
+		double e = 0.0;
+
+		if (steps_ < n)
+			return 0.0;
+		for (UINT32 k = 1; k <= n; k++)
+			e += e_[(steps_ - k) % LOUD_SHORT];
+		return e/n;
+	}
+
+	/* K-weighting of both channels (transposed direct form II, left in the low and right in the high lane)
+	   and the sum of the squares */
+	void weigh(const pcm_frame *input, UINT32 n) {
+		__m128d s10 = _mm_loadu_pd(s_[0][0]), s11 = _mm_loadu_pd(s_[0][1]);
+		__m128d s20 = _mm_loadu_pd(s_[1][0]), s21 = _mm_loadu_pd(s_[1][1]);
+		__m128d acc = _mm_setzero_pd();
+		const __m128d b0 = _mm_set1_pd(k_[0].b0), b1 = _mm_set1_pd(k_[0].b1), b2 = _mm_set1_pd(k_[0].b2);
+		const __m128d a1 = _mm_set1_pd(k_[0].a1), a2 = _mm_set1_pd(k_[0].a2);
+		const __m128d c1 = _mm_set1_pd(k_[1].a1), c2 = _mm_set1_pd(k_[1].a2);
+		const __m128d two = _mm_set1_pd(2.0);
+
+		for (UINT32 i = 0; i < n; i++) {
+			__m128i v = _mm_cvtsi32_si128(*(const int *)&input[i]);
+			__m128d x = _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+
+			// high shelf
+			__m128d y = _mm_add_pd(_mm_mul_pd(b0, x), s10);
+			s10 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, x), _mm_mul_pd(a1, y)), s11);
+			s11 = _mm_sub_pd(_mm_mul_pd(b2, x), _mm_mul_pd(a2, y));
+
+			// high-pass, numerator 1 -2 1
+			__m128d z = _mm_add_pd(y, s20);
+			s20 = _mm_sub_pd(_mm_sub_pd(s21, _mm_mul_pd(two, y)), _mm_mul_pd(c1, z));
+			s21 = _mm_sub_pd(y, _mm_mul_pd(c2, z));
+
+			acc = _mm_add_pd(acc, _mm_mul_pd(z, z));
+		}
+
+		_mm_storeu_pd(s_[0][0], s10); _mm_storeu_pd(s_[0][1], s11);
+		_mm_storeu_pd(s_[1][0], s20); _mm_storeu_pd(s_[1][1], s21);
+		acc = _mm_add_sd(acc, _mm_unpackhi_pd(acc, acc));			// both channels weighted by 1
+		acc_ += _mm_cvtsd_f64(acc);
+	}
+
+	/* largest magnitude of the samples and of the three interpolated points of the oversampled signal
+	   between each two of them; x_ keeps the last TP_TAPS samples of each channel twice, so that the
+	   taps are always contiguous */
+	void peak(const pcm_frame *input, UINT32 n) {
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		__m128 m = _mm_set1_ps(peak_);
+
+		for (UINT32 i = 0; i < n; i++) {
+			xpos_ = (xpos_ + TP_TAPS-1) % TP_TAPS;
+			for (int ch = 0; ch < 2; ch++) {
+				float x = ch ? input[i].right : input[i].left;
+
+				x_[ch][xpos_] = x_[ch][xpos_ + TP_TAPS] = x;
+			}
+
+			// the newest sample at xpos_, the taps in the order of the delay
+			const float *l = &x_[0][xpos_], *r = &x_[1][xpos_];
+			__m128 yl = _mm_setzero_ps(), yr = _mm_setzero_ps();
+			for (int j = 0; j < TP_TAPS; j++) {
+				__m128 h = _mm_load_ps(tp_[j]);
+				yl = _mm_add_ps(yl, _mm_mul_ps(h, _mm_set1_ps(l[j])));
+				yr = _mm_add_ps(yr, _mm_mul_ps(h, _mm_set1_ps(r[j])));
+			}
+			m = _mm_max_ps(m, _mm_max_ps(_mm_andnot_ps(sign, yl), _mm_andnot_ps(sign, yr)));
+			m = _mm_max_ps(m, _mm_andnot_ps(sign, _mm_set_ps(0.0f, 0.0f, r[0], l[0])));
+		}
+
+		m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+		peak_ = _mm_cvtss_f32(_mm_max_ss(m, _mm_shuffle_ps(m, m, 1)));
+	}
+
+	/* end of a 100 ms step: the new windows to the histograms and the reading published */
+	void step() {
+		LoudnessReading r;
+
+		e_[steps_ % LOUD_SHORT] = acc_/(32768.0*32768.0*LOUD_STEP);
+		acc_ = 0.0;
+		steps_++;
+
+		double m = window(LOUD_MOMENTARY), s = window(LOUD_SHORT);
+		if (steps_ >= LOUD_MOMENTARY) {
+			blocks_.add(m);
+			maxM_ = max(maxM_, lufs(m));
+		}
+		if (steps_ >= LOUD_SHORT) {
+			shortTerms_.add(s);
+			maxS_ = max(maxS_, lufs(s));
+		}
+
+		r.frame      = (UINT64)steps_*LOUD_STEP;
+		r.momentary  = (float)lufs(m);
+		r.shortTerm  = (float)lufs(s);
+		r.integrated = (float)integrated();
+		r.range      = (float)range();
+		r.truePeak   = (float)truePeak();
+
+		UINT32 seq = seq_.load(memory_order_relaxed);
+		seq_.store(seq + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		last_ = r;
+		seq_.store(seq + 2, memory_order_release);
+	}
+
+	Biquad          k_[2];					// high shelf and high-pass of the K-weighting
+	double          s_[2][2][2];			// state of the stages, both channels (loaded once per block)
+	float         (*tp_)[4];				// interpolator taps, the four phases of each (aligned)
+	float           x_[2][2*TP_TAPS];		// interpolator input of both channels
+	double          e_[LOUD_SHORT];			// mean squares of the last steps
+	double          acc_;					// weighted energy of the current step
+	float           peak_;					// largest magnitude so far
+	double          maxM_, maxS_;
+	Histogram       blocks_, shortTerms_;	// gating blocks and short-term values
+	LoudnessReading last_;					// latest reading, odd seq_ while it is being written
+	atomic<UINT32>  seq_;
+	UINT32          pos_, xpos_, steps_;
+};
@@ -9,10 +9,35 @@
  * Jan 2013		Steinberg VST plug-ins like programming interface for DSP objects
  * Feb 2013		event based audio processing for the audio capturing to decrease latencies
  * Apr 2014		Program termination possible also from the signal processing module (new thread for the UI)
+ * Oct 2026		Lock-free parameter passing to the audio thread, smoothed gain and crossfaded mode changes
+ * Oct 2026		Frequency response analysis of any processing block or chain of blocks
+ * Oct 2026		Golden output regression checks of all processing blocks and modes
+ * Oct 2026		Streaming STFT framework with noise suppression, spectral gate and EQ nodes
+ * Oct 2026		Echo canceller (time domain NLMS or partitioned frequency domain) with a chosen bulk delay
+ * Oct 2026		Offline feature extraction (log-mel, MFCC, RMS, zero-crossing rate) to a binary file
+ * Oct 2026		Lookahead limiter in the output stage instead of clipping, RMS compressor
+ * Oct 2026		Shared SSE2/AVX2/AVX-512 conversion and mixing kernels selected at run time
+ * Oct 2026		Oversampled waveshaper with polyphase half-band filters, cost and alias benchmark
+ * Oct 2026		Measured kernel, partition and block size plan, stored per CPU model
+ * Oct 2026		Processing modules loaded from DLLs through a stable C ABI (dspplugin.h), example module plugindelay
+ * Oct 2026		Processing chain rebuilt on a background thread and crossfaded in without dropouts
+ * Oct 2026		Output published to other processes through a shared memory ring, level monitor consumer
+ * Oct 2026		Filter mode detector for hundreds of streams, streams in the SIMD lanes
+ * Oct 2026		FIR coefficients loaded at run time with cached kernel layouts, folded and FFT filters
+ * Oct 2026		Parameter changes scheduled to a stream frame, blocks split at the change
+ * Oct 2026		Latency reported by every block, parallel branches lined up by shared delay lines
+ * Oct 2026		Long files processed offline in parallel segments with a state warm-up
+ * Oct 2026		Blocks skipped while their input is silent and their tail has decayed
+ * Oct 2026		EBU R128 loudness meter (momentary, short-term, integrated, range, true peak)
+ * Oct 2026		Pitch tracker (YIN by block partitioned fast correlation), test tone verification
+ * Oct 2026		Live input blocks captured by a background writer, replayed at the original timing or at full speed
+ * Oct 2026		Processing blocks as a static and a dynamic library with a C interface (dspapi.h), checked by dspapitest
+ * Oct 2026		Thread cycles, time and hardware counters (kernel ETW session) per block and per block of frames, as a table and JSON
  *
  * Written by Jarkko Vuori 2012, 2013, 2014
  */
 
+#define _USE_MATH_DEFINES
 #include <windows.h>
 #include <comdef.h>
 #include <stdio.h>
@@ -20,6 +45,12 @@
 #include <fstream>
 #include "dsp.h"
 #include "winaudio.h"
+#include "regress.h"
+#include "feature.h"
+#include "loudness.h"
+#include "pitch.h"
+#include "profile.h"
+#include "waveshaper.h"
 
 
 /* evaluates impulse responce of the system and stores it to the given file */
@@ -46,6 +77,961 @@ int testImpulseResponce(MyAudio *pAudio, LPCWSTR szFilename) {
 	return result;
 }
 
+/* measures the frequency response of the given comma separated chain of blocks and stores it to the given file */
+int testFrequencyResponce(MyAudio *pAudio, LPCWSTR szNodes, LPCWSTR szFilename, stimulus_type stimulus) {
+	Chain         chain("analysis");
+	Analyzer      analyzer(65536);
+	char          names[256], *name, *context = NULL;
+	LARGE_INTEGER t0, t1, freq;
+	size_t        n;
+
+	if (wcstombs_s(&n, names, sizeof(names), szNodes, _TRUNCATE) != 0)
+		return -__LINE__;
+	for (name = strtok_s(names, ",", &context); name != NULL; name = strtok_s(NULL, ",", &context)) {
+		DspNode *node = pAudio->GetNode(name);
+
+		if (node == NULL) {
+			printf("Unknown block '%s' (fir, fir1, fir2, reverb, fdn, chorus, denoise, gate, eq, compressor, limiter, waveshaper, plugin, chain or bandmix)\n", name);
+			return -__LINE__;
+		}
+		chain.add(node);
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	if (analyzer.measure(&chain, stimulus) != S_OK)
+		return -__LINE__;
+	QueryPerformanceCounter(&t1);
+
+	if (analyzer.save(szFilename) != S_OK)
+		return -__LINE__;
+
+	printf("Latency %u samples (%.2lf ms, %u reported by the blocks), analysed in %.1lf ms\n", analyzer.latency(), analyzer.latency()*1000.0/FS,
+		   chain.latency(), (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart);
+	return 0;
+}
+
+/* measures the thread cycles, the time and, with administrator rights, the hardware counters of
+   each block of the given comma separated chain over the WAV file (10 s of noise and a tone
+   without one), stores the counts to the JSON file if given */
+int profileNodes(MyAudio *pAudio, LPCWSTR szNodes, LPCWSTR szWaveFilename, LPCWSTR szJsonFilename) {
+	NodeProfiler  profiler;
+	Chain         chain("profile", PROF_BLOCK, true);
+	WavFileForIO  wav;
+	char          names[256], *name, *context = NULL;
+	pcm_frame    *in, *out = new pcm_frame[PROF_BLOCK];
+	UINT32        frames;
+	size_t        n;
+	LARGE_INTEGER t0, t1, freq;
+
+	if (wcstombs_s(&n, names, sizeof(names), szNodes, _TRUNCATE) != 0)
+		return -__LINE__;
+	for (name = strtok_s(names, ",", &context); name != NULL; name = strtok_s(NULL, ",", &context)) {
+		DspNode *node = pAudio->GetNode(name);
+
+		if (node == NULL) {
+			printf("Unknown block '%s' (fir, fir1, fir2, reverb, fdn, chorus, denoise, gate, eq, compressor, limiter, waveshaper, plugin, chain or bandmix)\n", name);
+			delete [] out;
+			return -__LINE__;
+		}
+		node->reset();
+		chain.add(new ProfiledNode(node, &profiler));
+	}
+
+	if (szWaveFilename != NULL) {
+		wav.setPath(szWaveFilename);
+		if (!wav.read()) {
+			printf("Cannot read %ls\n", szWaveFilename);
+			delete [] out;
+			return -__LINE__;
+		}
+		in     = wav.getFrames();
+		frames = wav.getFrameCount();
+	} else {
+		UINT32 s = 12345;
+
+		frames = 10*FS;
+		in     = new pcm_frame[frames];
+		for (UINT32 i = 0; i < frames; i++) {
+			s = s*1664525 + 1013904223;
+			in[i].left  = (INT16)(8192.0*sin(2.0*M_PI*440.0*i/FS) + (INT16)(s >> 16)*0.25);
+			in[i].right = (INT16)((INT16)(s >> 16)*0.25);
+		}
+	}
+
+	const char *why = profiler.startCounters();
+	if (why != NULL)
+		printf("Hardware counters not counted: %s\n", why);
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	for (UINT32 i = 0, m; i < frames; i += m) {
+		m = min(frames - i, (UINT32)PROF_BLOCK);
+		chain.process(&in[i], out, m);
+		profiler.next();
+	}
+	QueryPerformanceCounter(&t1);
+
+	if ((why = profiler.stopCounters()) != NULL)
+		printf("Hardware counters not counted: %s\n", why);
+
+	double ms = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+	printf("%u frames in blocks of %u in %.1lf ms (%.0lf x real time, with the counting)\n", frames, PROF_BLOCK, ms, frames*1000.0/FS / max(ms, 1e-3));
+	profiler.print();
+
+	int result = 0;
+	if (szJsonFilename != NULL && !profiler.save(szJsonFilename)) {
+		printf("Cannot write %ls\n", szJsonFilename);
+		result = -__LINE__;
+	}
+
+	if (szWaveFilename == NULL)
+		delete [] in;
+	delete [] out;
+	return result;
+}
+
+/* extracts the features of the given WAV file to a binary feature file */
+int extractFeatures(LPCWSTR szWaveFilename, LPCWSTR szFilename) {
+	WavFileForIO     wav(szWaveFilename);
+	FeatureExtractor features;
+	pcm_frame       *buf = new pcm_frame[4096];
+	LARGE_INTEGER    t0, t1, freq;
+	DWORD            flags = 0;
+
+	if (!wav.read()) {
+		printf("Cannot read %ls\n", szWaveFilename);
+		delete [] buf;
+		return -__LINE__;
+	}
+	if (features.open(szFilename, true) != S_OK) {
+		printf("Cannot create %ls\n", szFilename);
+		delete [] buf;
+		return -__LINE__;
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	UINT32 frames = wav.getFrameCount();
+	for (UINT32 i = 0, n; i < frames; i += n) {
+		n = min(frames - i, (UINT32)4096);
+		wav.LoadData(n, (BYTE *)buf, &flags);
+		features.process(buf, buf, n);
+	}
+	if (features.close() != S_OK) {
+		printf("Cannot write %ls\n", szFilename);
+		delete [] buf;
+		return -__LINE__;
+	}
+	QueryPerformanceCounter(&t1);
+
+	double ms = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+	printf("%u feature frames in %.1lf ms (%.0lf x real time)\n", frames/FEAT_HOP, ms, frames*1000.0/FS / max(ms, 1e-3));
+
+	delete [] buf;
+	return 0;
+}
+
+/* measures the loudness of the given WAV file */
+int measureLoudness(LPCWSTR szWaveFilename) {
+	WavFileForIO  wav(szWaveFilename);
+	LoudnessMeter meter;
+	LARGE_INTEGER t0, t1, freq;
+
+	if (!wav.read()) {
+		printf("Cannot read %ls\n", szWaveFilename);
+		return -__LINE__;
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	UINT32 frames = wav.getFrameCount();
+	for (UINT32 i = 0, n; i < frames; i += n) {
+		n = min(frames - i, (UINT32)4096);
+		meter.process(&wav.getFrames()[i], &wav.getFrames()[i], n);
+	}
+	QueryPerformanceCounter(&t1);
+
+	double ms = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+	printf("Integrated loudness %.1lf LUFS, loudness range %.1lf LU, true peak %.1lf dBTP\n", meter.integrated(), meter.range(), meter.truePeak());
+	printf("Largest momentary %.1lf LUFS, largest short-term %.1lf LUFS\n", meter.maxMomentary(), meter.maxShortTerm());
+	printf("Measured in %.1lf ms (%.0lf x real time)\n", ms, frames*1000.0/FS / max(ms, 1e-3));
+
+	return 0;
+}
+
+/* tracks the pitch of both channels of the given WAV file, without a file checks the frequencies
+   of the test tone generator */
+int trackPitch(LPCWSTR szWaveFilename) {
+	PitchTracker  tracker;
+	PitchFrame    f;
+	LARGE_INTEGER t0, t1, freq;
+
+	if (szWaveFilename == NULL) {
+		const double tones[] = { 55.0, 100.0, 440.0, 1000.0, 2500.0 };
+		pcm_frame   *in = new pcm_frame[441], *out = new pcm_frame[441];
+		int          result = 0;
+
+		memset(in, 0, 441*sizeof(pcm_frame));
+		for (int i = 0; i < sizeof(tones)/sizeof(tones[0]); i++) {
+			MyAudio *pAudio = new MyAudio;
+			DWORD    captureFlags = 0, renderFlags;
+
+			pAudio->SetMode(sinewave_mode);
+			pAudio->SetSineWaveFrequency(tones[i]);
+			tracker.reset();
+			for (int n = 0; n < 100; n++) {
+				pAudio->ProcessData(441, (BYTE *)in, &captureFlags, (BYTE *)out, &renderFlags);
+				tracker.process(out, out, 441);
+			}
+			delete pAudio;
+
+			// the generator plays the tone on both channels, the right one is tracked from the imaginary part of the transforms
+			for (int ch = 0; ch < 2; ch++) {
+				double cents = 1200.0*log(tracker.f0(ch)/tones[i])/log(2.0);
+				printf("Tone %7.1lf Hz %s: %9.3lf Hz (%+.2lf cents, confidence %.3f)\n", tones[i], ch == 0 ? "left " : "right", tracker.f0(ch), cents, tracker.confidence(ch));
+				if (fabs(cents) > 5.0)
+					result = -__LINE__;
+			}
+		}
+
+		delete [] in;
+		delete [] out;
+		return result;
+	}
+
+	WavFileForIO wav(szWaveFilename);
+	if (!wav.read()) {
+		printf("Cannot read %ls\n", szWaveFilename);
+		return -__LINE__;
+	}
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	UINT32 frames = wav.getFrameCount(), n = 0;
+	printf("time, f0 left, confidence, f0 right, confidence\n");
+	for (UINT32 i = 0, m; i < frames; i += m) {
+		m = min(frames - i, (UINT32)4096);
+		tracker.process(&wav.getFrames()[i], &wav.getFrames()[i], m);
+		while (tracker.pop(f)) {
+			printf("%.3lf, %.2f, %.3f, %.2f, %.3f\n", ((double)f.index*PITCH_HOP + PITCH_WINDOW)/FS, f.f0[0], f.confidence[0], f.f0[1], f.confidence[1]);
+			n++;
+		}
+	}
+	QueryPerformanceCounter(&t1);
+
+	double ms = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+	printf("%u pitch frames in %.1lf ms (%.0lf x real time)\n", n, ms, frames*1000.0/FS / max(ms, 1e-3));
+
+	return 0;
+}
+
+/* feeds a captured session through a new processing object, at the original timing or as fast as
+   possible, and reports the processing times and a checksum of the output */
+int replaySession(LPCWSTR szFilename, bool fRealtime) {
+	CaptureReader reader;
+	CaptureRecord r;
+	MyAudio      *pAudio = new MyAudio;
+	vector<pcm_frame> out;
+	LARGE_INTEGER t0, t1, t2, freq;
+	UINT32        blocks = 0, overruns = 0, lost = 0, params = 0, late = 0;
+	UINT64        frames = 0, sum = 0, worst = 0, hash = 14695981039346656037ULL;
+	HRESULT       hr = reader.open(szFilename);
+
+	if (hr != S_OK) {
+		printf(hr == E_NOTIMPL ? "%ls was captured in another format\n" : "Cannot read %ls\n", szFilename);
+		delete pAudio;
+		return -__LINE__;
+	}
+
+	// the live object was set up before the streaming, the blocks and the changes do not tell it
+	const CaptureSetup &setup = reader.setup();
+	if (pAudio->Setup(setup) != S_OK) {
+		printf("Cannot restore the setup of the session (module '%ls', coefficients '%ls')\n", setup.plugin, setup.coefs);
+		delete pAudio;
+		return -__LINE__;
+	}
+	printf("Setup: FIR kernels %s/%s/%s, echo canceller partition %u%s, delay %u, chain crossfade %u blocks%s%ls%s%ls\n",
+		   Fir::kernelName((fir_kernel)setup.firKernel[0]), Fir::kernelName((fir_kernel)setup.firKernel[1]), Fir::kernelName((fir_kernel)setup.firKernel[2]),
+		   setup.aecPartition, setup.aecPartition == 0 ? " (NLMS)" : "", setup.aecDelay, setup.chainFade, setup.plugin[0] ? ", module " : "", setup.plugin, setup.coefs[0] ? ", coefficients " : "", setup.coefs);
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	while (reader.next(r)) {
+		if (r.flags & CAPTURE_LOST)
+			lost++;
+
+		// the changes were applied in the following block, at the same frames now
+		if (r.flags & CAPTURE_PARAM) {
+			const CaptureParam &p = reader.param();
+
+			switch (p.id) {
+			case mode_param:      pAudio->SetMode((dsp_mode)(int)p.value, p.frame); break;
+			case frequency_param: pAudio->SetSineWaveFrequency(p.value, p.frame);   break;
+			case gain_param:      pAudio->SetGain(p.value, p.frame);                break;
+			case aec_param:       pAudio->SetEchoCanceller(p.value != 0.0, p.frame); break;
+			case limiter_param:   pAudio->SetLimiter(p.value != 0.0, p.frame);      break;
+			case chain_param:
+				// a chain variant built during the session, taken at the start of the next block as it was;
+				// the chain of the coefficients was already published by the setup
+				if (p.value >= 0.0)
+					pAudio->SwapChain(MyAudio::MakeChain((int)p.value), (int)p.value);
+				break;
+			}
+			params++;
+			continue;
+		}
+		// the device loop dropped the block without processing it
+		if (r.flags & CAPTURE_OVERRUN) {
+			overruns++;
+			continue;
+		}
+
+		if (fRealtime) {
+			LONGLONG due = t0.QuadPart + (LONGLONG)(reader.seconds(r.time)*freq.QuadPart);
+
+			do {
+				QueryPerformanceCounter(&t1);
+				if (due - t1.QuadPart > freq.QuadPart/500)
+					Sleep(1);
+			} while (t1.QuadPart < due);
+		}
+
+		DWORD captureFlags = r.flags & ~CAPTURE_RECORD, renderFlags;
+		if (out.size() < r.frames)
+			out.resize(r.frames);
+		QueryPerformanceCounter(&t1);
+		pAudio->ProcessData(r.frames, (BYTE *)reader.frames(), &captureFlags, (BYTE *)out.data(), &renderFlags);
+		QueryPerformanceCounter(&t2);
+
+		// processing time against the duration of the block
+		UINT64 ticks = t2.QuadPart - t1.QuadPart;
+		sum   += ticks;
+		worst  = max(worst, ticks);
+		if (ticks*FS > (UINT64)r.frames*freq.QuadPart)
+			late++;
+		for (UINT32 i = 0; i < r.frames*sizeof(pcm_frame); i++)
+			hash = (hash ^ ((BYTE *)out.data())[i]) * 1099511628211ULL;		// FNV-1a
+		blocks++;
+		frames += r.frames;
+	}
+	QueryPerformanceCounter(&t1);
+	delete pAudio;
+
+	double ms = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+	printf("%u blocks (%llu frames, %.1lf s), %u parameter changes, %u overruns, %u gaps of lost records\n",
+		   blocks, frames, (double)frames/FS, params, overruns, lost);
+	printf("Processing %.1lf us per block on the average, %.1lf us at most, %u blocks over their duration\n",
+		   blocks > 0 ? sum*1e6/freq.QuadPart/blocks : 0.0, worst*1e6/freq.QuadPart, late);
+	printf("Replayed in %.1lf ms (%.1lf x real time), output checksum %016llx\n", ms, frames*1000.0/FS / max(ms, 1e-3), hash);
+
+	return 0;
+}
+
+/* processes the WAV file through the given comma separated chain of blocks in parallel segments
+   (0 for one per processor), compares the result with the serial processing and stores it to the
+   output file */
+int processSegmented(LPCWSTR szNodes, LPCWSTR szWaveFilename, LPCWSTR szFilename, UINT32 segments, double decayDb) {
+	WavFileForIO  wav(szWaveFilename);
+	char          names[256];
+	size_t        len;
+	LARGE_INTEGER t0, t1, t2, freq;
+
+	if (wcstombs_s(&len, names, sizeof(names), szNodes, _TRUNCATE) != 0)
+		return -__LINE__;
+	auto factory = [&names]() {
+		Chain *chain = new Chain("segment", SEG_BLOCK, true);
+		char   buf[256], *name, *context = NULL;
+
+		strcpy_s(buf, sizeof(buf), names);
+		for (name = strtok_s(buf, ",", &context); name != NULL; name = strtok_s(NULL, ",", &context)) {
+			DspNode *node = MyAudio::MakeNode(name);
+
+			if (node == NULL) {
+				printf("Unknown block '%s' (fir, fir1, fir2, reverb, bandmix or chain)\n", name);
+				delete chain;
+				return (Chain *)NULL;
+			}
+			chain->add(node);
+		}
+		return chain;
+	};
+
+	Chain *serial = factory();
+	if (serial == NULL)
+		return -__LINE__;
+	if (!wav.read()) {
+		printf("Cannot read %ls\n", szWaveFilename);
+		delete serial;
+		return -__LINE__;
+	}
+	UINT32     frames = wav.getFrameCount();
+	pcm_frame *ref    = new pcm_frame[frames], *out = new pcm_frame[frames];
+
+	// serial reference
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	for (UINT32 i = 0, n; i < frames; i += n) {
+		n = min(frames - i, (UINT32)SEG_BLOCK);
+		serial->process(&wav.getFrames()[i], &ref[i], n);
+	}
+	delete serial;
+	QueryPerformanceCounter(&t1);
+
+	SegmentRunner runner([&factory]() { return (DspNode *)factory(); }, segments, decayDb);
+	HRESULT hr = runner.process(wav.getFrames(), out, frames);
+	QueryPerformanceCounter(&t2);
+	if (hr != S_OK) {
+		printf("The chain has a block whose state cannot be rebuilt from its input\n");
+		delete [] ref;
+		delete [] out;
+		return -__LINE__;
+	}
+
+	double ms1 = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart, ms2 = (t2.QuadPart - t1.QuadPart)*1000.0/freq.QuadPart;
+	printf("%u frames in %u segments, pre-roll %u samples: serial %.1lf ms, parallel %.1lf ms (%.1lf x)\n", frames, runner.segments(), runner.preroll(),
+		   ms1, ms2, ms1/max(ms2, 1e-3));
+
+	int    diff = 0;
+	double es = 0.0, en = 0.0;
+	for (UINT32 i = 0; i < frames; i++) {
+		int dl = out[i].left - ref[i].left, dr = out[i].right - ref[i].right;
+
+		diff = max(diff, max(abs(dl), abs(dr)));
+		es  += (double)ref[i].left*ref[i].left + (double)ref[i].right*ref[i].right;
+		en  += (double)dl*dl + (double)dr*dr;
+	}
+	if (diff == 0)
+		printf("Bit-exact with the serial processing\n");
+	else
+		printf("Max difference %d LSB (bound %.2lf LSB: %.2lf from the state at %.0lf dB decay, the rest the limit cycles of the feedback), SNR %.1lf dB\n",
+			   diff, runner.errorBound(), runner.stateError(), decayDb, 10.0*log10(es/en));
+
+	memcpy(wav.getFrames(), out, frames*sizeof(pcm_frame));
+	wav.setPath(szFilename);
+	int result = wav.save() ? 0 : -__LINE__;
+
+	delete [] ref;
+	delete [] out;
+	return result;
+}
+
+/* measures the cost and the alias level of the waveshaper at each oversampling factor */
+int benchWaveshaper() {
+	const UINT32 N = 16384, k0 = 2341;		// analysis length, test tone bin (6.3 kHz)
+	const UINT32 frames = 10*FS;
+	pcm_frame   *buf = new pcm_frame[frames];
+	float       *x   = (float *)_aligned_malloc(N*sizeof(float), 16), *p = new float[N/2+1];
+	cfloat      *X   = (cfloat *)_aligned_malloc((N/2+1)*sizeof(cfloat), 16);
+	RealFft      fft(N);
+	LARGE_INTEGER t0, t1, freq;
+
+	QueryPerformanceFrequency(&freq);
+	printf("factor  latency  time/s (ms)  ns/sample  alias (dBc)\n");
+	for (UINT32 factor = 1; factor <= 8; factor *= 2) {
+		Waveshaper shaper(factor);
+
+		for (UINT32 i = 0; i < frames; i++)
+			buf[i].left = buf[i].right = (INT16)(29205.0*sin(2.0*M_PI*k0*i/N));		// -1 dBFS
+
+		QueryPerformanceCounter(&t0);
+		for (UINT32 i = 0, n; i < frames; i += n) {
+			n = min(frames - i, (UINT32)256);
+			shaper.process(&buf[i], &buf[i], n);
+		}
+		QueryPerformanceCounter(&t1);
+
+		// every bin other than DC and the odd harmonics of the tone is alias (or quantization noise)
+		for (UINT32 i = 0; i < N; i++)
+			x[i] = buf[frames-N+i].left;
+		fft.forward(x, X);
+		cpower(X, p, N/2+1);
+		double alias = 0.0;
+		for (UINT32 k = 1; k <= N/2; k++)
+			if (k % k0 != 0 || (k/k0) % 2 == 0)
+				alias += p[k];
+
+		double ms = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+		printf("%4ux   %5u    %9.2lf  %9.2lf  %9.1lf\n", factor, shaper.latency(), ms/10.0, ms*1e6/(2.0*frames),
+			   10.0*log10(alias/p[k0] + 1e-30));
+	}
+
+	delete [] buf; delete [] p;
+	_aligned_free(x); _aligned_free(X);
+	return 0;
+}
+
+/* runs the filter mode detector on the given number of streams at once and compares the throughput
+   and the results with the single stream Fir blocks */
+int benchSessions(MyAudio *pAudio, int sessions) {
+	const UINT32 seconds = 10, N = SESSION_BLOCK, blocks = seconds*FS/N, period = 100;	// input signals repeat every period blocks
+	const int    checked[] = { 0, 1, 2, 3 };				// session 0 restarts half way
+	const int    nChecked  = sizeof(checked)/sizeof(checked[0]);
+	DetectorBank *bank = MyAudio::MakeDetectorBank(sessions, N);
+	INT16       **pool = new INT16 *[16];
+	const INT16 **in   = new const INT16 *[sessions];
+	float        *level = new float[sessions], *ref = new float[blocks*nChecked];
+	LARGE_INTEGER t0, t1, freq;
+	UINT32        s = 1;
+
+	// 16 different inputs: noise plus a tone from 300 Hz to 5 kHz
+	for (int k = 0; k < 16; k++) {
+		pool[k] = new INT16[period*N];
+		for (UINT32 i = 0; i < period*N; i++) {
+			s = s*1664525 + 1013904223;
+			pool[k][i] = (INT16)((INT16)(s >> 16)/8 + 12000.0*sin(2.0*M_PI*(300.0 + 300.0*k)*i/FS));
+		}
+	}
+	for (int id = 0; id < sessions; id++)
+		while (bank->add() < 0)
+			bank->update();									// command queue full, this is the processing thread too
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	for (UINT32 b = 0; b < blocks; b++) {
+		// every fourth session restarts half way (with the same id), the others go on
+		if (b == blocks/2)
+			for (int id = 0; id < sessions; id += 4) {
+				while (!bank->remove(id))
+					bank->update();
+				while (bank->add() < 0)
+					bank->update();
+			}
+
+		for (int id = 0; id < sessions; id++)
+			in[id] = &pool[id % 16][(b % period)*N];
+		bank->process(in, level);
+		for (int c = 0; c < nChecked; c++)
+			ref[c*blocks + b] = checked[c] < sessions ? level[checked[c]] : 0.0f;
+	}
+	QueryPerformanceCounter(&t1);
+	double ms = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+
+	// the same sessions one at a time through the Fir blocks
+	Fir       *fir1 = (Fir *)pAudio->GetNode("fir1"), *fir2 = (Fir *)pAudio->GetNode("fir2");
+	pcm_frame *x = new pcm_frame[N], *y = new pcm_frame[N];
+	int        mismatches = 0;
+	double     msFir = 0.0;
+	for (int c = 0; c < nChecked && checked[c] < sessions; c++) {
+		fir1->reset();
+		fir2->reset();
+		QueryPerformanceCounter(&t0);
+		for (UINT32 b = 0; b < blocks; b++) {
+			INT32 d = 0;
+
+			if (b == blocks/2 && checked[c] % 4 == 0) {
+				fir1->reset();									// restarted from silence
+				fir2->reset();
+			}
+
+			for (UINT32 i = 0; i < N; i++)
+				x[i].left = x[i].right = pool[checked[c] % 16][(b % period)*N + i];
+			fir1->process(x, y, N);
+			for (UINT32 i = 0; i < N; i++)
+				d += abs(y[i].left);
+			fir2->process(x, y, N);
+			for (UINT32 i = 0; i < N; i++)
+				d -= abs(y[i].left);
+			if (2.0f*d/32768.0f != ref[c*blocks + b])
+				mismatches++;
+		}
+		QueryPerformanceCounter(&t1);
+		msFir = (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart;
+	}
+
+	printf("%d sessions, %u sample blocks, %s kernels: %u s of audio in %.1lf ms\n", sessions, N, simd().name, seconds, ms);
+	printf("%.0lf streams per core (%.0lf with one Fir pair per stream)\n", sessions*seconds*1000.0/ms, seconds*1000.0/max(msFir, 1e-3));
+	printf("%d mismatching detector outputs against Fir\n", mismatches);
+
+	for (int k = 0; k < 16; k++)
+		delete [] pool[k];
+	delete [] pool; delete [] in; delete [] level; delete [] ref; delete [] x; delete [] y;
+	delete bank;
+	return mismatches ? -__LINE__ : 0;
+}
+
+/* consumer of the shared memory transport: prints the level of the published output once a second,
+   until the producer has been silent for SUBSCRIBE_IDLE ms */
+#define SUBSCRIBE_IDLE	2000
+
+int subscribe(LPCWSTR szName) {
+	ShmReader reader;
+	HRESULT   hr;
+
+	if ((hr = reader.open(szName)) != S_OK) {
+		printf("Cannot attach to '%ls' (%s)\n", szName, hr == E_OUTOFMEMORY ? "all reader slots in use" : "no such producer");
+		return -__LINE__;
+	}
+	printf("Attached to '%ls' at frame %llu\n", szName, reader.position());
+
+	double energy = 0.0;
+	int    peak = 0;
+	UINT32 count = 0, idle = 0, overruns = 0;
+	while (idle < SUBSCRIBE_IDLE) {
+		const pcm_frame *p;
+		UINT32           n = reader.acquire(&p, 100);
+
+		if (n == 0) {
+			idle += 100;
+			continue;
+		}
+		idle = 0;
+
+		for (UINT32 i = 0; i < n; i++) {
+			energy += (double)p[i].left*p[i].left + (double)p[i].right*p[i].right;
+			peak    = max(peak, max(abs(p[i].left), abs(p[i].right)));
+		}
+		if (!reader.release(n)) {
+			energy = 0.0;									// overwritten while reading, drop the partial second
+			peak   = 0;
+			count  = 0;
+			continue;
+		}
+
+		if ((count += n) >= reader.rate()) {
+			printf("%8.1lf s  rms %6.1lf dBFS  peak %6.1lf dBFS  overruns %u\n", (double)reader.position()/reader.rate(),
+				   10.0*log10(energy/(2.0*count)/(32768.0*32768.0) + 1e-20), 20.0*log10(peak/32768.0 + 1e-10), reader.overruns() - overruns);
+			overruns = reader.overruns();
+			energy   = 0.0;
+			peak     = 0;
+			count    = 0;
+		}
+	}
+	printf("Producer stopped\n");
+
+	return 0;
+}
+
+/* plans the kernels of the blocks and the smallest device block which the processing sustains
+   within the latency target, the measurements are done only once per CPU */
+int planProcessing(MyAudio *pAudio, double latency, bool fReplan) {
+	Planner       planner;
+	LARGE_INTEGER t0, t1, freq;
+	char          key[32];
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+	if (fReplan || !planner.load(PLAN_FILE))
+		planner.clear();
+	pAudio->Plan(planner);
+
+	// the objects of the load measurements get the same kernels, module and coefficients
+	CaptureSetup setup;
+	pAudio->GetSetup(&setup);
+
+	// device block: load of the heaviest mode (with the echo canceller and the limiter) below PLAN_LOAD
+	static const int blocks[] = { 256, 384, 512, 640, 768, 896, 1024 };
+	UINT32 maxFrames = (UINT32)(latency*FS/1000.0);
+	sprintf_s(key, sizeof(key), "block.%u", maxFrames);
+	int block = planner.choose(key, blocks, sizeof(blocks)/sizeof(blocks[0]), [&](int i) {
+		UINT32 n = blocks[i];
+		if (n > maxFrames || n + setup.aecPartition >= setup.aecDelay)
+			return -1.0;
+
+		pcm_frame *in = new pcm_frame[n], *out = new pcm_frame[n];
+		double     load = 0.0;
+		for (UINT32 j = 0, s = 1; j < n; j++) {
+			s = s*1664525 + 1013904223;
+			in[j].left = in[j].right = (INT16)(s >> 17);
+		}
+		for (dsp_mode mode = passthru_mode; mode < stop_mode; mode = (dsp_mode)(mode+1)) {
+			MyAudio *p = new MyAudio;
+			p->Setup(setup);
+			p->SetMode(mode);
+			p->SetEchoCanceller(true);
+			p->SetLimiter(true);
+
+			// past the mode crossfade and the fade-in of the chain, they are not part of the steady load
+			for (UINT32 j = 0; j < XFADE || j < (setup.chainFade + 1)*n; j += n) {
+				DWORD captureFlags = 0, renderFlags;
+				p->ProcessData(n, (BYTE *)in, &captureFlags, (BYTE *)out, &renderFlags);
+			}
+			double ms = Planner::measure([&]() {
+				DWORD captureFlags = 0, renderFlags;
+				for (int k = 0; k < 16; k++)
+					p->ProcessData(n, (BYTE *)in, &captureFlags, (BYTE *)out, &renderFlags);
+			});
+			load = max(load, ms/16 / (n*1000.0/FS));
+			delete p;
+		}
+		delete [] in; delete [] out;
+
+		return load <= PLAN_LOAD ? (double)n : -1.0;
+	});
+	if (block < 0) {
+		printf("No block size within %.1lf ms keeps the processing load below %.0lf%%\n", latency, PLAN_LOAD*100.0);
+		block = 0;
+	}
+	pAudio->SetBlockSize(block);
+	QueryPerformanceCounter(&t1);
+
+	if (planner.changed() && !planner.save(PLAN_FILE))
+		printf("Cannot write the plan %ls\n", PLAN_FILE);
+	printf("Plan for %s (%s in %.0lf ms): FIR kernels %s/%s, echo canceller partition %u%s, block %d\n", planner.cpu(),
+		   planner.loaded() && !fReplan ? "loaded" : "measured", (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart,
+		   Fir::kernelName((fir_kernel)planner.lookup("fir160.kernel")), Fir::kernelName((fir_kernel)planner.lookup("fir96.kernel")),
+		   setup.aecPartition, setup.aecPartition == 0 ? " (NLMS)" : "", block);
+
+	return 0;
+}
+
+/* the coefficient file parsers and the cache against the compiled-in way, and the fast
+   convolution against the direct FIR on the same long filter; the files go to the temp directory */
+#define COEFS_TAPS	1000
+
+static bool sameCoefs(const FilterCoefs &a, const FilterCoefs &b) {
+	return a.length() == b.length() && a.symmetric() == b.symmetric() && a.partitions() == b.partitions()
+		&& memcmp(a.taps(), b.taps(), a.length()*sizeof(double)) == 0
+		&& memcmp(a.q15(), b.q15(), a.padded()*sizeof(INT16)) == 0
+		&& (!a.symmetric() || memcmp(a.folded(), b.folded(), a.foldedLength()*sizeof(INT16)) == 0)
+		&& memcmp(a.spectra(), b.spectra(), a.partitions()*(COEF_PART+1)*sizeof(cfloat)) == 0;
+}
+
+static void checkCoefs(Regression &regress) {
+	INT16   h[COEFS_TAPS];
+	wchar_t dir[MAX_PATH], cache[MAX_PATH], path[MAX_PATH];
+	FILE   *fp;
+
+	// windowed sinc low-pass at 4.4 kHz, symmetric
+	for (int i = 0; i < COEFS_TAPS; i++) {
+		double x = i - (COEFS_TAPS-1)/2.0;
+		h[i] = (INT16)floor(32768.0*0.2*(x == 0.0 ? 1.0 : sin(0.2*M_PI*x)/(0.2*M_PI*x))*(0.54 - 0.46*cos(2.0*M_PI*i/(COEFS_TAPS-1))) + 0.5);
+	}
+	FilterCoefs ref(h, COEFS_TAPS);
+
+	GetTempPathW(MAX_PATH, dir);
+	wcscat_s(dir, MAX_PATH, L"dspregress");
+	CreateDirectoryW(dir, NULL);
+	swprintf(cache, MAX_PATH, L"%ls\\cache", dir);
+
+	// the same filter in every format
+	struct { const wchar_t *file; const char *name; } formats[] = {
+		{ L"coefs.txt", "coefs_txt" }, { L"coefs.csv", "coefs_csv" }, { L"coefs.h", "coefs_h" },
+		{ L"coefs.coef", "coefs_coef" }, { L"coefs64.coef", "coefs_coef64" }
+	};
+	for (int f = 0; f < sizeof(formats)/sizeof(formats[0]); f++) {
+		swprintf(path, MAX_PATH, L"%ls\\%ls", dir, formats[f].file);
+		if (_wfopen_s(&fp, path, L"wb") != 0) {
+			regress.expect(formats[f].name, false);
+			continue;
+		}
+		if (f == 0) {
+			fprintf(fp, "%% Generated by the regression test\n%% Numerator:\n");
+			for (int i = 0; i < COEFS_TAPS; i++)
+				fprintf(fp, "%.17g\n", h[i]/32768.0);
+		} else if (f == 1) {
+			for (int i = 0; i < COEFS_TAPS; i++)
+				fprintf(fp, "%d%s", h[i], i % 10 == 9 ? "\r\n" : i % 2 ? "; " : ",");
+		} else if (f == 2) {
+			fprintf(fp, "#include \"tmwtypes.h\"\nconst int BL = %d;\nconst int16_T B[%d] = {\n", COEFS_TAPS, COEFS_TAPS);
+			for (int i = 0; i < COEFS_TAPS; i++)
+				fprintf(fp, "%6d,%s", h[i], i % 8 == 7 ? "\n" : "");
+			fprintf(fp, "\n};\n");
+		} else {
+			UINT32 hdr[4] = { COEF_MAGIC, 1, COEFS_TAPS, f == 3 ? 1u : 0u };
+
+			fwrite(hdr, sizeof(hdr), 1, fp);
+			for (int i = 0; i < COEFS_TAPS; i++) {
+				double v = h[i]/32768.0;
+
+				if (f == 3)
+					fwrite(&h[i], sizeof(INT16), 1, fp);
+				else
+					fwrite(&v, sizeof(double), 1, fp);
+			}
+		}
+		fclose(fp);
+
+		FilterCoefs coefs;
+		regress.expect(formats[f].name, coefs.load(path, NULL) == S_OK && sameCoefs(coefs, ref));
+	}
+
+	// parsed and stored, then from the cache
+	FilterCoefs stale, first, cached;
+	swprintf(path, MAX_PATH, L"%ls\\%ls", dir, formats[0].file);
+	stale.load(path, cache);
+	DeleteFileW(stale.cacheFile());								// of an earlier run
+	regress.expect("coefs_cache", first.load(path, cache) == S_OK && !first.cached() && cached.load(path, cache) == S_OK && cached.cached()
+				   && sameCoefs(cached, ref));
+	DeleteFileW(cached.cacheFile());
+	RemoveDirectoryW(cache);
+	for (int f = 0; f < sizeof(formats)/sizeof(formats[0]); f++) {
+		swprintf(path, MAX_PATH, L"%ls\\%ls", dir, formats[f].file);
+		DeleteFileW(path);
+	}
+	RemoveDirectoryW(dir);
+
+	// the fast convolution lags the direct FIR by one partition
+	Fir    fir(ref);
+	FftFir fft(ref);
+	regress.runPair("fftfir", &fir, &fft, COEF_PART, tolerance_compare);
+}
+
+/* the echo cancellers on a simulated echo path past the bulk delay, device blocks of ECHO_BLOCK
+   frames; every ECHO_SILENT:th render block is played as silence in the last check */
+#define ECHO_FRAMES	(10*FS)
+#define ECHO_BLOCK	441
+#define ECHO_SILENT	7
+#define ECHO_ERLE	20.0	// least echo attenuation over the last second (dB)
+
+static double echoReturnLoss(EchoCanceller *aec, bool fSilent) {
+	vector<pcm_frame> render(ECHO_FRAMES + ECHO_BLOCK), capture(ECHO_BLOCK), output(ECHO_BLOCK);
+	vector<float>     played(ECHO_FRAMES + ECHO_BLOCK);
+	UINT32            s = 1;
+	double            echo = 0.0, residual = 0.0;
+
+	for (UINT32 i = 0; i < render.size(); i++) {
+		s = s*1664525 + 1013904223;
+		render[i].left = render[i].right = (INT16)(s >> 18);
+	}
+	for (UINT32 j = 0, k = 0; j + ECHO_BLOCK <= ECHO_FRAMES; j += ECHO_BLOCK, k++) {
+		bool fMute = fSilent && k % ECHO_SILENT == ECHO_SILENT-1;
+
+		// the echo: two reflections of what the device has played
+		for (UINT32 i = 0; i < ECHO_BLOCK; i++) {
+			INT64 m = (INT64)(j + i) - AEC_DELAY;
+			float e = (m >= 40 ? 0.5f*played[m-40] : 0.0f) + (m >= 300 ? -0.25f*played[m-300] : 0.0f);
+
+			capture[i].left = capture[i].right = (INT16)e;
+		}
+		aec->process(capture.data(), output.data(), ECHO_BLOCK);
+		aec->reference(fMute ? NULL : &render[j], ECHO_BLOCK);
+		for (UINT32 i = 0; i < ECHO_BLOCK; i++)
+			played[j+i] = fMute ? 0.0f : (float)render[j+i].left;
+
+		if (j >= ECHO_FRAMES - FS)
+			for (UINT32 i = 0; i < ECHO_BLOCK; i++) {
+				echo     += (double)capture[i].left*capture[i].left;
+				residual += (double)output[i].left*output[i].left;
+			}
+	}
+
+	return 10.0*log10((echo + 1.0)/(residual + 1.0));
+}
+
+static void checkEcho(Regression &regress) {
+	struct { const char *name; UINT32 partition; bool fSilent; } checks[] = {
+		{ "aec_pbfdaf", 128, false },
+		{ "aec_nlms",   0,   false },
+		{ "aec_silent", 128, true }
+	};
+	for (int i = 0; i < sizeof(checks)/sizeof(checks[0]); i++) {
+		EchoCanceller *aec = MyAudio::MakeEcho(checks[i].partition);
+		double         erle = echoReturnLoss(aec, checks[i].fSilent);
+
+		printf("%-16s %.1lf dB echo attenuation\n", checks[i].name, erle);
+		regress.expect(checks[i].name, erle >= ECHO_ERLE);
+		delete aec;
+	}
+}
+
+/* runs every block and processing mode on a deterministic stimulus and compares (or records) the outputs */
+int regressionTest(LPCWSTR szDir, bool fRecord) {
+	Regression    regress(szDir, fRecord);
+	MyAudio      *pAudio = new MyAudio;
+	LARGE_INTEGER t0, t1, freq;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+
+	// single blocks, the fixed-point ones must be bit-exact
+	regress.run("fir",    pAudio->GetNode("fir"),    exact_compare);
+	regress.run("fir1",   pAudio->GetNode("fir1"),   exact_compare);
+	regress.run("fir2",   pAudio->GetNode("fir2"),   exact_compare);
+	regress.run("reverb", pAudio->GetNode("reverb"), exact_compare);
+	regress.run("fdn",    pAudio->GetNode("fdn"),    tolerance_compare);
+	regress.run("chorus", pAudio->GetNode("chorus"), tolerance_compare);
+	regress.run("denoise", pAudio->GetNode("denoise"), tolerance_compare);
+	regress.run("gate",   pAudio->GetNode("gate"),   tolerance_compare);
+	regress.run("eq",     pAudio->GetNode("eq"),     tolerance_compare);
+	regress.run("compressor", pAudio->GetNode("compressor"), tolerance_compare);
+	regress.run("limiter", pAudio->GetNode("limiter"), tolerance_compare);
+	regress.run("waveshaper", pAudio->GetNode("waveshaper"), tolerance_compare);
+	regress.run("bandmix", pAudio->GetNode("bandmix"), tolerance_compare);
+
+	// skipping a block while its input is silent must not change its output
+	regress.runGated("gate_fir",    pAudio->GetNode("fir"));
+	regress.runGated("gate_fir1",   pAudio->GetNode("fir1"));
+	delete pAudio;
+
+	// coefficient files and the fast convolution
+	checkCoefs(regress);
+
+	// echo cancellers, also with silent render blocks
+	checkEcho(regress);
+
+	// whole processing chains of each mode, every one on a fresh object
+	struct { const char *name; dsp_mode mode; double gain; bool fLimiter; compare_type cmp; } modes[] = {
+		{ "mode_passthru", passthru_mode, 0.0,  false, exact_compare },
+		{ "mode_filter",   filter_mode,   0.0,  false, exact_compare },
+		{ "mode_sinewave", sinewave_mode, 0.0,  false, tolerance_compare },
+		{ "mode_test",     test_mode,     0.0,  false, exact_compare },
+		{ "mode_reverb",   reverb_mode,   0.0,  false, tolerance_compare },
+		{ "mode_limiter",  passthru_mode, 12.0, true,  tolerance_compare },
+		{ "mode_chain",    chain_mode,    0.0,  false, exact_compare }
+	};
+	for (int i = 0; i < sizeof(modes)/sizeof(modes[0]); i++) {
+		pAudio = new MyAudio;
+		pAudio->SetMode(modes[i].mode);
+		pAudio->SetGain(modes[i].gain);
+		pAudio->SetLimiter(modes[i].fLimiter);
+		regress.run(modes[i].name, [pAudio](pcm_frame *in, pcm_frame *out, UINT32 n) {
+			DWORD captureFlags = 0, renderFlags;
+			pAudio->ProcessData(n, (BYTE *)in, &captureFlags, (BYTE *)out, &renderFlags);
+		}, modes[i].cmp);
+		delete pAudio;
+	}
+
+	// chain swapped in the middle of the noise, crossfaded over the following blocks
+	pAudio = new MyAudio;
+	pAudio->SetMode(chain_mode);
+	UINT32 pos = 0;
+	regress.run("mode_swap", [pAudio, &pos](pcm_frame *in, pcm_frame *out, UINT32 n) {
+		DWORD captureFlags = 0, renderFlags;
+		if (pos < 16384 && pos + n >= 16384)
+			pAudio->SwapChain(MyAudio::MakeChain(3), 3);
+		pAudio->ProcessData(n, (BYTE *)in, &captureFlags, (BYTE *)out, &renderFlags);
+		pos += n;
+	}, tolerance_compare);
+	delete pAudio;
+
+	// changes scheduled in advance take effect at their frame whatever the block sizes are
+	for (int pass = 0; pass < 2; pass++) {
+		pAudio = new MyAudio;
+		pAudio->SetMode(passthru_mode, 12000);
+		pAudio->SetGain(-6.0, 20000);
+		pAudio->SetMode(reverb_mode, 30001);
+		pAudio->SetLimiter(true, 30001);
+		pAudio->SetGain(6.0, 45000);
+		pAudio->SetMode(chain_mode, 57344);
+		UINT32 block = pass == 0 ? 0 : 37;			// the varying blocks of the check or 37 frame device blocks
+		regress.run("mode_events", [pAudio, block](pcm_frame *in, pcm_frame *out, UINT32 n) {
+			DWORD captureFlags = 0, renderFlags;
+			for (UINT32 i = 0, m; i < n; i += m) {
+				m = block != 0 ? min(block, n - i) : n;
+				pAudio->ProcessData(m, (BYTE *)&in[i], &captureFlags, (BYTE *)&out[i], &renderFlags);
+			}
+		}, exact_compare);
+		delete pAudio;
+	}
+
+	// changes during a crossfade wait for its end, the last one wins
+	pAudio = new MyAudio;
+	pAudio->SetMode(reverb_mode, 20000);
+	pAudio->SetMode(passthru_mode, 20500);
+	pAudio->SetMode(chain_mode, 20700);
+	regress.run("mode_rapid", [pAudio](pcm_frame *in, pcm_frame *out, UINT32 n) {
+		DWORD captureFlags = 0, renderFlags;
+		pAudio->ProcessData(n, (BYTE *)in, &captureFlags, (BYTE *)out, &renderFlags);
+	}, exact_compare);
+	delete pAudio;
+
+	QueryPerformanceCounter(&t1);
+	printf("%d failures, %.1lf ms\n", regress.failures(), (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart);
+
+	return regress.failures() ? -__LINE__ : 0;
+}
+
 /* for the internal test only: generates signal blocks to the system and observes the result */
 int internalTest(MyAudio *pAudio) {
 	UINT32  numFramesAvailable = 441;
@@ -78,10 +1064,30 @@ void usage(LPCWSTR exe) {
         L"  %ls -?\n"
         L"  %ls --sine\n"
         L"  %ls --impulse <filename>\n"
+		L"  %ls --analyze <block[,block...]> <filename[.csv]> [--stimulus impulse|sweep|mls]\n"
+		L"  %ls --profile <block[,block...]> [<wavefilename>] [--json <filename>]\n"
 		L"  %ls --file <wavefilename>\n"
 		L"  %ls --test\n"
+		L"  %ls --regress <directory> [--record] (the references are in regress)\n"
+		L"  %ls --features <wavefilename> <featurefilename>\n"
+		L"  %ls --loudness <wavefilename>\n"
+		L"  %ls --pitch [<wavefilename>]\n"
+		L"  %ls --replay <capturefilename> [--realtime]\n"
+		L"  %ls --waveshaper\n"
+		L"  %ls --plan [--latency <ms>]\n"
+		L"  %ls --subscribe <name>\n"
+		L"  %ls --sessions <count>\n"
+		L"  %ls --segment <block[,block...]> <wavefilename> <outfilename> [--segments <count>] [--decay <dB>]\n"
+		L"  any of the above with --simd sse2|avx2|avx512 to limit the instruction set\n"
+		L"  streaming with --latency <ms> to limit the device block size (default %d ms)\n"
+		L"  any of the above with --plugin <dllname> to load a processing module\n"
+		L"  streaming with --publish <name> to share the output with --subscribe processes\n"
+		L"  streaming with --coefs <filename> to run the filter of the file in the chain mode\n"
+		L"  streaming with --fade <blocks> to set the crossfade of the chain swaps (default %d)\n"
+		L"  streaming with --aec nlms|pbfdaf [--aecdelay <samples>] to choose the echo canceller (default pbfdaf, %d)\n"
+		L"  streaming with --capture <filename> to record the input blocks for --replay\n"
         L"\n",
-		exe, exe, exe, exe, exe
+		exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, PLAN_LATENCY, SWAP_FADE, AEC_DELAY
     );
 }
 
@@ -89,8 +1095,33 @@ void usage(LPCWSTR exe) {
 class CPrefs {
 public:
     LPCWSTR szImpulseFilename, szWaveFilename;
+	LPCWSTR szAnalyzeNodes, szAnalyzeFilename;
+	LPCWSTR szProfileNodes, szProfileWave, szJson;
+	LPCWSTR szRegressDir;
+	bool    fRecord;
+	LPCWSTR szFeatureWave, szFeatureFilename;
+	LPCWSTR szLoudnessWave;
+	bool    fPitch;
+	LPCWSTR szPitchWave;
+	LPCWSTR szCapture, szReplay;
+	bool    fRealtime;
+	stimulus_type stimulus;
+	simd_level simd;
 	int     Hz;
 	bool    fTest;
+	bool    fWaveshaper;
+	bool    fPlan;
+	LPCWSTR szPlugin;
+	LPCWSTR szPublish, szSubscribe;
+	LPCWSTR szCoefs;
+	int     fade;
+	aec_kind aec;
+	UINT32  aecDelay;
+	int     sessions;
+	int     segments;
+	LPCWSTR szSegmentNodes, szSegmentWave, szSegmentFilename;
+	double  decay;
+	double  latency;
 
     // set hr to S_FALSE to abort but return success
     CPrefs(int argc, LPCWSTR argv[], HRESULT &hr);
@@ -101,8 +1132,41 @@ public:
 CPrefs::CPrefs(int argc, LPCWSTR argv[], HRESULT &hr)
 : Hz(0)
 , fTest(false)
+, fWaveshaper(false)
+, fPlan(false)
+, szPlugin(NULL)
+, szPublish(NULL)
+, szSubscribe(NULL)
+, szCoefs(NULL)
+, fade(-1)
+, aec(pbfdaf_aec)
+, aecDelay(AEC_DELAY)
+, sessions(0)
+, segments(0)
+, szSegmentNodes(NULL)
+, szSegmentWave(NULL)
+, szSegmentFilename(NULL)
+, decay(SEG_DECAY)
+, latency(PLAN_LATENCY)
 , szImpulseFilename(NULL)
-, szWaveFilename(NULL) {
+, szWaveFilename(NULL)
+, szAnalyzeNodes(NULL)
+, szAnalyzeFilename(NULL)
+, szProfileNodes(NULL)
+, szProfileWave(NULL)
+, szJson(NULL)
+, stimulus(impulse_stimulus)
+, simd(simdSupported())
+, szRegressDir(NULL)
+, fRecord(false)
+, szFeatureWave(NULL)
+, szFeatureFilename(NULL)
+, szLoudnessWave(NULL)
+, fPitch(false)
+, szPitchWave(NULL)
+, szCapture(NULL)
+, szReplay(NULL)
+, fRealtime(false) {
     switch (argc) {
         case 2:
             if (0 == _wcsicmp(argv[1], L"-?") || 0 == _wcsicmp(argv[1], L"/?")) {
@@ -162,6 +1226,333 @@ CPrefs::CPrefs(int argc, LPCWSTR argv[], HRESULT &hr)
                     continue;
                 }
 
+                // --analyze
+                if (0 == _wcsicmp(argv[i], L"--analyze")) {
+                    if (NULL != szAnalyzeNodes) {
+                        printf("Only one --analyze switch is allowed\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    if (i+2 >= argc) {
+                        printf("--analyze switch requires two arguments\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szAnalyzeNodes    = argv[++i];
+                    szAnalyzeFilename = argv[++i];
+                    continue;
+                }
+
+                // --profile
+                if (0 == _wcsicmp(argv[i], L"--profile")) {
+                    if (NULL != szProfileNodes) {
+                        printf("Only one --profile switch is allowed\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    if (i+1 >= argc) {
+                        printf("--profile switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szProfileNodes = argv[++i];
+                    if (i+1 < argc && wcsncmp(argv[i+1], L"--", 2) != 0)
+                        szProfileWave = argv[++i];
+                    continue;
+                }
+
+                // --json
+                if (0 == _wcsicmp(argv[i], L"--json")) {
+                    if (i+1 >= argc) {
+                        printf("--json switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szJson = argv[++i];
+                    continue;
+                }
+
+                // --stimulus
+                if (0 == _wcsicmp(argv[i], L"--stimulus")) {
+                    if (i+1 >= argc) {
+                        printf("--stimulus switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    i++;
+                    if (0 == _wcsicmp(argv[i], L"impulse"))
+                        stimulus = impulse_stimulus;
+                    else if (0 == _wcsicmp(argv[i], L"sweep"))
+                        stimulus = sweep_stimulus;
+                    else if (0 == _wcsicmp(argv[i], L"mls"))
+                        stimulus = mls_stimulus;
+                    else {
+                        printf("Invalid stimulus '%ls'\n", argv[i]);
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+                    continue;
+                }
+
+                // --simd
+                if (0 == _wcsicmp(argv[i], L"--simd")) {
+                    if (i+1 >= argc) {
+                        printf("--simd switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    i++;
+                    if (0 == _wcsicmp(argv[i], L"sse2"))
+                        simd = sse2_level;
+                    else if (0 == _wcsicmp(argv[i], L"avx2"))
+                        simd = avx2_level;
+                    else if (0 == _wcsicmp(argv[i], L"avx512"))
+                        simd = avx512_level;
+                    else {
+                        printf("Invalid instruction set '%ls'\n", argv[i]);
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+                    continue;
+                }
+
+                // --regress
+                if (0 == _wcsicmp(argv[i], L"--regress")) {
+                    if (i+1 >= argc) {
+                        printf("--regress switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szRegressDir = argv[++i];
+                    continue;
+                }
+
+                // --features
+                if (0 == _wcsicmp(argv[i], L"--features")) {
+                    if (i+2 >= argc) {
+                        printf("--features switch requires two arguments\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szFeatureWave     = argv[++i];
+                    szFeatureFilename = argv[++i];
+                    continue;
+                }
+
+                // --loudness
+                if (0 == _wcsicmp(argv[i], L"--loudness")) {
+                    if (i+1 >= argc) {
+                        printf("--loudness switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szLoudnessWave = argv[++i];
+                    continue;
+                }
+
+                // --pitch
+                if (0 == _wcsicmp(argv[i], L"--pitch")) {
+                    fPitch = true;
+                    if (i+1 < argc && wcsncmp(argv[i+1], L"--", 2) != 0)
+                        szPitchWave = argv[++i];
+                    continue;
+                }
+
+                // --capture, --replay
+                if (0 == _wcsicmp(argv[i], L"--capture") || 0 == _wcsicmp(argv[i], L"--replay")) {
+                    if (i+1 >= argc) {
+                        printf("%ls switch requires an argument\n", argv[i]);
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    if (0 == _wcsicmp(argv[i], L"--capture"))
+                        szCapture = argv[++i];
+                    else
+                        szReplay = argv[++i];
+                    continue;
+                }
+
+                // --realtime
+                if (0 == _wcsicmp(argv[i], L"--realtime")) {
+                    fRealtime = true;
+                    continue;
+                }
+
+                // --plugin
+                if (0 == _wcsicmp(argv[i], L"--plugin")) {
+                    if (i+1 >= argc) {
+                        printf("--plugin switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szPlugin = argv[++i];
+                    continue;
+                }
+
+                // --publish, --subscribe
+                if (0 == _wcsicmp(argv[i], L"--publish") || 0 == _wcsicmp(argv[i], L"--subscribe")) {
+                    if (i+1 >= argc) {
+                        printf("%ls switch requires an argument\n", argv[i]);
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    if (0 == _wcsicmp(argv[i], L"--publish"))
+                        szPublish = argv[++i];
+                    else
+                        szSubscribe = argv[++i];
+                    continue;
+                }
+
+                // --coefs
+                if (0 == _wcsicmp(argv[i], L"--coefs")) {
+                    if (i+1 >= argc) {
+                        printf("--coefs switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szCoefs = argv[++i];
+                    continue;
+                }
+
+                // --fade
+                if (0 == _wcsicmp(argv[i], L"--fade")) {
+                    if (i+1 >= argc || _wtoi(argv[i+1]) < 0) {
+                        printf("--fade switch requires a number of blocks\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    fade = _wtoi(argv[++i]);
+                    continue;
+                }
+
+                // --aec
+                if (0 == _wcsicmp(argv[i], L"--aec")) {
+                    if (i+1 >= argc) {
+                        printf("--aec switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    i++;
+                    if (0 == _wcsicmp(argv[i], L"pbfdaf"))
+                        aec = pbfdaf_aec;
+                    else if (0 == _wcsicmp(argv[i], L"nlms"))
+                        aec = nlms_aec;
+                    else {
+                        printf("Invalid echo canceller '%ls'\n", argv[i]);
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+                    continue;
+                }
+
+                // --aecdelay
+                if (0 == _wcsicmp(argv[i], L"--aecdelay")) {
+                    if (i+1 >= argc || _wtoi(argv[i+1]) <= 0 || _wtoi(argv[i+1]) > FS) {
+                        printf("--aecdelay switch requires a number of samples up to %d\n", FS);
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    aecDelay = _wtoi(argv[++i]);
+                    continue;
+                }
+
+                // --segment
+                if (0 == _wcsicmp(argv[i], L"--segment")) {
+                    if (i+3 >= argc) {
+                        printf("--segment switch requires three arguments\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    szSegmentNodes    = argv[++i];
+                    szSegmentWave     = argv[++i];
+                    szSegmentFilename = argv[++i];
+                    continue;
+                }
+
+                // --segments
+                if (0 == _wcsicmp(argv[i], L"--segments")) {
+                    if (i+1 >= argc || _wtoi(argv[i+1]) <= 0) {
+                        printf("--segments switch requires a positive count\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    segments = _wtoi(argv[++i]);
+                    continue;
+                }
+
+                // --decay
+                if (0 == _wcsicmp(argv[i], L"--decay")) {
+                    if (i+1 >= argc || _wtof(argv[i+1]) <= 0.0) {
+                        printf("--decay switch requires a positive value\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    decay = _wtof(argv[++i]);
+                    continue;
+                }
+
+                // --sessions
+                if (0 == _wcsicmp(argv[i], L"--sessions")) {
+                    if (i+1 >= argc || _wtoi(argv[i+1]) <= 0) {
+                        printf("--sessions switch requires a positive count\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    sessions = _wtoi(argv[++i]);
+                    continue;
+                }
+
+                // --plan
+                if (0 == _wcsicmp(argv[i], L"--plan")) {
+                    fPlan = true;
+                    continue;
+                }
+
+                // --latency
+                if (0 == _wcsicmp(argv[i], L"--latency")) {
+                    if (i+1 >= argc) {
+                        printf("--latency switch requires an argument\n");
+                        hr = E_INVALIDARG;
+                        return;
+                    }
+
+                    latency = _wtof(argv[++i]);
+                    continue;
+                }
+
+                // --waveshaper
+                if (0 == _wcsicmp(argv[i], L"--waveshaper")) {
+                    fWaveshaper = true;
+                    continue;
+                }
+
+                // --record
+                if (0 == _wcsicmp(argv[i], L"--record")) {
+                    fRecord = true;
+                    continue;
+                }
+
                 // --file
                 if (0 == _wcsicmp(argv[i], L"--file")) {
                     if (NULL != szWaveFilename) {
@@ -201,8 +1592,19 @@ DWORD WINAPI UserInterfaceFunction(LPVOID pContext) {
 		"  'D' to direct output without any processing\n"
 		"  'S' to generate sinusoidal signal\n"
 		"  'T' to test special signal processing block\n"
+		"  'R' to reverberate with the feedback delay network\n"
+		"  'P' to process with the loaded module\n"
+		"  'C' to process with the swappable chain, 'N' to build and swap in its next variant\n"
+		"  'E' to toggle the echo canceller\n"
+		"  'L' to toggle the output limiter\n"
+		"  'M' to show the output loudness\n"
+		"  '+'/'-' to change the output gain\n"
 		);
 	wchar_t ch;
+	double  gain = 0.0;	// dB
+	bool    fAec = false, fLimiter = false;
+	int     variant = 0;
+	LoudnessReading loudness;
 	do {
 		ch = toupper(_getwch());
 
@@ -223,9 +1625,52 @@ DWORD WINAPI UserInterfaceFunction(LPVOID pContext) {
 			pArgs->audioSource->SetMode(test_mode);
 			break;
 
+		case L'R':
+			pArgs->audioSource->SetMode(reverb_mode);
+			break;
+
+		case L'P':
+			pArgs->audioSource->SetMode(plugin_mode);
+			break;
+
+		case L'C':
+			pArgs->audioSource->SetMode(chain_mode);
+			break;
+
+		case L'N':
+			if (pArgs->audioSource->BuildChain(variant+1) == S_OK)
+				variant++;
+			break;
+
 		case L'X':
 			pArgs->audioSource->SetMode(stop_mode);
 			break;
+
+		case L'E':
+			fAec = !fAec;
+			pArgs->audioSource->SetEchoCanceller(fAec);
+			break;
+
+		case L'L':
+			fLimiter = !fLimiter;
+			pArgs->audioSource->SetLimiter(fLimiter);
+			break;
+
+		case L'M':
+			if (pArgs->audioSource->GetLoudness(&loudness) == S_OK)
+				printf("M %.1f S %.1f I %.1f LUFS, LRA %.1f LU, TP %.1f dBTP\n",
+					   loudness.momentary, loudness.shortTerm, loudness.integrated, loudness.range, loudness.truePeak);
+			break;
+
+		case L'+':
+			if (gain < 12.0) gain += 1.0;
+			pArgs->audioSource->SetGain(gain);
+			break;
+
+		case L'-':
+			if (gain > -60.0) gain -= 1.0;
+			pArgs->audioSource->SetGain(gain);
+			break;
 		}
 	} while (ch != L'X');
 	printf("\n");
@@ -235,14 +1680,16 @@ DWORD WINAPI UserInterfaceFunction(LPVOID pContext) {
 
 int _cdecl wmain(int argc, LPCWSTR argv[]) {
 	AudioThreadArgs pta = { NULL, true, E_UNEXPECTED };
-	MyAudio         audioSource;
 	HRESULT         hr = S_OK;
 	int             result = 0;
 
 	printf("Audio front end for DSP objects (%s)\n\n", __DATE__);
 
-	// parse command line
-	CPrefs prefs(argc, argv, hr);
+	// parse command line, the vector kernels are selected before the blocks are made (they choose theirs then)
+	CPrefs  prefs(argc, argv, hr);
+	bool    fSimd = simdSelect(prefs.simd);
+	MyAudio audioSource;
+
 	if (E_INVALIDARG == hr || S_FALSE == hr) {
 		// nothing to do
 		goto wmerr;
@@ -253,6 +1700,46 @@ int _cdecl wmain(int argc, LPCWSTR argv[]) {
 		goto wmerr;
 	}
 
+	// vector kernels of the processing blocks
+	if (!fSimd) {
+		printf("%s is not supported by this CPU\n", simdKernels(prefs.simd).name);
+		result = -__LINE__;
+		goto wmerr;
+	}
+	printf("Using %s kernels\n", simd().name);
+
+	// processing module
+	if (prefs.szPlugin != NULL) {
+		if (audioSource.LoadPlugin(prefs.szPlugin) != S_OK) {
+			printf("Cannot load the processing module %ls\n", prefs.szPlugin);
+			result = -__LINE__;
+			goto wmerr;
+		}
+		PluginNode *plugin = (PluginNode *)audioSource.GetNode("plugin");
+		printf("Loaded module '%s' (latency %u, tail %u samples)\n", plugin->name(), plugin->latency(), plugin->tail());
+	}
+
+	// filter of the chain mode
+	if (prefs.szCoefs != NULL) {
+		size_t taps;
+		bool   fCached;
+
+		if (audioSource.LoadCoefficients(prefs.szCoefs, &taps, &fCached) != S_OK) {
+			printf("Cannot load the filter coefficients %ls\n", prefs.szCoefs);
+			result = -__LINE__;
+			goto wmerr;
+		}
+		printf("Loaded a %u tap filter (%s, layouts %s) to the chain mode\n", (UINT32)taps, taps >= COEF_FFTMIN ? "fast convolution" : "direct",
+			   fCached ? "from the cache" : "prepared");
+	}
+
+	// crossfade of the chain swaps
+	if (prefs.fade >= 0)
+		audioSource.SetChainFade(prefs.fade);
+
+	// echo canceller kind and bulk delay, its partition is planned later
+	audioSource.SetEchoPath(prefs.aec, prefs.aecDelay);
+
 	// special internal test
 	if (prefs.fTest) {
 		result = internalTest(&audioSource);
@@ -270,6 +1757,106 @@ int _cdecl wmain(int argc, LPCWSTR argv[]) {
 		goto wmerr;
 	}
 
+	// golden output regression checks
+	if (prefs.szRegressDir != NULL) {
+		result = regressionTest(prefs.szRegressDir, prefs.fRecord);
+		goto wmerr;
+	}
+
+	// feature extraction
+	if (prefs.szFeatureWave != NULL) {
+		result = extractFeatures(prefs.szFeatureWave, prefs.szFeatureFilename);
+		goto wmerr;
+	}
+
+	// loudness of a file
+	if (prefs.szLoudnessWave != NULL) {
+		result = measureLoudness(prefs.szLoudnessWave);
+		goto wmerr;
+	}
+
+	// pitch of a file or of the test tones
+	if (prefs.fPitch) {
+		result = trackPitch(prefs.szPitchWave);
+		goto wmerr;
+	}
+
+	// replay of a captured session
+	if (prefs.szReplay != NULL) {
+		result = replaySession(prefs.szReplay, prefs.fRealtime);
+		goto wmerr;
+	}
+
+	// level monitor of a published output
+	if (prefs.szSubscribe != NULL) {
+		result = subscribe(prefs.szSubscribe);
+		goto wmerr;
+	}
+
+	// offline processing in parallel segments
+	if (prefs.szSegmentNodes != NULL) {
+		result = processSegmented(prefs.szSegmentNodes, prefs.szSegmentWave, prefs.szSegmentFilename, prefs.segments, prefs.decay);
+		goto wmerr;
+	}
+
+	// multi-session detector throughput
+	if (prefs.sessions > 0) {
+		result = benchSessions(&audioSource, prefs.sessions);
+		goto wmerr;
+	}
+
+	// waveshaper cost per oversampling factor
+	if (prefs.fWaveshaper) {
+		result = benchWaveshaper();
+		goto wmerr;
+	}
+
+	// frequency response analysis
+	if (prefs.szAnalyzeNodes != NULL) {
+		if (testFrequencyResponce(&audioSource, prefs.szAnalyzeNodes, prefs.szAnalyzeFilename, prefs.stimulus) < 0) {
+			printf("testFrequencyResponce failed\n");
+			result = -__LINE__;
+		}
+		else
+			result = 0;
+		goto wmerr;
+	}
+
+	// thread cycles, time and hardware counters per block
+	if (prefs.szProfileNodes != NULL) {
+		result = profileNodes(&audioSource, prefs.szProfileNodes, prefs.szProfileWave, prefs.szJson);
+		goto wmerr;
+	}
+
+	// measured processing plan
+	if (prefs.fPlan) {
+		result = planProcessing(&audioSource, prefs.latency, true);
+		goto wmerr;
+	}
+	planProcessing(&audioSource, prefs.latency, false);
+	audioSource.EnableMeter(true);
+
+	// output to the consumer processes
+	if (prefs.szPublish != NULL) {
+		if ((hr = audioSource.Publish(prefs.szPublish)) != S_OK) {
+			printf("Cannot create the shared memory transport '%ls'%s\n", prefs.szPublish,
+				   hr == HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS) ? " (published by another process)" : "");
+			result = -__LINE__;
+			goto wmerr;
+		}
+		printf("Publishing the output as '%ls'\n", prefs.szPublish);
+	}
+
+	// input blocks to a file for a replay
+	if (prefs.szCapture != NULL) {
+		if (audioSource.Capture(prefs.szCapture) != S_OK) {
+			printf("Cannot create %ls\n", prefs.szCapture);
+			result = -__LINE__;
+			goto wmerr;
+		}
+		printf("Capturing the input blocks to %ls\n", prefs.szCapture);
+	}
+
 	// wav file
 	if (prefs.szWaveFilename != NULL) {
 		if (audioSource.SetWavFileName(prefs.szWaveFilename) != S_OK)
@@ -338,8 +1925,13 @@ int _cdecl wmain(int argc, LPCWSTR argv[]) {
 	int    frames;
 	if (audioSource.GetPerformance(&cycle, &process_time, &frames) == S_OK) {
 		printf("Cycle time %.2lf ms, processing time %.2lf ms (load %.1lf%%)\n", cycle, process_time, cycle > 0 ? process_time/cycle*100 : 0.0);
-		printf("%d frames per one buffer\n", frames);
+		printf("%d frames per one buffer, processing latency %u samples\n", frames, audioSource.GetLatency());
 	}
+	if (prefs.szCapture != NULL && audioSource.GetCaptureLost() != 0)
+		printf("%u captured records were lost, the disk did not keep up\n", audioSource.GetCaptureLost());
+	LoudnessReading loudness;
+	if (audioSource.GetLoudness(&loudness) == S_OK)
+		printf("Output loudness %.1f LUFS integrated, range %.1f LU, true peak %.1f dBTP\n", loudness.integrated, loudness.range, loudness.truePeak);
 	if (audioSource.error() != 0)
 		printf("There was an error on the dsp object at line %d\n", audioSource.error());
 
@@ -0,0 +1,383 @@
+/*
+ * node.h -- Common interface of the signal processing blocks
+ *
+ * Every block processes a stereo pcm_frame stream, so blocks and whole chains
+ * of blocks can be driven (and measured) through the same interface. Every block reports
+ * the delay it adds, so that parallel branches can be lined up sample-exactly, and how long
+ * its output goes on after the input has become silent, so that an idle block can be skipped.
+ */
+
+#pragma once
+#include <windows.h>
+#include <math.h>
+#include <vector>
+#include "wavIO.h"
+#include "simd.h"
+
+using namespace std;
+
+#define PREROLL_NONE	0xFFFFFFFF	// the state of the block cannot be rebuilt from its input
+#define TAIL_INFINITE	0xFFFFFFFF	// the block may produce output from silence (e.g. an oscillator)
+
+
+class DspNode {
+public:
+	virtual ~DspNode() {}
+
+	/* process the given number of frames (input and output buffers must not overlap, unless inPlace()) */
+	virtual void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) = 0;
+
+	/* clear the internal state (delay lines etc.) */
+	virtual void reset() = 0;
+
+	virtual const char *name() const = 0;
+
+	/* delay the block adds to the signal (in samples), e.g. a lookahead or a frame buffer */
+	virtual UINT32 latency() const { return 0; }
+
+	/* input samples which rebuild the state of a cleared block: all the samples a finite memory
+	   depends on (exactly the same output after them), for a feedback block as many as the
+	   effect of the older state needs to decay by decayDb */
+	virtual UINT32 preroll(double decayDb) const { return PREROLL_NONE; }
+
+	/* samples after which the output of a silent input is silent and the state has decayed
+	   below 1 LSB, so the block need not be run (from a cleared state) until the input returns */
+	virtual UINT32 tail() const { return TAIL_INFINITE; }
+
+	/* largest amplitude (in LSB) that the rounding in the feedback loops of the block can sustain
+	   at its output without input, or add to the difference of two runs from different states,
+	   0 for a block without feedback */
+	virtual double limitCycle() const { return 0.0; }
+
+	/* the block may be run with the output in the input buffer (it reads every input frame before it writes that output frame) */
+	virtual bool inPlace() const { return false; }
+};
+
+
+/* runs a node unless its input has been silent for longer than its tail, the output is then
+   silence and the node is cleared once of the remains of its state */
+class SilenceGate {
+public:
+	SilenceGate(): silent_(0), fQuiet_(false) {
+	}
+
+	/* returns false if the node was skipped */
+	bool process(DspNode *node, const pcm_frame *input, pcm_frame *output, UINT32 samples) {
+		if (!simd().isSilent(input, samples))
+			silent_ = 0;
+		else if (silent_ >= node->tail() && fQuiet_) {
+			if (silent_ != IDLE) {
+				node->reset();
+				silent_ = IDLE;
+			}
+			memset(output, 0, samples*sizeof(pcm_frame));
+			return false;
+		} else
+			silent_ = min(silent_ + samples, IDLE-1);
+
+		node->process(input, output, samples);
+
+		// the rounding limit cycles of a feedback loop may go on after the tail (not in the reverb,
+		// whose loops round toward zero), so the node is skipped (and cleared) only after a block
+		// where its output has died out too
+		fQuiet_ = silent_ != 0 && simd().isSilent(output, samples);
+		return true;
+	}
+
+	/* the node is idle (skipped) */
+	bool idle() const { return silent_ == IDLE; }
+
+	void reset() {
+		silent_ = 0;
+		fQuiet_ = false;
+	}
+
+private:
+	static const UINT32 IDLE = 0xFFFFFFFF;
+
+	UINT32 silent_;								// silent input samples, IDLE once the node has been cleared
+	bool   fQuiet_;								// the last output block of the node was silent
+};
+
+
+/* serial connection of nodes, the output of each node feeds the next one */
+class Chain: public DspNode {
+public:
+	/* fOwner: the nodes are deleted together with the chain */
+	Chain(const char *name = "chain", UINT32 maxFrames = 4096, bool fOwner = false): name_(name), maxFrames_(maxFrames), fOwner_(fOwner) {
+		buf_[0] = new pcm_frame[maxFrames];
+		buf_[1] = new pcm_frame[maxFrames];
+	}
+
+	~Chain() {
+		if (fOwner_)
+			for (size_t k = 0; k < nodes_.size(); k++)
+				delete nodes_[k];
+		delete [] buf_[0];
+		delete [] buf_[1];
+	}
+
+	/* the node is not taken over if the allocation fails */
+	void add(DspNode *node) {
+		gates_.reserve(gates_.size() + 1);
+		nodes_.push_back(node);
+		gates_.push_back(SilenceGate());
+	}
+
+	size_t   size() const { return nodes_.size(); }
+	DspNode *node(size_t i) { return nodes_[i]; }
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		if (nodes_.empty()) {
+			if (output != input)
+				memcpy(output, input, samples*sizeof(pcm_frame));
+			return;
+		}
+
+		// the nodes are not required to work in place, so use ping-pong buffers between them
+		// (the chain itself may be run in place, the last node then writes to a buffer too unless it can work in place)
+		for (UINT32 j = 0; j < samples; j += maxFrames_) {
+			UINT32           n  = min(samples - j, maxFrames_);
+			const pcm_frame *in = &input[j];
+
+			for (size_t k = 0; k < nodes_.size(); k++) {
+				bool       fLast = k == nodes_.size()-1 && (in != &output[j] || nodes_[k]->inPlace());
+				pcm_frame *out   = fLast ? &output[j] : buf_[k & 1];
+
+				gates_[k].process(nodes_[k], in, out, n);		// the silence propagates along the chain
+				in = out;
+			}
+			if (in != &output[j])
+				memcpy(&output[j], in, n*sizeof(pcm_frame));
+		}
+	}
+
+	void reset() {
+		for (size_t k = 0; k < nodes_.size(); k++) {
+			nodes_[k]->reset();
+			gates_[k].reset();
+		}
+	}
+
+	const char *name() const { return name_; }
+
+	/* the tails of the nodes add up */
+	UINT32 tail() const {
+		UINT64 d = 0;
+
+		for (size_t k = 0; k < nodes_.size(); k++)
+			d += nodes_[k]->tail();
+		return (UINT32)min(d, (UINT64)TAIL_INFINITE);
+	}
+
+	UINT32 latency() const {
+		UINT32 d = 0;
+
+		for (size_t k = 0; k < nodes_.size(); k++)
+			d += nodes_[k]->latency();
+		return d;
+	}
+
+	/* the buffers between the nodes are the chain's own */
+	bool inPlace() const { return true; }
+
+	/* the memories of the nodes add up */
+	UINT32 preroll(double decayDb) const {
+		UINT32 d = 0;
+
+		for (size_t k = 0; k < nodes_.size(); k++) {
+			UINT32 p = nodes_[k]->preroll(decayDb);
+			if (p == PREROLL_NONE)
+				return PREROLL_NONE;
+			d += p;
+		}
+		return d;
+	}
+
+	/* the limit cycles of the nodes add up (the later nodes taken at unity gain) */
+	double limitCycle() const {
+		double a = 0.0;
+
+		for (size_t k = 0; k < nodes_.size(); k++)
+			a += nodes_[k]->limitCycle();
+		return a;
+	}
+
+private:
+	const char        *name_;
+	UINT32             maxFrames_;
+	bool               fOwner_;
+	vector<DspNode *>  nodes_;
+	vector<SilenceGate> gates_;
+	pcm_frame         *buf_[2];
+};
+
+
+/* parallel connection of nodes fed by the same input, the outputs are mixed with their gains;
+   the branches with less latency than the slowest one read their input delayed by the
+   difference from one delay line shared by all of them */
+class Parallel: public DspNode {
+public:
+	/* fOwner: the nodes are deleted together with the node */
+	Parallel(const char *name = "parallel", UINT32 maxFrames = 4096, bool fOwner = false):
+	  name_(name), maxFrames_(maxFrames), fOwner_(fOwner), ring_(NULL), size_(0), wr_(0), latency_(0) {
+		in_   = new pcm_frame[maxFrames];
+		out_  = new pcm_frame[maxFrames];
+		accL_ = new float[maxFrames];
+		accR_ = new float[maxFrames];
+	}
+
+	~Parallel() {
+		if (fOwner_)
+			for (size_t k = 0; k < branches_.size(); k++)
+				delete branches_[k].node;
+		delete [] ring_;
+		delete [] in_;
+		delete [] out_;
+		delete [] accL_;
+		delete [] accR_;
+	}
+
+	/* not while processing, the delays are recomputed */
+	void add(DspNode *node, float gain = 1.0f) {
+		Branch b = { node, gain, 0 };
+
+		branches_.push_back(b);
+		compensate();
+	}
+
+	/* sets the compensating delays from the latencies the branches report now (e.g. after a
+	   branch has been reconfigured), not while processing */
+	void compensate() {
+		latency_ = 0;
+		for (size_t k = 0; k < branches_.size(); k++)
+			latency_ = max(latency_, branches_[k].node->latency());
+		for (size_t k = 0; k < branches_.size(); k++)
+			branches_[k].delay = latency_ - branches_[k].node->latency();
+
+		// room for the longest delay and a whole block
+		UINT32 size = 1;
+		while (size < latency_ + maxFrames_)
+			size <<= 1;
+		if (latency_ > 0 && size != size_) {
+			delete [] ring_;
+			ring_ = new pcm_frame[size];
+			size_ = size;
+			memset(ring_, 0, size_*sizeof(pcm_frame));
+			wr_   = 0;
+		}
+	}
+
+	size_t   size() const { return branches_.size(); }
+	DspNode *node(size_t i) { return branches_[i].node; }
+	UINT32   delay(size_t i) const { return branches_[i].delay; }
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		for (UINT32 j = 0; j < samples; j += maxFrames_) {
+			UINT32 n = min(samples - j, maxFrames_);
+
+			if (latency_ > 0)
+				store(&input[j], n);
+			memset(accL_, 0, n*sizeof(float));
+			memset(accR_, 0, n*sizeof(float));
+
+			for (size_t k = 0; k < branches_.size(); k++) {
+				const Branch    &b = branches_[k];
+				const pcm_frame *x = &input[j];
+
+				if (b.delay > 0) {
+					load(in_, n, wr_ - b.delay);
+					x = in_;
+				}
+				b.node->process(x, out_, n);
+				for (UINT32 i = 0; i < n; i++) {
+					accL_[i] += b.gain*out_[i].left;
+					accR_[i] += b.gain*out_[i].right;
+				}
+			}
+			simd().f32ToPcm(accL_, accR_, &output[j], n);
+			wr_ += n;
+		}
+	}
+
+	void reset() {
+		for (size_t k = 0; k < branches_.size(); k++)
+			branches_[k].node->reset();
+		if (ring_ != NULL)
+			memset(ring_, 0, size_*sizeof(pcm_frame));
+		wr_ = 0;
+	}
+
+	const char *name() const { return name_; }
+
+	/* latency of the slowest branch, the others are delayed to it */
+	UINT32 latency() const { return latency_; }
+
+	/* the longest tail of a branch and its compensating delay */
+	UINT32 tail() const {
+		UINT64 d = 0;
+
+		for (size_t k = 0; k < branches_.size(); k++)
+			d = max(d, (UINT64)branches_[k].node->tail() + branches_[k].delay);
+		return (UINT32)min(d, (UINT64)TAIL_INFINITE);
+	}
+
+	/* the longest memory of a branch and its compensating delay */
+	UINT32 preroll(double decayDb) const {
+		UINT32 d = 0;
+
+		for (size_t k = 0; k < branches_.size(); k++) {
+			UINT32 p = branches_[k].node->preroll(decayDb);
+			if (p == PREROLL_NONE)
+				return PREROLL_NONE;
+			d = max(d, p + branches_[k].delay);
+		}
+		return d;
+	}
+
+	/* the limit cycles of the branches at their gains add up */
+	double limitCycle() const {
+		double a = 0.0;
+
+		for (size_t k = 0; k < branches_.size(); k++)
+			a += fabs(branches_[k].gain)*branches_[k].node->limitCycle();
+		return a;
+	}
+
+private:
+	struct Branch {
+		DspNode *node;
+		float    gain;
+		UINT32   delay;						// compensating delay of the input (in samples)
+	};
+
+	/* appends n input frames to the delay line */
+	void store(const pcm_frame *frames, UINT32 n) {
+		for (UINT32 i = 0, m; i < n; i += m) {
+			UINT32 k = (wr_ + i) & (size_-1);
+
+			m = min(n - i, size_ - k);				// up to the end of the delay line
+			memcpy(&ring_[k], &frames[i], m*sizeof(pcm_frame));
+		}
+	}
+
+	/* n frames of the delay line from stream time pos on */
+	void load(pcm_frame *frames, UINT32 n, UINT32 pos) {
+		for (UINT32 i = 0, m; i < n; i += m) {
+			UINT32 k = (pos + i) & (size_-1);
+
+			m = min(n - i, size_ - k);
+			memcpy(&frames[i], &ring_[k], m*sizeof(pcm_frame));
+		}
+	}
+
+	const char       *name_;
+	UINT32            maxFrames_;
+	bool              fOwner_;
+	vector<Branch>    branches_;
+	pcm_frame        *ring_;					// input history shared by the delayed branches
+	UINT32            size_, wr_;				// length of the delay line (power of two), frames written
+	UINT32            latency_;
+	pcm_frame        *in_, *out_;				// delayed input and output of a branch
+	float            *accL_, *accR_;			// mix of the branch outputs
+};
@@ -0,0 +1,129 @@
+/*
+ * params.h -- Lock-free parameter passing from the user interface thread to the audio thread
+ *
+ * Parameter changes are posted to a single-producer/single-consumer queue and drained once
+ * per block by the audio thread, so the processing loops never see a half written value.
+ * Continuous parameters are smoothed over a ramp to avoid zipper noise.
+ */
+
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <math.h>
+#include <emmintrin.h>
+#include "simd.h"
+
+using namespace std;
+
+
+/* single-producer/single-consumer message queue (N must be a power of two) */
+template <class T, unsigned N> class SpscQueue {
+public:
+	SpscQueue(): head_(0), tail_(0) {
+	}
+
+	/* producer side: returns false if the queue is full */
+	bool push(const T &msg) {
+		unsigned h = head_.load(memory_order_relaxed);
+
+		if (h - tail_.load(memory_order_acquire) == N)
+			return false;
+		buf_[h & (N-1)] = msg;
+		head_.store(h+1, memory_order_release);
+
+		return true;
+	}
+
+	/* number of queued elements, a snapshot while the other side runs */
+	unsigned size() const {
+		return head_.load(memory_order_acquire) - tail_.load(memory_order_acquire);
+	}
+
+	/* consumer side: returns false if the queue is empty */
+	bool pop(T &msg) {
+		unsigned t = tail_.load(memory_order_relaxed);
+
+		if (t == head_.load(memory_order_acquire))
+			return false;
+		msg = buf_[t & (N-1)];
+		tail_.store(t+1, memory_order_release);
+
+		return true;
+	}
+
+private:
+	T                 buf_[N];
+	atomic<unsigned>  head_, tail_;
+};
+
+
+/* parameter value which glides to its new target value over a given number of samples */
+class SmoothedParam {
+public:
+	SmoothedParam(float value, UINT32 rampLength, bool fExponential = false):
+	  current_(value), target_(value), start_(value), step_(0.0f), pos_(0), left_(0), len_(rampLength), fExp_(fExponential) {
+	}
+
+	/* set a new target value, the glide starts at the next ramp() call */
+	void set(float value) {
+		target_ = value;
+		start_  = current_;
+		pos_    = 0;
+		left_   = len_;
+		if (fExp_ && current_ > 0.0f && target_ > 0.0f)
+			step_ = powf(target_/current_, 1.0f/len_);		// multiplicative step
+		else
+			step_ = (target_ - current_) / len_;			// additive step
+	}
+
+	bool  isSmoothing() const { return left_ != 0; }
+	float value() const { return current_; }
+
+	/* fill v[0..n-1] with the per-sample parameter values of this block; the values depend only on
+	   the position in the ramp, not on how the stream is cut to blocks */
+	void ramp(float *v, UINT32 n) {
+		UINT32 i = 0;
+
+		if (left_ != 0) {
+			UINT32 m = n < left_ ? n : left_;
+
+			if (fExp_ && current_ > 0.0f && target_ > 0.0f) {
+				// start*step^(pos+1+i), 4 lanes at a time with the lane step step^4; the first
+				// value of each block comes from powf, so the rounding does not accumulate over blocks
+				float  s2 = step_*step_, b = start_*powf(step_, (float)(pos_+1));
+				__m128 x  = _mm_mul_ps(_mm_set1_ps(b), _mm_setr_ps(1.0f, step_, s2, s2*step_)), s4 = _mm_set1_ps(s2*s2);
+
+				for (; i+4 <= m; i += 4) {
+					_mm_storeu_ps(&v[i], x);
+					x = _mm_mul_ps(x, s4);
+				}
+				for (float y = _mm_cvtss_f32(x); i < m; i++, y *= step_)
+					v[i] = y;
+				pos_    += m;
+				current_ = v[m-1];
+			} else {
+				simd().rampFill(v, start_, step_, pos_+1, m);
+				i = m;
+				pos_    += m;
+				current_ = start_ + step_*(float)pos_;
+			}
+
+			left_ -= m;
+			if (left_ == 0)
+				current_ = target_;							// remove accumulated rounding errors
+		}
+
+		// rest of the block is flat
+		__m128 x = _mm_set1_ps(current_);
+		for (; i+4 <= n; i += 4)
+			_mm_storeu_ps(&v[i], x);
+		for (; i < n; i++)
+			v[i] = current_;
+	}
+
+private:
+	float  current_, target_, start_, step_;
+	UINT32 pos_;									// samples of the ramp so far
+	UINT32 left_, len_;
+	bool   fExp_;
+};
@@ -0,0 +1,275 @@
+/*
+ * pitch.h -- Streaming fundamental frequency tracker (YIN)
+ *
+ * Passes the signal through unchanged and estimates, every hop, the fundamental frequency of
+ * both channels and its confidence with the YIN method: the squared difference function of
+ * the frame, normalized by its cumulative mean, and the first dip below a threshold.
+ *
+ * The difference function d(t) = E(0) + E(t) - 2 r(t) needs the autocorrelation r(t) of the
+ * integration window against the whole frame for every lag. It is computed by fast
+ * correlation of hop sized blocks (as the partitioned convolution of FftFir does): only the
+ * newest block is transformed every hop, the older block spectra are kept, and the block pair
+ * products are summed per lag offset before the inverse transforms. The two channels are
+ * transformed together, the left one as the real and the right one as the imaginary part, so
+ * both trackers run on the same transforms.
+ *
+ * The window energies E(t) move along with the frame: every hop they shift by the hop, and
+ * only the last hop of lags is new, started from the energies of the hop blocks.
+ *
+ * The pitch frames are posted to a lock-free ring for a consumer thread.
+ */
+
+#pragma once
+#include <windows.h>
+#include <math.h>
+#include "wavIO.h"
+#include "cirbuffer.h"
+#include "node.h"
+#include "fft.h"
+#include "params.h"
+
+using namespace std;
+
+#define PITCH_HOP		512		// hop size and block length of the correlation (in samples)
+#define PITCH_WINDOW	1024	// integration window (in samples, multiple of the hop)
+#define PITCH_LAGS		1024	// lags searched (multiple of the hop), the lowest f0 is FS/PITCH_LAGS
+#define PITCH_FMAX		4000.0	// highest f0 searched (Hz)
+#define PITCH_THRESHOLD	0.1f	// YIN threshold of the normalized difference
+
+
+struct PitchFrame {
+	UINT32 index;				// frame number, the analysed window ends at sample index*hop + PITCH_WINDOW
+	float  f0[2];				// fundamental frequency of both channels (Hz), 0 for silence
+	float  confidence[2];		// 1 - normalized difference at the period, 0..1
+};
+
+
+class PitchTracker: public DspNode {
+public:
+	PitchTracker(): H(PITCH_HOP), W(PITCH_WINDOW), T(PITCH_LAGS), N(PITCH_WINDOW + PITCH_LAGS),
+	  P(PITCH_WINDOW/PITCH_HOP), Q((PITCH_WINDOW + PITCH_LAGS)/PITCH_HOP), K(PITCH_HOP+1), fft_(2*PITCH_HOP), dropped_(0) {
+		for (int ch = 0; ch < 2; ch++) {
+			x_[ch]    = new float[N];
+			r_[ch]    = new float[T];
+			e_[ch]    = new double[T];
+			eb_[ch]   = new double[Q];
+			spec_[ch] = new cfloat[Q*K];
+			S_[ch]    = new cfloat[K];
+		}
+		z_   = new cfloat[2*H];
+		dn_  = new float[T];
+		tmin_ = max(2u, (UINT32)(FS/PITCH_FMAX));
+		reset();
+	}
+
+	~PitchTracker() {
+		for (int ch = 0; ch < 2; ch++) {
+			delete [] x_[ch]; delete [] r_[ch]; delete [] e_[ch]; delete [] eb_[ch]; delete [] spec_[ch]; delete [] S_[ch];
+		}
+		delete [] z_; delete [] dn_;
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		if (output != input)
+			memcpy(output, input, samples*sizeof(pcm_frame));
+
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			// up to the end of the current hop
+			n = min(samples - i, H - pos_);
+
+			float *l = &x_[0][N-H+pos_], *r = &x_[1][N-H+pos_];
+			for (UINT32 j = 0; j < n; j++) {
+				l[j] = input[i+j].left/32768.0f;
+				r[j] = input[i+j].right/32768.0f;
+			}
+
+			if ((pos_ += n) == H) {
+				analyze();
+				for (int ch = 0; ch < 2; ch++)
+					memmove(x_[ch], &x_[ch][H], (N-H)*sizeof(float));
+				pos_ = 0;
+			}
+		}
+	}
+
+	void reset() {
+		for (int ch = 0; ch < 2; ch++) {
+			memset(x_[ch], 0, N*sizeof(float));
+			memset(e_[ch], 0, T*sizeof(double));
+			memset(eb_[ch], 0, Q*sizeof(double));
+			memset(spec_[ch], 0, Q*K*sizeof(cfloat));
+		}
+		memset(&last_, 0, sizeof(last_));
+		pos_   = 0;
+		head_  = 0;
+		index_ = 0;
+	}
+
+	const char *name() const { return "pitch"; }
+
+	/* the latest estimate of the given channel (0 left, 1 right) */
+	float f0(int ch) const { return last_.f0[ch]; }
+	float confidence(int ch) const { return last_.confidence[ch]; }
+
+	/* consumer side of the pitch frame ring, returns false if there is no new frame */
+	bool pop(PitchFrame &f) {
+		return ring_.pop(f);
+	}
+
+	/* frames lost because the ring was full */
+	UINT32 dropped() const { return dropped_; }
+
+private:
+	/* spectrum of the newest block (both channels in one transform), the correlations and the estimates */
+	void analyze() {
+		PitchFrame f;
+
+		head_ = (head_ + 1) % Q;
+		for (UINT32 n = 0; n < H; n++) {
+			z_[n].re = x_[0][N-H+n];
+			z_[n].im = x_[1][N-H+n];
+		}
+		memset(&z_[H], 0, H*sizeof(cfloat));
+		fft_.forward(z_);
+
+		// L[k] = (Z[k] + conj(Z[-k]))/2, R[k] = (Z[k] - conj(Z[-k]))/2i
+		cfloat *L = &spec_[0][head_*K], *R = &spec_[1][head_*K];
+		for (UINT32 k = 0; k < K; k++) {
+			cfloat a = z_[k], b = z_[(2*H - k) & (2*H-1)];
+
+			L[k].re = 0.5f*(a.re + b.re); L[k].im = 0.5f*(a.im - b.im);
+			R[k].re = 0.5f*(a.im + b.im); R[k].im = 0.5f*(b.re - a.re);
+		}
+
+		correlate();
+
+		f.index = index_++;
+		for (int ch = 0; ch < 2; ch++) {
+			energies(ch);
+			estimate(ch, &f.f0[ch], &f.confidence[ch]);
+		}
+		last_ = f;
+		if (!ring_.push(f))
+			dropped_++;
+	}
+
+	/* r[t] = sum of x[j]*x[j+t] over the window for t = 0..T-1, from the products of the block spectra
+	   of window block p and frame block p+d, one inverse transform per lag offset d*H */
+	void correlate() {
+		for (int ch = 0; ch < 2; ch++)
+			memset(r_[ch], 0, T*sizeof(float));
+
+		for (UINT32 d = 0; d <= T/H; d++) {
+			for (int ch = 0; ch < 2; ch++) {
+				memset(S_[ch], 0, K*sizeof(cfloat));
+				for (UINT32 p = 0; p < P && p+d < Q; p++)
+					cmac(block(ch, p), block(ch, p+d), S_[ch], K, true);
+			}
+
+			// both real correlations in one inverse transform: Y = SL + i SR, hermitian halves mirrored
+			for (UINT32 k = 0; k < K; k++) {
+				const cfloat &a = S_[0][k], &b = S_[1][k];
+
+				z_[k].re = a.re - b.im;
+				z_[k].im = a.im + b.re;
+				if (k > 0 && k < H) {
+					z_[2*H-k].re = a.re + b.im;
+					z_[2*H-k].im = b.re - a.im;
+				}
+			}
+			fft_.inverse(z_);
+
+			// lags t = d*H + m with |m| < H, negative m at the end of the transform
+			for (int m = -(int)H+1; m < (int)H; m++) {
+				int t = (int)(d*H) + m;
+
+				if (t >= 0 && t < (int)T) {
+					r_[0][t] += z_[m & (2*H-1)].re;
+					r_[1][t] += z_[m & (2*H-1)].im;
+				}
+			}
+		}
+	}
+
+	/* E(t) = sum of x[j]^2 over the window starting at t: the older lags are those of the previous
+	   frame shifted by the hop, the last hop of lags starts from the energies of the P blocks
+	   before the newest one and slides one sample at a time */
+	void energies(int ch) {
+		const float *x = x_[ch];
+		double      *e = e_[ch], *eb = eb_[ch], s = 0.0;
+
+		for (UINT32 j = N-H; j < N; j++)
+			s += (double)x[j]*x[j];
+		eb[head_] = s;
+
+		s = 0.0;
+		for (UINT32 b = Q-1-P; b < Q-1; b++)
+			s += eb[(head_ + 1 + b) % Q];
+
+		memmove(e, &e[H], (T-H)*sizeof(double));
+		for (UINT32 t = T-H; t < T; t++) {
+			e[t] = s;
+			s   += (double)x[t+W]*x[t+W] - (double)x[t]*x[t];
+		}
+	}
+
+	/* spectrum of block b of the frame (0 the oldest) */
+	const cfloat *block(int ch, UINT32 b) const {
+		return &spec_[ch][((head_ + 1 + b) % Q)*K];
+	}
+
+	/* YIN: the first dip of the cumulative mean normalized difference under the threshold
+	   (the smallest value if there is none), refined by a parabola through its neighbours */
+	void estimate(int ch, float *f0, float *confidence) {
+		const float  *r = r_[ch];
+		const double *e = e_[ch];
+
+		double e0 = e[0], sum = 0.0;
+		if (e0 < 1e-10*W) {
+			*f0 = *confidence = 0.0f;
+			return;
+		}
+
+		dn_[0] = 1.0f;
+		for (UINT32 t = 1; t < T; t++) {
+			double d = max(e0 + e[t] - 2.0*r[t], 0.0);
+
+			sum   += d;
+			dn_[t] = sum > 0.0 ? (float)(d*t/sum) : 1.0f;
+		}
+
+		UINT32 t = tmin_, best = tmin_;
+		for (; t < T-1; t++) {
+			if (dn_[t] < PITCH_THRESHOLD) {
+				while (t+1 < T-1 && dn_[t+1] < dn_[t])
+					t++;
+				break;
+			}
+			if (dn_[t] < dn_[best])
+				best = t;
+		}
+		if (t >= T-1)
+			t = best;
+
+		float a = dn_[t-1], b = dn_[t], c = dn_[t+1], den = a - 2.0f*b + c;
+		float shift = den > 0.0f ? 0.5f*(a - c)/den : 0.0f;
+
+		*f0         = (float)(FS/(t + shift));
+		*confidence = max(0.0f, min(1.0f, 1.0f - b));
+	}
+
+	UINT32  H, W, T, N;				// hop, window, lags and frame length
+	UINT32  P, Q, K;				// blocks of the window and of the frame, bins of a block spectrum
+	Fft     fft_;
+	float  *x_[2];					// frame of both channels, the newest hop at the end
+	cfloat *spec_[2];				// spectra of the frame blocks (newest at head_)
+	cfloat *S_[2], *z_;				// summed block products, transform buffer
+	float  *r_[2];					// correlation of the window and the frame
+	double *e_[2];					// energy of the window at each lag
+	double *eb_[2];					// energies of the frame blocks (newest at head_)
+	float  *dn_;					// normalized difference
+	UINT32  tmin_;
+	PitchFrame last_;
+	SpscQueue<PitchFrame, 256> ring_;
+	UINT32  pos_, head_, index_, dropped_;
+};
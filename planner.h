@@ -0,0 +1,159 @@
+/*
+ * planner.h -- Measured selection of kernel variants and block sizes
+ *
+ * Times the alternative implementations of a processing step on the running machine and
+ * remembers the fastest one. The choices are kept as "key value" lines in a plan file
+ * together with the CPU model they were measured on; a plan of another CPU is ignored, so
+ * the measurements are repeated once after a hardware change and loaded on later starts.
+ */
+
+#pragma once
+#include <windows.h>
+#include <intrin.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <map>
+
+using namespace std;
+
+#define PLAN_FILE		L"dspframework.plan"	// default plan file (in the working directory)
+#define PLAN_REPEATS	5						// timing runs per candidate, the best one counts
+#define PLAN_LATENCY	20						// default latency target of the device block (in ms)
+#define PLAN_LOAD		0.5						// largest processing time per block period
+
+
+class Planner {
+public:
+	Planner(): fChanged_(false), fLoaded_(false) {
+		int r[4];
+		char brand[49] = { 0 };
+
+		// processor brand string of the extended cpuid leaves, trailing and leading blanks removed
+		__cpuid(r, 0x80000000);
+		if ((unsigned)r[0] >= 0x80000004) {
+			for (int i = 0; i < 3; i++) {
+				__cpuid(r, 0x80000002 + i);
+				memcpy(&brand[16*i], r, 16);
+			}
+		}
+		cpu_ = brand;
+		cpu_.erase(0, cpu_.find_first_not_of(' '));
+		cpu_.erase(cpu_.find_last_not_of(' ') + 1);
+		if (cpu_.empty())
+			cpu_ = "unknown";
+	}
+
+	/* reads the plan, returns false if there is none for this CPU */
+	bool load(LPCWSTR filename) {
+		FILE *fp;
+		char  line[256], key[128];
+		int   value;
+
+		if (_wfopen_s(&fp, filename, L"r") != 0)
+			return false;
+
+		// first line is the CPU model
+		if (fgets(line, sizeof(line), fp) == NULL || strncmp(line, "cpu ", 4) != 0 || cpu_ != trim(&line[4])) {
+			fclose(fp);
+			return false;
+		}
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (sscanf_s(line, "%127s %d", key, (unsigned)sizeof(key), &value) == 2)
+				plan_[key] = value;
+		fclose(fp);
+
+		fLoaded_  = true;
+		fChanged_ = false;
+		return true;
+	}
+
+	/* writes the plan */
+	bool save(LPCWSTR filename) {
+		FILE *fp;
+
+		if (_wfopen_s(&fp, filename, L"w") != 0)
+			return false;
+		fprintf(fp, "cpu %s\n", cpu_.c_str());
+		for (map<string, int>::const_iterator i = plan_.begin(); i != plan_.end(); i++)
+			fprintf(fp, "%s %d\n", i->first.c_str(), i->second);
+		fChanged_ = false;
+
+		return fclose(fp) == 0;
+	}
+
+	/* forget all choices, the next choose() calls measure again */
+	void clear() {
+		plan_.clear();
+		fChanged_ = true;
+	}
+
+	/* planned value of the key, or def if there is none */
+	int lookup(const char *key, int def = -1) const {
+		map<string, int>::const_iterator i = plan_.find(key);
+
+		return i != plan_.end() ? i->second : def;
+	}
+
+	void set(const char *key, int value) {
+		plan_[key] = value;
+		fChanged_  = true;
+	}
+
+	/* planned value of the key; if there is none, the candidates values[0..n-1] are timed with cost(i)
+	   (in any unit, lower is better, negative if the candidate is not applicable) and the cheapest
+	   one is planned, -1 if none is applicable */
+	template <class F> int choose(const char *key, const int *values, int n, F cost) {
+		int value = lookup(key);
+
+		for (int i = 0; i < n; i++)
+			if (values[i] == value)
+				return value;
+
+		int    best = -1;
+		double c, cheapest = 0.0;
+		for (int i = 0; i < n; i++)
+			if ((c = cost(i)) >= 0.0 && (best < 0 || c < cheapest)) {
+				best     = i;
+				cheapest = c;
+			}
+		if (best < 0)
+			return -1;
+		set(key, values[best]);
+
+		return values[best];
+	}
+
+	/* best time of PLAN_REPEATS runs of f (in ms) */
+	template <class F> static double measure(F f) {
+		LARGE_INTEGER t0, t1, freq;
+		double best = 1e30;
+
+		QueryPerformanceFrequency(&freq);
+		f();													// warm up the caches
+		for (int i = 0; i < PLAN_REPEATS; i++) {
+			QueryPerformanceCounter(&t0);
+			f();
+			QueryPerformanceCounter(&t1);
+			best = min(best, (t1.QuadPart - t0.QuadPart)*1000.0/freq.QuadPart);
+		}
+
+		return best;
+	}
+
+	const char *cpu() const { return cpu_.c_str(); }
+	bool loaded() const { return fLoaded_; }
+	bool changed() const { return fChanged_; }
+
+private:
+	static string trim(const char *s) {
+		string t(s);
+
+		t.erase(t.find_last_not_of(" \r\n") + 1);
+		return t;
+	}
+
+	string           cpu_;
+	map<string, int> plan_;
+	bool             fChanged_, fLoaded_;
+};
@@ -0,0 +1,135 @@
+/*
+ * plugin.h -- Host side of the DSP module ABI (see dspplugin.h)
+ *
+ * PluginNode loads a module DLL and runs it as an ordinary processing node. The module
+ * state and the planar float buffers are allocated at load time; a block is converted
+ * from the 16-bit frames once, processed in place by the module and converted back.
+ */
+
+#pragma once
+#include <windows.h>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "cirbuffer.h"
+#include "node.h"
+#include "dspplugin.h"
+
+using namespace std;
+
+#define PLUGIN_BLOCK	1024	// largest block given to a module in one call (in frames)
+
+
+class PluginNode: public DspNode {
+public:
+	PluginNode(): hLib_(NULL), desc_(NULL), state_(NULL) {
+		ch_[0] = ch_[1] = NULL;
+	}
+
+	~PluginNode() {
+		unload();
+	}
+
+	/* load the module and initialize its state, the node passes the signal through until then */
+	HRESULT load(LPCWSTR filename) {
+		unload();
+
+		if ((hLib_ = LoadLibraryW(filename)) == NULL)
+			return E_FAIL;
+		dsp_plugin_entry entry = (dsp_plugin_entry)GetProcAddress(hLib_, DSP_PLUGIN_ENTRY);
+		const dsp_plugin *desc = entry != NULL ? entry(DSP_PLUGIN_ABI) : NULL;
+
+		// same major version, and at least the fields of the first version present
+		if (desc == NULL || (desc->abi_version >> 16) != (DSP_PLUGIN_ABI >> 16) || desc->struct_size < sizeof(dsp_plugin) ||
+			desc->process == NULL || desc->init == NULL || desc->reset == NULL || (desc->channels != 1 && desc->channels != 2)) {
+			unload();
+			return E_NOINTERFACE;
+		}
+
+		state_ = _aligned_malloc(max(desc->state_size, (size_t)1), DSP_PLUGIN_ALIGN);
+		memset(state_, 0, max(desc->state_size, (size_t)1));
+		for (int c = 0; c < 2; c++) {
+			ch_[c] = (float *)_aligned_malloc((PLUGIN_BLOCK + DSP_PLUGIN_PAD)*sizeof(float), DSP_PLUGIN_ALIGN);
+			memset(ch_[c], 0, (PLUGIN_BLOCK + DSP_PLUGIN_PAD)*sizeof(float));
+		}
+		if (desc->init(state_, FS, PLUGIN_BLOCK) != 0) {
+			unload();
+			return E_FAIL;
+		}
+		desc_ = desc;
+
+		return S_OK;
+	}
+
+	void unload() {
+		if (desc_ != NULL && desc_->release != NULL)
+			desc_->release(state_);
+		desc_ = NULL;
+		if (hLib_ != NULL) {
+			FreeLibrary(hLib_);
+			hLib_ = NULL;
+		}
+		for (int c = 0; c < 2; c++) {
+			_aligned_free(ch_[c]);
+			ch_[c] = NULL;
+		}
+		_aligned_free(state_);
+		state_ = NULL;
+	}
+
+	bool loaded() const { return desc_ != NULL; }
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		if (desc_ == NULL) {
+			if (input != output)
+				memcpy(output, input, samples*sizeof(pcm_frame));
+			return;
+		}
+
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			n = min(samples - i, (UINT32)PLUGIN_BLOCK);
+
+			simd().pcmToF32(&input[i], ch_[0], ch_[1], n);
+			scale(n, 1.0f/32768.0f);
+			if (desc_->channels == 1) {
+				// mono modules get the mean of the channels and their output goes to both
+				for (UINT32 j = 0; j < n; j += 4)
+					_mm_store_ps(&ch_[0][j], _mm_mul_ps(_mm_add_ps(_mm_load_ps(&ch_[0][j]), _mm_load_ps(&ch_[1][j])), _mm_set1_ps(0.5f)));
+				desc_->process(state_, ch_, n);
+				scale(n, 32768.0f);
+				simd().f32ToPcm(ch_[0], ch_[0], &output[i], n);
+			} else {
+				desc_->process(state_, ch_, n);
+				scale(n, 32768.0f);
+				simd().f32ToPcm(ch_[0], ch_[1], &output[i], n);
+			}
+		}
+	}
+
+	void reset() {
+		if (desc_ != NULL)
+			desc_->reset(state_);
+	}
+
+	UINT32 latency() const { return desc_ != NULL ? desc_->latency : 0; }
+
+	/* output length after the input has become silent (in samples) */
+	UINT32 tail() const { return desc_ != NULL ? desc_->tail : 0; }
+
+	const char *name() const { return desc_ != NULL && desc_->name != NULL ? desc_->name : "plugin"; }
+
+private:
+	/* both channel buffers multiplied in place, whole vectors */
+	void scale(UINT32 n, float g) {
+		const __m128 s = _mm_set1_ps(g);
+
+		for (int c = 0; c < 2; c++)
+			for (UINT32 j = 0; j < n; j += 4)
+				_mm_store_ps(&ch_[c][j], _mm_mul_ps(_mm_load_ps(&ch_[c][j]), s));
+	}
+
+	HMODULE           hLib_;
+	const dsp_plugin *desc_;
+	void             *state_;
+	float            *ch_[2];		// planar channel buffers given to the module
+};
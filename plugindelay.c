@@ -0,0 +1,53 @@
+/*
+ * plugindelay.c -- Example DSP module (see dspplugin.h)
+ *
+ * Delays both channels by a fixed number of samples. The delay lines are in the state the
+ * host allocates, so the module itself allocates nothing and needs no release(). Built as
+ * plugindelay.dll, run with --plugin plugindelay.dll and checked by dspapitest.
+ */
+
+#include <string.h>
+#include "dspplugin.h"
+
+#define DELAY	32		/* samples, a power of two */
+
+typedef struct {
+	float    ring[2][DELAY];
+	uint32_t pos;
+} delay_state;
+
+
+static int init(void *state, double fs, uint32_t max_frames) {
+	(void)state; (void)fs; (void)max_frames;		/* the state comes zeroed */
+	return 0;
+}
+
+static void reset(void *state) {
+	memset(state, 0, sizeof(delay_state));
+}
+
+static void process(void *state, float *const *channel, uint32_t frames) {
+	delay_state *s = (delay_state *)state;
+	uint32_t     c, i, pos;
+
+	for (c = 0; c < 2; c++) {
+		float *x = channel[c];
+
+		for (i = 0, pos = s->pos; i < frames; i++, pos = (pos + 1) & (DELAY-1)) {
+			float y = s->ring[c][pos];
+
+			s->ring[c][pos] = x[i];
+			x[i] = y;
+		}
+	}
+	s->pos = (s->pos + frames) & (DELAY-1);
+}
+
+static const dsp_plugin plugin = {
+	DSP_PLUGIN_ABI, sizeof(dsp_plugin), "delay", 2, DELAY, DELAY, sizeof(delay_state),
+	init, reset, process, NULL
+};
+
+DSP_PLUGIN_EXPORT const dsp_plugin *dspPluginEntry(uint32_t host_abi) {
+	return (host_abi >> 16) == (DSP_PLUGIN_ABI >> 16) ? &plugin : NULL;
+}
@@ -0,0 +1,510 @@
+/*
+ * profile.h -- Cycles, time and hardware counters per processing block
+ *
+ * Every node of a chain is wrapped in a ProfiledNode which reads the cycle counter of the
+ * calling thread and the performance counter before and after the node runs and charges the
+ * difference, less the cost of the reading itself, to the node and to the current block. The
+ * totals come out as a table, and the totals together with the per block counts as JSON.
+ *
+ * With administrator rights the instructions, cache misses, last level cache misses and branch
+ * mispredictions are counted too. The PMU counters are read by the kernel ETW session, which
+ * attaches them to the system call events (TracePmcCounterListInfo, TracePmcEventListInfo).
+ * The cycle counter reading of start() and stop() is a system call, so the counters of a node
+ * are the difference between its two events. The thread is kept on one processor while the
+ * counters run, because they count for the processor, not for the thread: a node which is
+ * preempted is also charged with what the other thread did meanwhile. Without the rights, or
+ * if another tool has the kernel session, only the cycles and the time are reported.
+ */
+
+#pragma once
+#include <windows.h>
+#include <evntrace.h>
+#include <evntcons.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+#include <map>
+#include "wavIO.h"
+#include "node.h"
+
+#pragma comment(lib, "Advapi32.lib")
+
+using namespace std;
+
+#define PROF_BLOCK		441			// frames per block of the offline profiling (10 ms)
+#define PROF_SAMPLES	(1 << 20)	// largest number of per block node samples kept for the JSON output
+#define PROF_PMCS		4			// hardware counters: instructions, cache, last level cache and branch misses
+#define PROF_SYSCALL	51			// system call entry event of the kernel PerfInfo class
+
+// kernel event session and the class of its system call events
+static const GUID profKernelGuid   = { 0x9e814aad, 0x3204, 0x11d2, { 0x9a, 0x82, 0x00, 0x60, 0x08, 0xa8, 0x69, 0x39 } };
+static const GUID profPerfInfoGuid = { 0xce1dbfb4, 0x137e, 0x4da6, { 0x87, 0xb0, 0x3f, 0x59, 0xaa, 0x10, 0x2c, 0xbc } };
+
+// profile sources of the counters, in the order of the report
+static const wchar_t *profSources[PROF_PMCS] = { L"InstructionRetired", L"CacheMisses", L"LLCMisses", L"BranchMispredictions" };
+
+
+/* counts of one node in one block */
+struct ProfileSample {
+	UINT32 block;
+	UINT32 node;
+	UINT64 cycles;						// cycles of the thread
+	UINT64 ticks;						// performance counter ticks
+	UINT64 pmc[PROF_PMCS];				// hardware counters (profSources), if counted
+};
+
+
+/* PMU counter values at every system call of one thread, by the kernel ETW session */
+class PmcSession {
+public:
+	struct Event {
+		UINT64 address;					// system service called
+		UINT32 cpu;
+		UINT64 pmc[PROF_PMCS];
+	};
+
+	PmcSession(): session_(0), trace_(INVALID_PROCESSTRACE_HANDLE), hThread_(NULL), thread_(0), nPmcs_(0) {
+		memset(&props_, 0, sizeof(props_));
+		for (int k = 0; k < PROF_PMCS; k++)
+			index_[k] = -1;
+	}
+
+	~PmcSession() {
+		stop();
+	}
+
+	/* starts counting the system calls of the calling thread, NULL or the reason why not */
+	const char *start() {
+		ULONG                   sources[PROF_PMCS], len = 0;
+		vector<BYTE>            list(64*1024);
+		EVENT_TRACE_PROPERTIES *p = &props_.p;
+		CLASSIC_EVENT_ID        id;
+		ULONG                   err;
+
+		// the counters this processor has
+		if (TraceQueryInformation(0, TraceProfileSourceListInfo, list.data(), (ULONG)list.size(), &len) != ERROR_SUCCESS)
+			return "no hardware counters (Windows 10 or later and administrator rights needed)";
+		for (ULONG off = 0; ; ) {
+			PROFILE_SOURCE_INFO *s = (PROFILE_SOURCE_INFO *)&list[off];
+
+			for (int k = 0; k < PROF_PMCS; k++)
+				if (_wcsicmp(s->Description, profSources[k]) == 0 && index_[k] < 0) {
+					index_[k]        = nPmcs_;
+					sources[nPmcs_++] = s->Source;
+				}
+			if (s->NextEntryOffset == 0)
+				break;
+			off += s->NextEntryOffset;
+		}
+		if (nPmcs_ == 0)
+			return "none of the counters is available on this processor";
+
+		// real time kernel session with the system call events
+		p->Wnode.BufferSize    = sizeof(Properties);
+		p->Wnode.Guid          = profKernelGuid;
+		p->Wnode.ClientContext = 1;								// performance counter timestamps
+		p->Wnode.Flags         = WNODE_FLAG_TRACED_GUID;
+		p->LogFileMode         = EVENT_TRACE_REAL_TIME_MODE;
+		p->EnableFlags         = EVENT_TRACE_FLAG_SYSTEMCALL;
+		p->BufferSize          = 256;							// KB
+		p->MinimumBuffers      = 64;
+		p->MaximumBuffers      = 256;
+		p->FlushTimer          = 1;
+		p->LoggerNameOffset    = offsetof(Properties, name);
+		if ((err = StartTraceW(&session_, KERNEL_LOGGER_NAMEW, p)) != ERROR_SUCCESS) {
+			session_ = 0;
+			return err == ERROR_ACCESS_DENIED ? "no administrator rights" :
+				   err == ERROR_ALREADY_EXISTS ? "the kernel event session is in use by another tool" : "cannot start the kernel event session";
+		}
+
+		memset(&id, 0, sizeof(id));
+		id.EventGuid = profPerfInfoGuid;
+		id.Type      = PROF_SYSCALL;
+		if (TraceSetInformation(session_, TracePmcCounterListInfo, sources, nPmcs_*sizeof(ULONG)) != ERROR_SUCCESS ||
+			TraceSetInformation(session_, TracePmcEventListInfo, &id, sizeof(id)) != ERROR_SUCCESS) {
+			stop();
+			return "the counters cannot be attached to the system call events";
+		}
+
+		// consumer of the events
+		EVENT_TRACE_LOGFILEW log;
+		memset(&log, 0, sizeof(log));
+		log.LoggerName          = (LPWSTR)KERNEL_LOGGER_NAMEW;
+		log.ProcessTraceMode    = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+		log.EventRecordCallback = callback;
+		log.Context             = this;
+		thread_ = GetCurrentThreadId();
+		events_.clear();
+		events_.reserve(1 << 20);
+		if ((trace_ = OpenTraceW(&log)) == INVALID_PROCESSTRACE_HANDLE ||
+			(hThread_ = CreateThread(NULL, 0, consumer, this, 0, NULL)) == NULL) {
+			stop();
+			return "cannot open the kernel event session";
+		}
+
+		return NULL;
+	}
+
+	/* stops the session after the events so far have been delivered */
+	void stop() {
+		if (session_ != 0) {
+			ControlTraceW(session_, NULL, &props_.p, EVENT_TRACE_CONTROL_STOP);
+			session_ = 0;
+		}
+		if (hThread_ != NULL) {
+			WaitForSingleObject(hThread_, INFINITE);
+			CloseHandle(hThread_);
+			hThread_ = NULL;
+		}
+		if (trace_ != INVALID_PROCESSTRACE_HANDLE) {
+			CloseTrace(trace_);
+			trace_ = INVALID_PROCESSTRACE_HANDLE;
+		}
+	}
+
+	/* column of the counter k (profSources) in Event::pmc, -1 if it is not counted */
+	int index(int k) const { return index_[k]; }
+
+	/* system calls of the thread, after stop() */
+	const vector<Event> &events() const { return events_; }
+
+private:
+	struct Properties {
+		EVENT_TRACE_PROPERTIES p;
+		WCHAR                  name[sizeof(KERNEL_LOGGER_NAMEW)/sizeof(WCHAR)];
+	};
+
+	static DWORD WINAPI consumer(LPVOID pContext) {
+		PmcSession *p = (PmcSession *)pContext;
+
+		ProcessTrace(&p->trace_, 1, NULL, NULL);				// until the session stops
+		return 0;
+	}
+
+	static VOID WINAPI callback(PEVENT_RECORD rec) {
+		PmcSession *p = (PmcSession *)rec->UserContext;
+		Event       e;
+
+		if (rec->EventHeader.ThreadId != p->thread_ || rec->EventHeader.EventDescriptor.Opcode != PROF_SYSCALL ||
+			!IsEqualGUID(rec->EventHeader.ProviderId, profPerfInfoGuid) || rec->UserDataLength < sizeof(UINT32))
+			return;
+
+		// the payload is the address of the service, a pointer of the kernel
+		memset(&e, 0, sizeof(e));
+		if ((rec->EventHeader.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) != 0 && rec->UserDataLength >= sizeof(UINT64))
+			e.address = *(const UINT64 *)rec->UserData;
+		else
+			e.address = *(const UINT32 *)rec->UserData;
+		e.cpu     = rec->BufferContext.ProcessorIndex;
+		for (USHORT i = 0; i < rec->ExtendedDataCount; i++) {
+			const EVENT_HEADER_EXTENDED_DATA_ITEM &x = rec->ExtendedData[i];
+
+			if (x.ExtType == EVENT_HEADER_EXT_TYPE_PMC_COUNTERS) {
+				const UINT64 *c = (const UINT64 *)(ULONG_PTR)x.DataPtr;
+
+				for (UINT32 k = 0; k < p->nPmcs_ && k < x.DataSize/sizeof(UINT64); k++)
+					e.pmc[k] = c[k];
+				p->events_.push_back(e);
+			}
+		}
+	}
+
+	TRACEHANDLE   session_, trace_;
+	HANDLE        hThread_;
+	DWORD         thread_;
+	UINT32        nPmcs_;
+	int           index_[PROF_PMCS];
+	vector<Event> events_;
+	Properties    props_;
+};
+
+
+class NodeProfiler {
+public:
+	NodeProfiler(): first_(0), block_(0), fPmc_(false), fCounting_(false), affinity_(0) {
+		UINT64        a, b;
+		LARGE_INTEGER t0, t1;
+
+		QueryPerformanceFrequency(&freq_);
+
+		// cost of a reading pair, the smallest of a few
+		overhead_      = ~0ULL;
+		overheadTicks_ = ~0ULL;
+		for (int i = 0; i < 16; i++) {
+			QueryPerformanceCounter(&t0);
+			a = cycles();
+			b = cycles();
+			QueryPerformanceCounter(&t1);
+			overhead_      = min(overhead_, b - a);
+			overheadTicks_ = min(overheadTicks_, (UINT64)(t1.QuadPart - t0.QuadPart));
+		}
+		samples_.reserve(PROF_SAMPLES);
+	}
+
+	~NodeProfiler() {
+		stopCounters();
+	}
+
+	/* index of a new node in the report */
+	UINT32 add(const char *name) {
+		Totals t;
+
+		memset(&t, 0, sizeof(t));
+		t.name = name;
+		totals_.push_back(t);
+		return (UINT32)(totals_.size() - 1);
+	}
+
+	/* starts the hardware counters for the calling thread before the first node, NULL or the
+	   reason why they are not counted */
+	const char *startCounters() {
+		affinity_ = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << GetCurrentProcessorNumber());
+
+		const char *why = pmc_.start();
+		if (why != NULL) {
+			restoreAffinity();
+			return why;
+		}
+		fCounting_ = true;
+		first_     = samples_.size();
+		calls_.clear();
+		calls_.reserve(PROF_SAMPLES);
+
+		return NULL;
+	}
+
+	/* stops the counters after the last node and charges them to the nodes, NULL or the reason
+	   why they could not be */
+	const char *stopCounters() {
+		if (!fCounting_)
+			return NULL;
+		fCounting_ = false;
+		pmc_.stop();
+		restoreAffinity();
+
+		// the readings of start() and stop() are the calls of the most common service
+		const vector<PmcSession::Event> &ev = pmc_.events();
+		map<UINT64, size_t>              count;
+		UINT64                           marker = 0;
+		size_t                           most = 0, n = 0;
+
+		for (size_t i = 0; i < ev.size(); i++)
+			if (++count[ev[i].address] > most) {
+				most   = count[ev[i].address];
+				marker = ev[i].address;
+			}
+		vector<const PmcSession::Event *> marks;
+		for (size_t i = 0; i < ev.size(); i++)
+			if (ev[i].address == marker)
+				marks.push_back(&ev[i]);
+		if (marks.size() != 2*calls_.size())
+			return "the system call events do not match the calls (events lost), the counters are not reported";
+
+		for (size_t i = 0; i < calls_.size(); i++) {
+			const PmcSession::Event *a = marks[2*i], *b = marks[2*i+1];
+			Totals &t = totals_[calls_[i].node];
+
+			if (a->cpu != b->cpu)
+				continue;
+			t.pmcCycles += calls_[i].cycles;
+			for (int k = 0; k < PROF_PMCS; k++) {
+				int    j = pmc_.index(k);
+				UINT64 d = j >= 0 ? b->pmc[j] - a->pmc[j] : 0;
+
+				t.pmc[k] += d;
+				if (first_ + i < samples_.size())
+					samples_[first_ + i].pmc[k] = d;
+			}
+			t.counted++;
+			n++;
+		}
+		fPmc_ = n > 0;
+
+		return NULL;
+	}
+
+	/* the counters at the start of a node */
+	void start() {
+		QueryPerformanceCounter(&t0_);
+		c0_ = cycles();
+	}
+
+	/* charges the counters since start() to the node and to the current block */
+	void stop(UINT32 node, UINT32 frames) {
+		ProfileSample s;
+		UINT64        c1 = cycles();
+		LARGE_INTEGER t1;
+
+		QueryPerformanceCounter(&t1);
+
+		memset(&s, 0, sizeof(s));
+		s.block  = block_;
+		s.node   = node;
+		s.ticks  = sub(t1.QuadPart - t0_.QuadPart, overheadTicks_);
+		s.cycles = sub(c1 - c0_, overhead_);
+
+		Totals &t = totals_[node];
+		t.calls++;
+		t.frames += frames;
+		t.ticks  += s.ticks;
+		t.cycles += s.cycles;
+		if (samples_.size() < PROF_SAMPLES)
+			samples_.push_back(s);
+		if (fCounting_)
+			calls_.push_back(s);
+	}
+
+	/* the following nodes belong to the next block */
+	void next() { block_++; }
+
+	/* per node table: share of the cycles, time per block, cycles per frame and, if counted,
+	   instructions per cycle and the misses per 1000 instructions */
+	void print() const {
+		UINT64 all = 0;
+
+		for (size_t k = 0; k < totals_.size(); k++)
+			all += totals_[k].cycles;
+
+		printf("%-10s %6s %8s %9s %9s", "block", "calls", "share", "us/block", "cyc/frame");
+		if (fPmc_)
+			printf(" %6s %9s %9s %9s", "IPC", "cache/ki", "LLC/ki", "branch/ki");
+		printf("\n");
+		for (size_t k = 0; k < totals_.size(); k++) {
+			const Totals &t = totals_[k];
+
+			printf("%-10s %6u %7.1lf%% %9.2lf %9.1lf", t.name, t.calls, all > 0 ? 100.0*t.cycles/all : 0.0,
+				   t.calls > 0 ? t.ticks*1e6/freq_.QuadPart/t.calls : 0.0, t.frames > 0 ? (double)t.cycles/t.frames : 0.0);
+			if (fPmc_) {
+				double ki = t.pmc[0]/1000.0;
+
+				column(6, pmc_.index(0) >= 0 && t.pmcCycles > 0, (double)t.pmc[0]/max(t.pmcCycles, (UINT64)1));
+				for (int j = 1; j < PROF_PMCS; j++)
+					column(9, pmc_.index(0) >= 0 && pmc_.index(j) >= 0 && ki > 0.0, t.pmc[j]/max(ki, 1e-3));
+			}
+			printf("\n");
+		}
+	}
+
+	/* the totals and the per block counts */
+	bool save(LPCWSTR filename) const {
+		static const char *keys[PROF_PMCS] = { "instructions", "cache_misses", "llc_misses", "branch_misses" };
+		FILE *fp;
+
+		if (_wfopen_s(&fp, filename, L"w") != 0)
+			return false;
+
+		fprintf(fp, "{\n  \"rate\": %u,\n  \"nodes\": [\n", FS);
+		for (size_t k = 0; k < totals_.size(); k++) {
+			const Totals &t = totals_[k];
+
+			fprintf(fp, "    { \"name\": \"%s\", \"calls\": %u, \"frames\": %llu, \"us\": %.3lf, \"cycles\": %llu", t.name, t.calls,
+					t.frames, t.ticks*1e6/freq_.QuadPart, t.cycles);
+			if (fPmc_) {
+				fprintf(fp, ", \"counted\": %u", t.counted);
+				for (int j = 0; j < PROF_PMCS; j++)
+					if (pmc_.index(j) >= 0)
+						fprintf(fp, ", \"%s\": %llu", keys[j], t.pmc[j]);
+					else
+						fprintf(fp, ", \"%s\": null", keys[j]);
+			}
+			fprintf(fp, " }%s\n", k+1 < totals_.size() ? "," : "");
+		}
+
+		// one row per node and block: block, node, us, cycles and the counters (profSources) if counted
+		fprintf(fp, "  ],\n  \"samples\": [\n");
+		for (size_t i = 0; i < samples_.size(); i++) {
+			const ProfileSample &s = samples_[i];
+
+			fprintf(fp, "    [%u, %u, %.3lf, %llu", s.block, s.node, s.ticks*1e6/freq_.QuadPart, s.cycles);
+			if (fPmc_)
+				for (int j = 0; j < PROF_PMCS; j++)
+					if (pmc_.index(j) >= 0)
+						fprintf(fp, ", %llu", s.pmc[j]);
+					else
+						fprintf(fp, ", null");
+			fprintf(fp, "]%s\n", i+1 < samples_.size() ? "," : "");
+		}
+		fprintf(fp, "  ]\n}\n");
+
+		return fclose(fp) == 0;
+	}
+
+private:
+	struct Totals {
+		const char *name;
+		UINT32      calls;
+		UINT32      counted;			// calls with the hardware counters read on one processor
+		UINT64      frames;
+		UINT64      cycles;
+		UINT64      ticks;
+		UINT64      pmc[PROF_PMCS];
+		UINT64      pmcCycles;			// cycles of the counted calls
+	};
+
+	static UINT64 sub(UINT64 d, UINT64 overhead) { return d > overhead ? d - overhead : 0; }
+
+	static void column(int width, bool fValid, double value) {
+		if (fValid)
+			printf(" %*.2lf", width, value);
+		else
+			printf(" %*s", width, "-");
+	}
+
+	/* cycles of the calling thread so far, a system call (the marker of the hardware counters) */
+	static UINT64 cycles() {
+		ULONG64 c;
+
+		return QueryThreadCycleTime(GetCurrentThread(), &c) ? c : 0;
+	}
+
+	void restoreAffinity() {
+		if (affinity_ != 0)
+			SetThreadAffinityMask(GetCurrentThread(), affinity_);
+		affinity_ = 0;
+	}
+
+	UINT64                overhead_, overheadTicks_;
+	LARGE_INTEGER         freq_, t0_;
+	UINT64                c0_;
+	vector<Totals>        totals_;
+	vector<ProfileSample> samples_;
+	vector<ProfileSample> calls_;		// node and cycles of every call while the counters run
+	size_t                first_;		// sample of the first of them
+	UINT32                block_;
+	PmcSession            pmc_;
+	bool                  fPmc_, fCounting_;
+	DWORD_PTR             affinity_;
+};
+
+
+/* measures a node of a chain, otherwise passes everything on to it */
+class ProfiledNode: public DspNode {
+public:
+	/* fOwner: the node is deleted together with the wrapper */
+	ProfiledNode(DspNode *node, NodeProfiler *profiler, bool fOwner = false): node_(node), profiler_(profiler), fOwner_(fOwner) {
+		index_ = profiler->add(node->name());
+	}
+
+	~ProfiledNode() {
+		if (fOwner_)
+			delete node_;
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		profiler_->start();
+		node_->process(input, output, samples);
+		profiler_->stop(index_, samples);
+	}
+
+	void reset() { node_->reset(); }
+	const char *name() const { return node_->name(); }
+	UINT32 latency() const { return node_->latency(); }
+	UINT32 preroll(double decayDb) const { return node_->preroll(decayDb); }
+	UINT32 tail() const { return node_->tail(); }
+
+private:
+	DspNode      *node_;
+	NodeProfiler *profiler_;
+	UINT32        index_;
+	bool          fOwner_;
+};
@@ -0,0 +1,207 @@
+/*
+ * regress.h -- Golden output regression checks
+ *
+ * Runs a processing block on a deterministic stimulus with a varying block size and
+ * compares the result against a stored reference output. Fixed-point blocks must match
+ * bit-exactly, floating point blocks are allowed a small error (max LSB difference and SNR).
+ * A missing reference is a failure. The references are kept in the regress directory of
+ * the repository and recorded again (--record) only when an output is meant to change.
+ */
+
+#pragma once
+#include <windows.h>
+#include <math.h>
+#include <stdio.h>
+#include "node.h"
+
+using namespace std;
+
+#define REGRESS_FRAMES	65536	// length of the stimulus (in frames)
+
+
+enum compare_type {exact_compare, tolerance_compare};
+
+class Regression {
+public:
+	Regression(LPCWSTR dir, bool fRecord): dir_(dir), fRecord_(fRecord), failures_(0) {
+		UINT32 s = 12345;
+
+		if (fRecord)
+			CreateDirectoryW(dir, NULL);
+
+		// stimulus: impulse, pseudo-random noise, linear chirp and a full scale square wave
+		in_  = new pcm_frame[REGRESS_FRAMES];
+		out_ = new pcm_frame[REGRESS_FRAMES];
+		ref_ = new pcm_frame[REGRESS_FRAMES];
+		for (UINT32 i = 0; i < REGRESS_FRAMES; i++) {
+			double v;
+
+			s = s*1664525 + 1013904223;				// LCG, same sequence on every platform
+			if (i < 8192)
+				v = (i == 0) ? 32767.0 : 0.0;
+			else if (i < 24576)
+				v = (INT16)(s >> 16) * 0.5;
+			else if (i < 57344)
+				v = 16384.0*sin(0.5e-4*(i-24576.0)*(i-24576.0));
+			else
+				v = ((i >> 6) & 1) ? 32767.0 : -32768.0;
+			in_[i].left  = (INT16)v;
+			in_[i].right = (INT16)(s >> 20);
+		}
+	}
+
+	~Regression() {
+		delete [] in_;
+		delete [] out_;
+		delete [] ref_;
+	}
+
+	/* runs the given node and checks (or records) its output, returns false on mismatch */
+	bool run(const char *name, DspNode *node, compare_type cmp, int maxLsb = 1, double minSnr = 90.0) {
+		node->reset();
+		process(node);
+
+		return check(name, cmp, maxLsb, minSnr);
+	}
+
+	/* runs the node on the stimulus with every other 8192 frames silenced, alone and in a chain
+	   whose silence gate skips and clears it in the gaps; the outputs must be the same */
+	bool runGated(const char *name, DspNode *node) {
+		Chain      chain("gated", 1024);
+		pcm_frame *in = new pcm_frame[REGRESS_FRAMES];
+
+		for (UINT32 i = 0; i < REGRESS_FRAMES; i++)
+			if ((i >> 13) & 1)
+				in[i].left = in[i].right = 0;
+			else
+				in[i] = in_[i];
+
+		chain.add(node);
+		node->reset();
+		for (UINT32 i = 0, n; i < REGRESS_FRAMES; i += n) {
+			n = blockSize(i);
+			node->process(&in[i], &ref_[i], n);
+		}
+		node->reset();
+		for (UINT32 i = 0, n; i < REGRESS_FRAMES; i += n) {
+			n = blockSize(i);
+			chain.process(&in[i], &out_[i], n);
+		}
+		delete [] in;
+
+		bool fOk = memcmp(out_, ref_, REGRESS_FRAMES*sizeof(pcm_frame)) == 0;
+		printf("%-16s %s\n", name, fOk ? "gated bit-exact" : "FAILED (gated output differs)");
+		if (!fOk)
+			failures_++;
+
+		return fOk;
+	}
+
+	/* runs the reference node a and the node b, whose output is delayed by shift frames more, and
+	   compares their outputs (e.g. the same filter by two methods) */
+	bool runPair(const char *name, DspNode *a, DspNode *b, UINT32 shift, compare_type cmp, int maxLsb = 1, double minSnr = 90.0) {
+		a->reset();
+		process(a);
+		memcpy(ref_, out_, REGRESS_FRAMES*sizeof(pcm_frame));
+		b->reset();
+		process(b);
+		memmove(out_, &out_[shift], (REGRESS_FRAMES - shift)*sizeof(pcm_frame));
+
+		return compare(name, cmp, maxLsb, minSnr, REGRESS_FRAMES - shift);
+	}
+
+	/* counts the result of a check made by the caller */
+	bool expect(const char *name, bool fOk) {
+		printf("%-16s %s\n", name, fOk ? "ok" : "FAILED");
+		if (!fOk)
+			failures_++;
+
+		return fOk;
+	}
+
+	/* callback version for processing which is not a DspNode (e.g. the whole MyAudio::ProcessData) */
+	template <class F> bool run(const char *name, F process, compare_type cmp, int maxLsb = 1, double minSnr = 90.0) {
+		for (UINT32 i = 0, n; i < REGRESS_FRAMES; i += n) {
+			n = blockSize(i);
+			process(&in_[i], &out_[i], n);
+		}
+
+		return check(name, cmp, maxLsb, minSnr);
+	}
+
+	int failures() const { return failures_; }
+
+private:
+	/* block sizes vary deterministically from 1 to 1024 frames to exercise the block boundaries */
+	UINT32 blockSize(UINT32 pos) {
+		UINT32 n = ((pos*2654435761u) >> 22) + 1;
+
+		return min(n, REGRESS_FRAMES - pos);
+	}
+
+	void process(DspNode *node) {
+		for (UINT32 i = 0, n; i < REGRESS_FRAMES; i += n) {
+			n = blockSize(i);
+			node->process(&in_[i], &out_[i], n);
+		}
+	}
+
+	bool check(const char *name, compare_type cmp, int maxLsb, double minSnr) {
+		wchar_t path[MAX_PATH];
+		FILE   *fp;
+
+		swprintf(path, MAX_PATH, L"%ls\\%hs.pcm", dir_, name);
+
+		if (fRecord_) {
+			if (_wfopen_s(&fp, path, L"wb") != 0 || fwrite(out_, sizeof(pcm_frame), REGRESS_FRAMES, fp) != REGRESS_FRAMES) {
+				printf("%-16s cannot write reference\n", name);
+				failures_++;
+				return false;
+			}
+			fclose(fp);
+			printf("%-16s recorded\n", name);
+			return true;
+		}
+
+		if (_wfopen_s(&fp, path, L"rb") != 0 || fread(ref_, sizeof(pcm_frame), REGRESS_FRAMES, fp) != REGRESS_FRAMES) {
+			printf("%-16s no reference output (record it with --record)\n", name);
+			failures_++;
+			return false;
+		}
+		fclose(fp);
+
+		return compare(name, cmp, maxLsb, minSnr, REGRESS_FRAMES);
+	}
+
+	/* the first frames of the output against the reference */
+	bool compare(const char *name, compare_type cmp, int maxLsb, double minSnr, UINT32 frames) {
+		if (memcmp(out_, ref_, frames*sizeof(pcm_frame)) == 0) {
+			printf("%-16s bit-exact\n", name);
+			return true;
+		}
+
+		// not bit-exact: measure the difference
+		int    diff = 0;
+		double es = 0.0, en = 0.0;
+		for (UINT32 i = 0; i < frames; i++) {
+			int dl = out_[i].left - ref_[i].left, dr = out_[i].right - ref_[i].right;
+
+			diff = max(diff, max(abs(dl), abs(dr)));
+			es  += (double)ref_[i].left*ref_[i].left + (double)ref_[i].right*ref_[i].right;
+			en  += (double)dl*dl + (double)dr*dr;
+		}
+		double snr = en > 0.0 ? 10.0*log10(es/en) : 999.0;
+
+		bool fOk = cmp == tolerance_compare && diff <= maxLsb && snr >= minSnr;
+		printf("%-16s %s (max difference %d LSB, SNR %.1lf dB)\n", name, fOk ? "within tolerance" : "FAILED", diff, snr);
+		if (!fOk)
+			failures_++;
+
+		return fOk;
+	}
+
+	LPCWSTR    dir_;
+	bool       fRecord_;
+	int        failures_;
+	pcm_frame *in_, *out_, *ref_;
+};
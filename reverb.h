@@ -0,0 +1,60 @@
+#pragma once
+#include <windows.h>
+#include "comb.h"
+#include "allpass.h"
+#include "node.h"
+
+using namespace std;
+
+
+/* Schroeder reverberator: four parallel comb filters followed by two series allpass filters */
+class Reverb: public DspNode {
+public:
+	Reverb(): comb1(5239, 1.0f), comb2(6544, 1.0f), comb3(7250, 1.0f), comb4(7708, 1.0f),
+			  ap1(220, 96.83e-3f), ap2(75, 32.92e-3f) {
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		memset(output, 0, samples*sizeof(pcm_frame));
+		comb1.process(input, output, samples);
+		comb2.process(input, output, samples);
+		comb3.process(input, output, samples);
+		comb4.process(input, output, samples);
+
+		ap1.process(output, output, samples);
+		ap2.process(output, output, samples);
+	}
+
+	void reset() {
+		comb1.reset(); comb2.reset(); comb3.reset(); comb4.reset();
+		ap1.reset(); ap2.reset();
+	}
+
+	const char *name() const { return "reverb"; }
+
+	/* the longest comb tail followed by both allpasses */
+	UINT32 tail() const {
+		UINT32 d = max(max(comb1.tail(), comb2.tail()), max(comb3.tail(), comb4.tail()));
+
+		return d + ap1.tail() + ap2.tail();
+	}
+
+	/* the longest comb followed by both allpasses */
+	UINT32 preroll(double decayDb) const {
+		UINT32 d = max(max(comb1.preroll(decayDb), comb2.preroll(decayDb)), max(comb3.preroll(decayDb), comb4.preroll(decayDb)));
+
+		return d + ap1.preroll(decayDb) + ap2.preroll(decayDb);
+	}
+
+	/* the combs add up, each allpass passes them on at its peak gain and adds its own */
+	double limitCycle() const {
+		double a = comb1.limitCycle() + comb2.limitCycle() + comb3.limitCycle() + comb4.limitCycle();
+
+		a = a*ap1.peakGain() + ap1.limitCycle();
+		return a*ap2.peakGain() + ap2.limitCycle();
+	}
+
+private:
+	Comb    comb1, comb2, comb3, comb4;
+	Allpass ap1, ap2;
+};
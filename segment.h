@@ -0,0 +1,145 @@
+/*
+ * segment.h -- Offline processing of one long signal in parallel segments
+ *
+ * The signal is cut into as many segments as there are processors and every segment is
+ * processed on its own thread by its own instance of the block. An instance first rebuilds
+ * its state by running over the preroll() input samples preceding its segment (the output is
+ * thrown away), so the segments stitch together without seams. A block with a finite memory,
+ * like a FIR filter, reproduces the serial output exactly. The state of a feedback block is
+ * rebuilt only until the older state has decayed by the given amount, which bounds the error
+ * at the segment starts to that much below full scale. The fixed-point feedback loops keep
+ * rounding limit cycles which no pre-roll removes, the serial and the segmented processing may
+ * settle to different ones, so the error of the reverb does not go below them.
+ */
+
+#pragma once
+#include <windows.h>
+#include <math.h>
+#include <functional>
+#include "wavIO.h"
+#include "node.h"
+
+using namespace std;
+
+#define SEG_DECAY	96.0	// default decay of the feedback state over the pre-roll (in dB, below the LSB at full scale)
+#define SEG_BLOCK	4096	// processing block of the segment threads (in frames)
+
+
+class SegmentRunner {
+public:
+	/* factory makes a new instance of the processing on every call (called on the worker threads,
+	   the instances are deleted after their segment), segments 0 for one per processor */
+	SegmentRunner(function<DspNode *()> factory, UINT32 segments = 0, double decayDb = SEG_DECAY):
+	  factory_(factory), segments_(segments), used_(0), decayDb_(decayDb), preroll_(0), limit_(0.0) {
+		if (segments_ == 0) {
+			SYSTEM_INFO si;
+
+			GetSystemInfo(&si);
+			segments_ = si.dwNumberOfProcessors;
+		}
+		segments_ = max(1u, min(segments_, (UINT32)MAXIMUM_WAIT_OBJECTS));
+	}
+
+	/* processes frames of input to output (not overlapping), E_NOTIMPL if the state of some block
+	   cannot be rebuilt from its input */
+	HRESULT process(const pcm_frame *input, pcm_frame *output, UINT32 frames) {
+		DspNode *node = factory_();
+
+		if (node == NULL)
+			return E_FAIL;
+		preroll_ = node->preroll(decayDb_);
+		limit_   = node->limitCycle();
+		delete node;
+		if (preroll_ == PREROLL_NONE)
+			return E_NOTIMPL;
+
+		// a segment shorter than its pre-roll would more than double the work
+		UINT32 n = max(1u, min(segments_, frames / max(preroll_, (UINT32)SEG_BLOCK)));
+		vector<Segment> segs(n);
+		vector<HANDLE>  threads;
+
+		for (UINT32 k = 0; k < n; k++) {
+			Segment &s = segs[k];
+
+			s.runner = this;
+			s.input  = input;
+			s.output = output;
+			s.begin  = (UINT32)((UINT64)frames*k/n);
+			s.end    = (UINT32)((UINT64)frames*(k+1)/n);
+			s.hr     = E_FAIL;
+		}
+		// the first segment on this thread, the state of the stream start is the cleared one
+		for (UINT32 k = 1; k < n; k++) {
+			HANDLE h = CreateThread(NULL, 0, worker, &segs[k], 0, NULL);
+
+			if (h == NULL)
+				worker(&segs[k]);								// no more threads, do it here
+			else
+				threads.push_back(h);
+		}
+		worker(&segs[0]);
+
+		if (!threads.empty())
+			WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+		for (size_t i = 0; i < threads.size(); i++)
+			CloseHandle(threads[i]);
+
+		used_ = n;
+		for (UINT32 k = 0; k < n; k++)
+			if (segs[k].hr != S_OK)
+				return segs[k].hr;
+
+		return S_OK;
+	}
+
+	/* segments and pre-roll of the last process() */
+	UINT32 segments() const { return used_; }
+	UINT32 preroll() const { return preroll_; }
+
+	/* error at the segment starts caused by the decayed remains of the older feedback state (in LSB) */
+	double stateError() const { return 32768.0*pow(10.0, -decayDb_/20.0); }
+
+	/* largest error of the segmented output (in LSB): the remains of the older state and two limit
+	   cycles of opposite sign, one in each of the outputs */
+	double errorBound() const { return stateError() + 2.0*limit_; }
+
+private:
+	struct Segment {
+		SegmentRunner   *runner;
+		const pcm_frame *input;
+		pcm_frame       *output;
+		UINT32           begin, end;
+		HRESULT          hr;
+	};
+
+	static DWORD WINAPI worker(LPVOID pContext) {
+		Segment   *s    = (Segment *)pContext;
+		DspNode   *node = s->runner->factory_();
+
+		if (node == NULL)
+			return 0;
+		pcm_frame *tmp  = new pcm_frame[SEG_BLOCK];
+		UINT32     from = s->begin > s->runner->preroll_ ? s->begin - s->runner->preroll_ : 0;
+
+		// warm-up, the output is not needed
+		for (UINT32 i = from, n; i < s->begin; i += n) {
+			n = min(s->begin - i, (UINT32)SEG_BLOCK);
+			node->process(&s->input[i], tmp, n);
+		}
+		for (UINT32 i = s->begin, n; i < s->end; i += n) {
+			n = min(s->end - i, (UINT32)SEG_BLOCK);
+			node->process(&s->input[i], &s->output[i], n);
+		}
+
+		delete [] tmp;
+		delete node;
+		s->hr = S_OK;
+		return 0;
+	}
+
+	function<DspNode *()> factory_;
+	UINT32                segments_, used_;
+	double                decayDb_;
+	UINT32                preroll_;
+	double                limit_;						// limit cycle amplitude of the block (in LSB)
+};
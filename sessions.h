@@ -0,0 +1,245 @@
+/*
+ * sessions.h -- Band detector of the filter mode for many independent streams
+ *
+ * Runs the two band-pass filters of the filter mode and their level comparison on hundreds
+ * of mono streams in one thread. The streams are grouped by SESSION_LANES and the state of a
+ * group is stored structure-of-arrays, a row of the delay line holding the same time step of
+ * every stream of the group, so one vector instruction advances all the streams of a group
+ * through the same coefficient (one AVX-512, two AVX2 or four SSE2 registers per row).
+ *
+ * A row element packs two consecutive samples of a stream, x[t] in the low and x[t-1] in the
+ * high half, so that pmaddwd with a coefficient pair does two taps at once. The arithmetic is
+ * the Q15 arithmetic of the Fir block, so every stream gives exactly the filter outputs Fir
+ * gives for it alone.
+ *
+ * Sessions are added and removed by a control thread through a command queue which the
+ * processing thread drains at the block boundary, the other sessions go on uninterrupted.
+ */
+
+#pragma once
+#include <windows.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <vector>
+#include "wavIO.h"
+#include "simd.h"
+#include "params.h"
+
+using namespace std;
+
+#define SESSION_LANES	16		// streams of one group
+#define SESSION_BLOCK	441		// default processing block (in samples, 10 ms)
+#define SESSION_QUEUE	256		// add and remove commands waiting for the processing thread (power of two)
+#define DETECT_LIMIT	24.0f	// level difference of the filter mode detector
+
+
+class DetectorBank {
+public:
+	/* h1 and h2 are the Q15 band-pass filters of the same length, capacity the largest number of sessions */
+	DetectorBank(const INT16 *h1, const INT16 *h2, UINT32 taps, UINT32 capacity, UINT32 block = SESSION_BLOCK):
+	  T((taps+1) & ~1), N(block), capacity_(capacity), groups_((capacity + SESSION_LANES-1)/SESSION_LANES), sessions_(0) {
+		// coefficient pairs (h[2j], h[2j+1]) for pmaddwd, odd length padded with a zero tap
+		for (int f = 0; f < 2; f++) {
+			const INT16 *h = f ? h2 : h1;
+
+			hp_[f] = (INT32 *)_aligned_malloc(T/2*sizeof(INT32), 64);
+			for (UINT32 j = 0; j < T/2; j++)
+				hp_[f][j] = (UINT16)h[2*j] | (UINT32)(2*j+1 < taps ? h[2*j+1] : 0) << 16;
+		}
+
+		// rows 0..T-1 are the history, T..T+N-1 the current block
+		stride_ = (T + N)*SESSION_LANES;
+		x_      = (INT32 *)_aligned_malloc(groups_*stride_*sizeof(INT32), 64);
+		memset(x_, 0, groups_*stride_*sizeof(INT32));
+		mask_.assign(groups_, 0);
+		for (UINT32 id = capacity; id-- > 0; )
+			free_.push_back(id);
+
+		switch (simdLevel()) {
+		case avx512_level: kernel_ = &DetectorBank::groupAvx512; break;
+		case avx2_level:   kernel_ = &DetectorBank::groupAvx2;   break;
+		default:           kernel_ = &DetectorBank::groupSse2;   break;
+		}
+	}
+
+	~DetectorBank() {
+		_aligned_free(hp_[0]);
+		_aligned_free(hp_[1]);
+		_aligned_free(x_);
+	}
+
+	/* control thread: new session starting at the next block, returns its id or -1 if there is no room */
+	int add() {
+		if (free_.empty())
+			return -1;
+
+		Command cmd = { true, free_.back() };
+		if (!cmds_.push(cmd))
+			return -1;
+		free_.pop_back();
+		sessions_++;
+
+		return cmd.id;
+	}
+
+	/* control thread: the session ends at the next block, its id may be reused at once */
+	bool remove(int id) {
+		Command cmd = { false, id };
+
+		if (!cmds_.push(cmd))
+			return false;
+		free_.push_back(id);
+		sessions_--;
+
+		return true;
+	}
+
+	/* processing thread: one block of every session, input[id] has block samples of session id
+	   (unused for the ids not in use) and level[id] receives the level difference of the two
+	   bands (the detector fires when its magnitude exceeds DETECT_LIMIT) */
+	void process(const INT16 *const *input, float *level) {
+		__declspec(align(64)) INT32 sum[2][SESSION_LANES];
+
+		update();
+
+		for (UINT32 g = 0; g < groups_; g++) {
+			if (mask_[g] == 0)
+				continue;
+			INT32 *x = &x_[g*stride_];
+
+			// transpose the block into the rows, pairing every sample with the previous one
+			for (UINT32 lane = 0; lane < SESSION_LANES; lane++) {
+				if (!(mask_[g] & (1u << lane)))
+					continue;
+				const INT16 *p    = input[g*SESSION_LANES + lane];
+				INT32       *row  = &x[T*SESSION_LANES + lane];
+				UINT32       prev = (UINT16)row[-SESSION_LANES];
+
+				for (UINT32 t = 0; t < N; t++, row += SESSION_LANES) {
+					*row = (UINT16)p[t] | prev << 16;
+					prev = (UINT16)p[t];
+				}
+			}
+
+			(this->*kernel_)(x, sum);
+
+			for (UINT32 lane = 0; lane < SESSION_LANES; lane++)
+				if (mask_[g] & (1u << lane))
+					level[g*SESSION_LANES + lane] = 2.0f*(sum[0][lane] - sum[1][lane])/32768.0f;	// both channels in the filter mode
+
+			memmove(x, &x[N*SESSION_LANES], T*SESSION_LANES*sizeof(INT32));
+		}
+	}
+
+	/* processing thread: takes the added and removed sessions into account, done by process() too */
+	void update() {
+		Command cmd;
+
+		while (cmds_.pop(cmd)) {
+			UINT32 g = cmd.id/SESSION_LANES, lane = cmd.id % SESSION_LANES;
+
+			if (cmd.fAdd) {
+				// start from silence
+				for (UINT32 r = 0; r < T + N; r++)
+					x_[g*stride_ + r*SESSION_LANES + lane] = 0;
+				mask_[g] |= 1u << lane;
+			} else
+				mask_[g] &= ~(1u << lane);
+		}
+	}
+
+	UINT32 capacity() const { return capacity_; }
+	UINT32 sessions() const { return sessions_; }
+	UINT32 block() const { return N; }
+
+private:
+	struct Command {
+		bool fAdd;
+		int  id;
+	};
+
+	/* Q30 sum of the taps, rounded, shifted to Q15 and saturated like Fir does, the absolute
+	   values summed over the block for both filters */
+	void groupSse2(const INT32 *x, INT32 sum[2][SESSION_LANES]) {
+		for (int q = 0; q < SESSION_LANES/4; q++) {
+			__m128i s1 = _mm_setzero_si128(), s2 = _mm_setzero_si128();
+
+			for (UINT32 t = 0; t < N; t++) {
+				const __m128i *r  = (const __m128i *)&x[(T+t)*SESSION_LANES] + q;
+				__m128i        a1 = _mm_set1_epi32(0x4000), a2 = a1;
+
+				for (UINT32 j = 0; j < T/2; j++, r -= 2*SESSION_LANES/4) {
+					__m128i v = _mm_load_si128(r);
+					a1 = _mm_add_epi32(a1, _mm_madd_epi16(v, _mm_set1_epi32(hp_[0][j])));
+					a2 = _mm_add_epi32(a2, _mm_madd_epi16(v, _mm_set1_epi32(hp_[1][j])));
+				}
+				s1 = _mm_add_epi32(s1, abs16(_mm_srai_epi32(a1, 15)));
+				s2 = _mm_add_epi32(s2, abs16(_mm_srai_epi32(a2, 15)));
+			}
+			_mm_store_si128((__m128i *)&sum[0][4*q], s1);
+			_mm_store_si128((__m128i *)&sum[1][4*q], s2);
+		}
+	}
+
+	/* |sat16(v)| in 32-bit lanes with SSE2 only */
+	static inline __m128i abs16(__m128i v) {
+		v = _mm_packs_epi32(v, v);
+		v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i s = _mm_srai_epi32(v, 31);
+
+		return _mm_sub_epi32(_mm_xor_si128(v, s), s);
+	}
+
+	SIMD_AVX2 void groupAvx2(const INT32 *x, INT32 sum[2][SESSION_LANES]) {
+		const __m256i lo = _mm256_set1_epi32(-32768), hi = _mm256_set1_epi32(32767);
+
+		for (int q = 0; q < SESSION_LANES/8; q++) {
+			__m256i s1 = _mm256_setzero_si256(), s2 = _mm256_setzero_si256();
+
+			for (UINT32 t = 0; t < N; t++) {
+				const __m256i *r  = (const __m256i *)&x[(T+t)*SESSION_LANES] + q;
+				__m256i        a1 = _mm256_set1_epi32(0x4000), a2 = a1;
+
+				for (UINT32 j = 0; j < T/2; j++, r -= 2*SESSION_LANES/8) {
+					__m256i v = _mm256_load_si256(r);
+					a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(v, _mm256_set1_epi32(hp_[0][j])));
+					a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(v, _mm256_set1_epi32(hp_[1][j])));
+				}
+				s1 = _mm256_add_epi32(s1, _mm256_abs_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(a1, 15), lo), hi)));
+				s2 = _mm256_add_epi32(s2, _mm256_abs_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(a2, 15), lo), hi)));
+			}
+			_mm256_store_si256((__m256i *)&sum[0][8*q], s1);
+			_mm256_store_si256((__m256i *)&sum[1][8*q], s2);
+		}
+	}
+
+	SIMD_AVX512 void groupAvx512(const INT32 *x, INT32 sum[2][SESSION_LANES]) {
+		const __m512i lo = _mm512_set1_epi32(-32768), hi = _mm512_set1_epi32(32767);
+		__m512i s1 = _mm512_setzero_si512(), s2 = _mm512_setzero_si512();
+
+		for (UINT32 t = 0; t < N; t++) {
+			const __m512i *r  = (const __m512i *)&x[(T+t)*SESSION_LANES];
+			__m512i        a1 = _mm512_set1_epi32(0x4000), a2 = a1;
+
+			for (UINT32 j = 0; j < T/2; j++, r -= 2) {
+				__m512i v = _mm512_load_si512(r);
+				a1 = _mm512_add_epi32(a1, _mm512_madd_epi16(v, _mm512_set1_epi32(hp_[0][j])));
+				a2 = _mm512_add_epi32(a2, _mm512_madd_epi16(v, _mm512_set1_epi32(hp_[1][j])));
+			}
+			s1 = _mm512_add_epi32(s1, _mm512_abs_epi32(_mm512_min_epi32(_mm512_max_epi32(_mm512_srai_epi32(a1, 15), lo), hi)));
+			s2 = _mm512_add_epi32(s2, _mm512_abs_epi32(_mm512_min_epi32(_mm512_max_epi32(_mm512_srai_epi32(a2, 15), lo), hi)));
+		}
+		_mm512_store_si512(sum[0], s1);
+		_mm512_store_si512(sum[1], s2);
+	}
+
+	UINT32 T, N;							// filter length (even) and block length
+	UINT32 capacity_, groups_, stride_;
+	INT32 *hp_[2];							// coefficient pairs of both filters
+	INT32 *x_;								// delay line rows of every group
+	vector<UINT32> mask_;					// sessions in use in each group (processing thread)
+	vector<int>    free_;					// ids not in use (control thread)
+	UINT32         sessions_;
+	SpscQueue<Command, SESSION_QUEUE> cmds_;
+	void (DetectorBank::*kernel_)(const INT32 *x, INT32 sum[2][SESSION_LANES]);
+};
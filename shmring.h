@@ -0,0 +1,308 @@
+/*
+ * shmring.h -- Shared memory transport of the processed audio to other local processes
+ *
+ * The producer writes the frames to a ring in a named file mapping and advances the write
+ * position; every consumer process claims a reader slot with its own read position and
+ * reads the frames in place, so a block is copied once however many consumers there are.
+ * The producer never waits for the consumers: it only signals the event of each slot, and
+ * a consumer which falls more than the ring length behind has lost the overwritten frames.
+ * It detects that from the positions, counts an overrun and skips ahead to the live data.
+ *
+ * The positions are absolute frame counts, so a consumer knows the stream time of every
+ * frame and the length of any gap.
+ */
+
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <stdio.h>
+#include "wavIO.h"
+
+using namespace std;
+
+#define SHM_MAGIC		0x52505344		// 'DSPR'
+#define SHM_VERSION		1
+#define SHM_FRAMES		32768			// default ring length (in frames, power of two, abt. 0.74 s)
+#define SHM_READERS		8				// largest number of simultaneous consumers
+#define SHM_MARGIN		4096			// largest write, frames a consumer must stay away from the write position
+
+
+/* beginning of the shared memory, followed by the frame ring */
+struct ShmHeader {
+	UINT32           magic, version;
+	UINT32           frames;								// ring length (in frames)
+	UINT32           rate;									// sampling rate (Hz)
+	atomic<UINT64>   writePos;								// frames written since the start
+	struct {
+		atomic<DWORD>  pid;									// process id of the consumer, 0 if free
+		atomic<UINT64> readPos;
+		atomic<UINT32> overruns;							// number of times frames were lost
+	} reader[SHM_READERS];
+};
+
+
+/* names of the mapping and of the reader events derived from the transport name */
+inline void shmName(wchar_t *buf, size_t len, LPCWSTR name, int reader = -1) {
+	if (reader < 0)
+		swprintf(buf, len, L"Local\\dspframework.%ls", name);
+	else
+		swprintf(buf, len, L"Local\\dspframework.%ls.reader%d", name, reader);
+}
+
+
+class ShmWriter {
+public:
+	ShmWriter(): hMap_(NULL), hdr_(NULL), ring_(NULL) {
+		for (int r = 0; r < SHM_READERS; r++)
+			hEvent_[r] = NULL;
+	}
+
+	~ShmWriter() {
+		close();
+	}
+
+	/* creates the named transport, frames must be a power of two; fails if another producer
+	   already has the name */
+	HRESULT create(LPCWSTR name, UINT32 frames = SHM_FRAMES, UINT32 rate = 44100) {
+		wchar_t path[MAX_PATH];
+		size_t  size = sizeof(ShmHeader) + (size_t)frames*sizeof(pcm_frame);
+
+		if ((frames & (frames-1)) != 0 || frames < 2*SHM_MARGIN)
+			return E_INVALIDARG;
+		close();
+
+		shmName(path, MAX_PATH, name);
+		if ((hMap_ = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, path)) == NULL)
+			return E_FAIL;
+		if (GetLastError() == ERROR_ALREADY_EXISTS) {			// another producer has the name, leave its ring alone
+			CloseHandle(hMap_);
+			hMap_ = NULL;
+			return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+		}
+		if ((hdr_ = (ShmHeader *)MapViewOfFile(hMap_, FILE_MAP_ALL_ACCESS, 0, 0, size)) == NULL) {
+			close();
+			return E_FAIL;
+		}
+		// auto-reset events, one per reader slot so that every consumer is woken up
+		for (int r = 0; r < SHM_READERS; r++) {
+			shmName(path, MAX_PATH, name, r);
+			if ((hEvent_[r] = CreateEventW(NULL, FALSE, FALSE, path)) == NULL) {
+				close();
+				return E_FAIL;
+			}
+		}
+
+		ring_         = (pcm_frame *)&hdr_[1];
+		hdr_->frames  = frames;
+		hdr_->rate    = rate;
+		hdr_->writePos.store(0, memory_order_relaxed);
+		for (int r = 0; r < SHM_READERS; r++) {
+			hdr_->reader[r].pid.store(0, memory_order_relaxed);
+			hdr_->reader[r].overruns.store(0, memory_order_relaxed);
+		}
+		hdr_->version = SHM_VERSION;
+		atomic_thread_fence(memory_order_release);
+		hdr_->magic   = SHM_MAGIC;							// consumers may attach from now on
+
+		return S_OK;
+	}
+
+	void close() {
+		for (int r = 0; r < SHM_READERS; r++) {
+			if (hEvent_[r] != NULL)
+				CloseHandle(hEvent_[r]);
+			hEvent_[r] = NULL;
+		}
+		if (hdr_ != NULL) {
+			hdr_->magic = 0;
+			UnmapViewOfFile(hdr_);
+		}
+		if (hMap_ != NULL)
+			CloseHandle(hMap_);
+		hMap_ = NULL;
+		hdr_  = NULL;
+		ring_ = NULL;
+	}
+
+	bool opened() const { return hdr_ != NULL; }
+
+	/* audio thread: appends the frames and wakes up the consumers, never blocks */
+	void write(const pcm_frame *frames, UINT32 n) {
+		UINT32 mask = hdr_->frames - 1;
+
+		// at most SHM_MARGIN frames are overwritten ahead of the published write position
+		for (UINT32 j = 0, len; j < n; j += len) {
+			UINT64 pos = hdr_->writePos.load(memory_order_relaxed);
+
+			len = min(n - j, (UINT32)SHM_MARGIN);
+			for (UINT32 i = 0, m; i < len; i += m) {
+				UINT32 k = (UINT32)(pos + i) & mask;
+
+				m = min(len - i, hdr_->frames - k);			// up to the end of the ring
+				memcpy(&ring_[k], &frames[j+i], m*sizeof(pcm_frame));
+			}
+			hdr_->writePos.store(pos + len, memory_order_release);
+		}
+
+		for (int r = 0; r < SHM_READERS; r++)
+			if (hdr_->reader[r].pid.load(memory_order_relaxed) != 0)
+				SetEvent(hEvent_[r]);
+	}
+
+	/* number of attached consumers */
+	int readers() const {
+		int n = 0;
+
+		for (int r = 0; r < SHM_READERS; r++)
+			if (hdr_->reader[r].pid.load(memory_order_relaxed) != 0)
+				n++;
+		return n;
+	}
+
+private:
+	HANDLE     hMap_;
+	HANDLE     hEvent_[SHM_READERS];
+	ShmHeader *hdr_;
+	pcm_frame *ring_;
+};
+
+
+class ShmReader {
+public:
+	ShmReader(): hMap_(NULL), hEvent_(NULL), hdr_(NULL), ring_(NULL), slot_(-1) {
+	}
+
+	~ShmReader() {
+		close();
+	}
+
+	/* attaches to the named transport, the reading starts from the live data */
+	HRESULT open(LPCWSTR name) {
+		wchar_t path[MAX_PATH];
+
+		close();
+		shmName(path, MAX_PATH, name);
+		if ((hMap_ = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, path)) == NULL ||
+			(hdr_ = (ShmHeader *)MapViewOfFile(hMap_, FILE_MAP_ALL_ACCESS, 0, 0, 0)) == NULL) {
+			close();
+			return E_FAIL;
+		}
+		if (hdr_->magic != SHM_MAGIC || hdr_->version != SHM_VERSION) {
+			close();
+			return E_NOINTERFACE;
+		}
+		atomic_thread_fence(memory_order_acquire);
+		ring_ = (pcm_frame *)&hdr_[1];
+
+		// claim a free reader slot, or one left behind by a consumer which has exited without close()
+		for (int r = 0; r < SHM_READERS && slot_ < 0; r++) {
+			DWORD pid = 0;
+
+			if (hdr_->reader[r].pid.compare_exchange_strong(pid, GetCurrentProcessId()))
+				slot_ = r;
+		}
+		for (int r = 0; r < SHM_READERS && slot_ < 0; r++) {
+			DWORD pid = hdr_->reader[r].pid.load(memory_order_relaxed);
+
+			if (pid != 0 && !alive(pid) && hdr_->reader[r].pid.compare_exchange_strong(pid, GetCurrentProcessId()))
+				slot_ = r;
+		}
+		if (slot_ < 0) {
+			close();
+			return E_OUTOFMEMORY;
+		}
+		hdr_->reader[slot_].readPos.store(hdr_->writePos.load(memory_order_acquire), memory_order_relaxed);
+		hdr_->reader[slot_].overruns.store(0, memory_order_relaxed);
+
+		shmName(path, MAX_PATH, name, slot_);
+		if ((hEvent_ = OpenEventW(SYNCHRONIZE, FALSE, path)) == NULL) {
+			close();
+			return E_FAIL;
+		}
+
+		return S_OK;
+	}
+
+	void close() {
+		if (slot_ >= 0)
+			hdr_->reader[slot_].pid.store(0, memory_order_release);
+		slot_ = -1;
+		if (hEvent_ != NULL)
+			CloseHandle(hEvent_);
+		if (hdr_ != NULL)
+			UnmapViewOfFile(hdr_);
+		if (hMap_ != NULL)
+			CloseHandle(hMap_);
+		hEvent_ = NULL;
+		hdr_    = NULL;
+		hMap_   = NULL;
+		ring_   = NULL;
+	}
+
+	/* waits up to timeout ms for new frames and returns the next contiguous run of them in place
+	   (up to the end of the ring), 0 if there are none; release() tells if the producer has
+	   overwritten them meanwhile */
+	UINT32 acquire(const pcm_frame **frames, DWORD timeout) {
+		UINT64 pos = position(), end = hdr_->writePos.load(memory_order_acquire);
+
+		if (pos == end && timeout != 0) {
+			WaitForSingleObject(hEvent_, timeout);
+			end = hdr_->writePos.load(memory_order_acquire);
+		}
+
+		// too far behind: the oldest frames are being overwritten, continue from the live data
+		if (end - pos > hdr_->frames - SHM_MARGIN) {
+			skip(end);
+			pos = end;
+		}
+
+		UINT32 k = (UINT32)pos & (hdr_->frames - 1);
+		*frames  = &ring_[k];
+
+		return (UINT32)min(end - pos, (UINT64)(hdr_->frames - k));
+	}
+
+	/* marks n frames of the last acquire() consumed, returns false if they were overwritten
+	   while they were being read */
+	bool release(UINT32 n) {
+		UINT64 pos = position(), end = hdr_->writePos.load(memory_order_acquire);
+
+		if (end - pos > hdr_->frames - SHM_MARGIN) {
+			skip(end);
+			return false;
+		}
+		hdr_->reader[slot_].readPos.store(pos + n, memory_order_release);
+
+		return true;
+	}
+
+	/* stream time of the next frame (in frames) */
+	UINT64 position() const { return hdr_->reader[slot_].readPos.load(memory_order_relaxed); }
+
+	UINT32 overruns() const { return hdr_->reader[slot_].overruns.load(memory_order_relaxed); }
+	UINT32 rate() const { return hdr_->rate; }
+
+private:
+	/* tells if the process still runs; one which cannot be opened for another reason (access
+	   denied) is taken as running */
+	static bool alive(DWORD pid) {
+		HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+		bool   fAlive;
+
+		if (h == NULL)
+			return GetLastError() != ERROR_INVALID_PARAMETER;		// no such process
+		fAlive = WaitForSingleObject(h, 0) == WAIT_TIMEOUT;
+		CloseHandle(h);
+		return fAlive;
+	}
+
+	void skip(UINT64 end) {
+		hdr_->reader[slot_].readPos.store(end, memory_order_release);
+		hdr_->reader[slot_].overruns.fetch_add(1, memory_order_relaxed);
+	}
+
+	HANDLE     hMap_, hEvent_;
+	ShmHeader *hdr_;
+	pcm_frame *ring_;
+	int        slot_;
+};
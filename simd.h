@@ -0,0 +1,738 @@
+/*
+ * simd.h -- Vectorized sample conversion and mixing primitives
+ *
+ * Every kernel has an SSE2 version and, where the wider registers pay off, AVX2 and AVX-512
+ * (F+BW) versions. The best set supported by the CPU and the operating system is selected
+ * on first use (simd()), a lower one can be forced with simdSelect() for testing.
+ *
+ * Float samples are in 16-bit units (full scale 32768). Conversions to integers round to the
+ * nearest, ties away from zero, and saturate, as the earlier scalar code did, so that the
+ * fixed-point blocks stay bit-exact on every instruction set. The reductions (absSum, energy)
+ * add in a different order on different instruction sets.
+ */
+
+#pragma once
+#include <windows.h>
+#include <intrin.h>
+#include <immintrin.h>
+#include "wavIO.h"
+
+using namespace std;
+
+#if defined(__GNUC__)
+#define SIMD_AVX2	__attribute__((target("avx2")))
+#define SIMD_AVX512	__attribute__((target("avx2,avx512f,avx512bw")))
+#else
+#define SIMD_AVX2
+#define SIMD_AVX512
+#endif
+
+#define SIMD_BLOCK	256		// chunk size for recursive per-sample code feeding the kernels
+
+
+enum simd_level {sse2_level, avx2_level, avx512_level};
+
+struct Sse2Kernels {
+	/* float -> int32, round to nearest with ties away from zero (|v| < 2^23) */
+	static inline __m128i roundAway(__m128 v) {
+		const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000)), half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f);
+		__m128i r = _mm_cvtps_epi32(v);											// ties to even
+		__m128  s = _mm_and_ps(v, sign);
+		__m128  m = _mm_cmpeq_ps(_mm_sub_ps(v, _mm_cvtepi32_ps(r)), _mm_or_ps(s, half));	// tie rounded towards zero
+
+		return _mm_add_epi32(r, _mm_and_si128(_mm_castps_si128(m), _mm_cvtps_epi32(_mm_or_ps(s, one))));
+	}
+
+	/* float -> int32 in the 16-bit range */
+	static inline __m128i round16(__m128 v) {
+		return roundAway(_mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-32768.0f)), _mm_set1_ps(32767.0f)));
+	}
+
+	static inline INT16 sat16(float x) {
+		return (INT16)_mm_cvtsi128_si32(round16(_mm_set_ss(x)));
+	}
+
+	static inline float hsum(__m128 a) {
+		a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+		return _mm_cvtss_f32(_mm_add_ss(a, _mm_shuffle_ps(a, a, 1)));
+	}
+
+	/* y = sat(a + b) */
+	static void q15Add(const INT16 *a, const INT16 *b, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8)
+			_mm_storeu_si128((__m128i *)&y[i], _mm_adds_epi16(_mm_loadu_si128((const __m128i *)&a[i]), _mm_loadu_si128((const __m128i *)&b[i])));
+		for (; i < n; i++)
+			y[i] = (INT16)_mm_cvtsi128_si32(_mm_adds_epi16(_mm_cvtsi32_si128(a[i]), _mm_cvtsi32_si128(b[i])));
+	}
+
+	/* y = sat(a*b >> 15) */
+	static void q15Mul(const INT16 *a, const INT16 *b, INT16 *y, size_t n) {
+		const __m128i min = _mm_set1_epi16(-32768);
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i *)&a[i]), c = _mm_loadu_si128((const __m128i *)&b[i]);
+			__m128i r = _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epi16(x, c), 1), _mm_srli_epi16(_mm_mullo_epi16(x, c), 15));
+
+			_mm_storeu_si128((__m128i *)&y[i], _mm_xor_si128(r, _mm_and_si128(_mm_cmpeq_epi16(x, min), _mm_cmpeq_epi16(c, min))));
+		}
+		for (; i < n; i++) {
+			INT32 p = ((INT32)a[i]*b[i]) >> 15;
+			y[i] = (INT16)(p > 32767 ? 32767 : p);
+		}
+	}
+
+	/* y = sat(a + b) */
+	static void q31Add(const INT32 *a, const INT32 *b, INT32 *y, size_t n) {
+		const __m128i max = _mm_set1_epi32(0x7FFFFFFF);
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4) {
+			__m128i x = _mm_loadu_si128((const __m128i *)&a[i]), c = _mm_loadu_si128((const __m128i *)&b[i]), s = _mm_add_epi32(x, c);
+			__m128i o = _mm_srai_epi32(_mm_andnot_si128(_mm_xor_si128(x, c), _mm_xor_si128(x, s)), 31);	// same signs in, other sign out
+			__m128i t = _mm_xor_si128(_mm_srai_epi32(x, 31), max);
+
+			_mm_storeu_si128((__m128i *)&y[i], _mm_or_si128(_mm_and_si128(o, t), _mm_andnot_si128(o, s)));
+		}
+		for (; i < n; i++) {
+			INT64 s = (INT64)a[i] + b[i];
+			y[i] = (INT32)(s > 0x7FFFFFFF ? 0x7FFFFFFF : (s < -0x7FFFFFFF-1 ? -0x7FFFFFFF-1 : s));
+		}
+	}
+
+	/* y = sat(a*b >> 31), SSE2 has no signed 32x32 -> 64 multiply */
+	static void q31Mul(const INT32 *a, const INT32 *b, INT32 *y, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			INT64 p = ((INT64)a[i]*b[i]) >> 31;
+			y[i] = (INT32)(p > 0x7FFFFFFF ? 0x7FFFFFFF : p);
+		}
+	}
+
+	/* y = sat(x) */
+	static void i32ToI16(const INT32 *x, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8)
+			_mm_storeu_si128((__m128i *)&y[i], _mm_packs_epi32(_mm_loadu_si128((const __m128i *)&x[i]), _mm_loadu_si128((const __m128i *)&x[i+4])));
+		for (; i < n; i++)
+			y[i] = (INT16)_mm_cvtsi128_si32(_mm_packs_epi32(_mm_cvtsi32_si128(x[i]), _mm_setzero_si128()));
+	}
+
+	static void f32ToI16(const float *x, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8)
+			_mm_storeu_si128((__m128i *)&y[i], _mm_packs_epi32(round16(_mm_loadu_ps(&x[i])), round16(_mm_loadu_ps(&x[i+4]))));
+		for (; i < n; i++)
+			y[i] = sat16(x[i]);
+	}
+
+	static void i16ToF32(const INT16 *x, float *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&x[i]);
+			_mm_storeu_ps(&y[i],   _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)));
+			_mm_storeu_ps(&y[i+4], _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)));
+		}
+		for (; i < n; i++)
+			y[i] = x[i];
+	}
+
+	/* float -> packed little-endian 24-bit samples (x 256) */
+	static void f32ToI24(const float *x, BYTE *y, size_t n) {
+		const __m128 lo = _mm_set1_ps(-8388608.0f), hi = _mm_set1_ps(8388607.0f), scale = _mm_set1_ps(256.0f);
+		INT32  t[4];
+		size_t i = 0;
+
+		for (; i < n; i += 4) {
+			size_t m = min(n - i, (size_t)4);
+			__m128 v = m == 4 ? _mm_loadu_ps(&x[i]) : _mm_setr_ps(x[i], m > 1 ? x[i+1] : 0.0f, m > 2 ? x[i+2] : 0.0f, 0.0f);
+
+			_mm_storeu_si128((__m128i *)t, roundAway(_mm_min_ps(_mm_max_ps(_mm_mul_ps(v, scale), lo), hi)));
+			for (size_t j = 0; j < m; j++, y += 3) {
+				y[0] = (BYTE)t[j]; y[1] = (BYTE)(t[j] >> 8); y[2] = (BYTE)(t[j] >> 16);
+			}
+		}
+	}
+
+	/* packed little-endian 24-bit samples -> float (/ 256) */
+	static void i24ToF32(const BYTE *x, float *y, size_t n) {
+		for (size_t i = 0; i < n; i++, x += 3)
+			y[i] = (float)((INT32)(((UINT32)x[0] << 8) | ((UINT32)x[1] << 16) | ((UINT32)x[2] << 24)) >> 8) * (1.0f/256.0f);
+	}
+
+	/* sum of |left + right| */
+	static float absSum(const pcm_frame *x, size_t n) {
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128  mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		__m128 acc = _mm_setzero_ps();
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4)
+			acc = _mm_add_ps(acc, _mm_and_ps(mask, _mm_cvtepi32_ps(_mm_madd_epi16(_mm_loadu_si128((const __m128i *)&x[i]), one))));
+		float s = hsum(acc);
+		for (; i < n; i++)
+			s += (float)abs(x[i].left + x[i].right);
+
+		return s;
+	}
+
+	/* all samples zero, checked 32 frames at a time so that a signal is found soon */
+	static bool isSilent(const pcm_frame *x, size_t n) {
+		size_t i = 0;
+
+		for (; i+32 <= n; i += 32) {
+			const __m128i *p = (const __m128i *)&x[i];
+			__m128i v = _mm_setzero_si128();
+
+			for (int j = 0; j < 8; j++)
+				v = _mm_or_si128(v, _mm_loadu_si128(&p[j]));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF)
+				return false;
+		}
+		for (; i < n; i++)
+			if (x[i].left != 0 || x[i].right != 0)
+				return false;
+
+		return true;
+	}
+
+	/* sum of x^2 */
+	static float energy(const float *x, size_t n) {
+		__m128 acc = _mm_setzero_ps();
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4) {
+			__m128 v = _mm_loadu_ps(&x[i]);
+			acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+		}
+		float s = hsum(acc);
+		for (; i < n; i++)
+			s += x[i]*x[i];
+
+		return s;
+	}
+
+	/* linear ramp y[i] = start + step*(k+i), the same value for a ramp index however the ramp is split */
+	static void rampFill(float *y, float start, float step, UINT32 k0, size_t n) {
+		__m128 k = _mm_add_ps(_mm_set1_ps((float)k0), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)), s = _mm_set1_ps(step), b = _mm_set1_ps(start);
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4) {
+			_mm_storeu_ps(&y[i], _mm_add_ps(b, _mm_mul_ps(s, k)));
+			k = _mm_add_ps(k, _mm_set1_ps(4.0f));
+		}
+		for (; i < n; i++)
+			y[i] = start + step*(float)(k0+i);
+	}
+
+	/* y = sat(g*x), gain per frame */
+	static void applyGain(const pcm_frame *x, const float *g, pcm_frame *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&x[i]);
+			__m128  a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+			__m128  k = _mm_loadu_ps(&g[i]);
+
+			_mm_storeu_si128((__m128i *)&y[i], _mm_packs_epi32(round16(_mm_mul_ps(_mm_unpacklo_ps(k, k), a)), round16(_mm_mul_ps(_mm_unpackhi_ps(k, k), b))));
+		}
+		for (; i < n; i++) {
+			y[i].left  = sat16(g[i]*x[i].left);
+			y[i].right = sat16(g[i]*x[i].right);
+		}
+	}
+
+	/* y = sat(t*a + (1-t)*b), weight per frame */
+	static void xfade(const pcm_frame *a, const pcm_frame *b, const float *t, pcm_frame *y, size_t n) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4) {
+			__m128i u = _mm_loadu_si128((const __m128i *)&a[i]), v = _mm_loadu_si128((const __m128i *)&b[i]);
+			__m128  k = _mm_loadu_ps(&t[i]), k0 = _mm_unpacklo_ps(k, k), k1 = _mm_unpackhi_ps(k, k);
+			__m128  a0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(u, u), 16)), a1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(u, u), 16));
+			__m128  b0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), b1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+
+			_mm_storeu_si128((__m128i *)&y[i], _mm_packs_epi32(round16(_mm_add_ps(_mm_mul_ps(k0, a0), _mm_mul_ps(_mm_sub_ps(one, k0), b0))),
+															  round16(_mm_add_ps(_mm_mul_ps(k1, a1), _mm_mul_ps(_mm_sub_ps(one, k1), b1)))));
+		}
+		for (; i < n; i++) {
+			y[i].left  = sat16(t[i]*a[i].left  + (1.0f-t[i])*b[i].left);
+			y[i].right = sat16(t[i]*a[i].right + (1.0f-t[i])*b[i].right);
+		}
+	}
+
+	/* planar -> stereo frames (l == r gives the same sample on both channels) */
+	static void interleave(const INT16 *l, const INT16 *r, pcm_frame *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m128i a = _mm_loadu_si128((const __m128i *)&l[i]), b = _mm_loadu_si128((const __m128i *)&r[i]);
+			_mm_storeu_si128((__m128i *)&y[i],   _mm_unpacklo_epi16(a, b));
+			_mm_storeu_si128((__m128i *)&y[i+4], _mm_unpackhi_epi16(a, b));
+		}
+		for (; i < n; i++) {
+			y[i].left  = l[i];
+			y[i].right = r[i];
+		}
+	}
+
+	static void deinterleave(const pcm_frame *x, INT16 *l, INT16 *r, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m128i a = _mm_loadu_si128((const __m128i *)&x[i]), b = _mm_loadu_si128((const __m128i *)&x[i+4]);
+			_mm_storeu_si128((__m128i *)&l[i], _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16)));
+			_mm_storeu_si128((__m128i *)&r[i], _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+		}
+		for (; i < n; i++) {
+			l[i] = x[i].left;
+			r[i] = x[i].right;
+		}
+	}
+
+	/* planar float -> stereo frames (l == r gives the same sample on both channels) */
+	static void f32ToPcm(const float *l, const float *r, pcm_frame *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4) {
+			__m128i a = round16(_mm_loadu_ps(&l[i])), b = round16(_mm_loadu_ps(&r[i]));
+			_mm_storeu_si128((__m128i *)&y[i], _mm_packs_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b)));
+		}
+		for (; i < n; i++) {
+			y[i].left  = sat16(l[i]);
+			y[i].right = sat16(r[i]);
+		}
+	}
+
+	static void pcmToF32(const pcm_frame *x, float *l, float *r, size_t n) {
+		size_t i = 0;
+
+		for (; i+4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&x[i]);
+			_mm_storeu_ps(&l[i], _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16)));
+			_mm_storeu_ps(&r[i], _mm_cvtepi32_ps(_mm_srai_epi32(v, 16)));
+		}
+		for (; i < n; i++) {
+			l[i] = x[i].left;
+			r[i] = x[i].right;
+		}
+	}
+};
+
+
+struct Avx2Kernels {
+	static inline SIMD_AVX2 __m256i roundAway(__m256 v) {
+		const __m256 sign = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000)), half = _mm256_set1_ps(0.5f), one = _mm256_set1_ps(1.0f);
+		__m256i r = _mm256_cvtps_epi32(v);
+		__m256  s = _mm256_and_ps(v, sign);
+		__m256  m = _mm256_cmp_ps(_mm256_sub_ps(v, _mm256_cvtepi32_ps(r)), _mm256_or_ps(s, half), _CMP_EQ_OQ);
+
+		return _mm256_add_epi32(r, _mm256_and_si256(_mm256_castps_si256(m), _mm256_cvtps_epi32(_mm256_or_ps(s, one))));
+	}
+
+	static inline SIMD_AVX2 __m256i round16(__m256 v) {
+		return roundAway(_mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-32768.0f)), _mm256_set1_ps(32767.0f)));
+	}
+
+	/* 16-bit stereo frames -> float, frames 0..3 and 4..7 of the register */
+	static inline SIMD_AVX2 __m256 lo(__m256i v) { return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v))); }
+	static inline SIMD_AVX2 __m256 hi(__m256i v) { return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1))); }
+
+	/* pack two vectors of interleaved frames 0..3 and 4..7 back to frames 0..7 */
+	static inline SIMD_AVX2 __m256i pack(__m256i a, __m256i b) {
+		return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+	}
+
+	static SIMD_AVX2 void q15Add(const INT16 *a, const INT16 *b, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16)
+			_mm256_storeu_si256((__m256i *)&y[i], _mm256_adds_epi16(_mm256_loadu_si256((const __m256i *)&a[i]), _mm256_loadu_si256((const __m256i *)&b[i])));
+		Sse2Kernels::q15Add(&a[i], &b[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void q15Mul(const INT16 *a, const INT16 *b, INT16 *y, size_t n) {
+		const __m256i min = _mm256_set1_epi16(-32768);
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)&a[i]), c = _mm256_loadu_si256((const __m256i *)&b[i]);
+			__m256i r = _mm256_or_si256(_mm256_slli_epi16(_mm256_mulhi_epi16(x, c), 1), _mm256_srli_epi16(_mm256_mullo_epi16(x, c), 15));
+
+			_mm256_storeu_si256((__m256i *)&y[i], _mm256_xor_si256(r, _mm256_and_si256(_mm256_cmpeq_epi16(x, min), _mm256_cmpeq_epi16(c, min))));
+		}
+		Sse2Kernels::q15Mul(&a[i], &b[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void q31Add(const INT32 *a, const INT32 *b, INT32 *y, size_t n) {
+		const __m256i max = _mm256_set1_epi32(0x7FFFFFFF);
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)&a[i]), c = _mm256_loadu_si256((const __m256i *)&b[i]), s = _mm256_add_epi32(x, c);
+			__m256i o = _mm256_srai_epi32(_mm256_andnot_si256(_mm256_xor_si256(x, c), _mm256_xor_si256(x, s)), 31);
+			__m256i t = _mm256_xor_si256(_mm256_srai_epi32(x, 31), max);
+
+			_mm256_storeu_si256((__m256i *)&y[i], _mm256_blendv_epi8(s, t, o));
+		}
+		Sse2Kernels::q31Add(&a[i], &b[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void q31Mul(const INT32 *a, const INT32 *b, INT32 *y, size_t n) {
+		const __m256i min = _mm256_set1_epi32(0x80000000);
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)&a[i]), c = _mm256_loadu_si256((const __m256i *)&b[i]);
+			__m256i e = _mm256_srli_epi64(_mm256_mul_epi32(x, c), 31);								// even lanes, bits 31..62 of the product
+			__m256i o = _mm256_slli_epi64(_mm256_srli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(c, 32)), 31), 32);
+			__m256i r = _mm256_blend_epi32(e, o, 0xAA);
+
+			_mm256_storeu_si256((__m256i *)&y[i], _mm256_xor_si256(r, _mm256_and_si256(_mm256_cmpeq_epi32(x, min), _mm256_cmpeq_epi32(c, min))));
+		}
+		Sse2Kernels::q31Mul(&a[i], &b[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void i32ToI16(const INT32 *x, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16)
+			_mm256_storeu_si256((__m256i *)&y[i], pack(_mm256_loadu_si256((const __m256i *)&x[i]), _mm256_loadu_si256((const __m256i *)&x[i+8])));
+		Sse2Kernels::i32ToI16(&x[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void f32ToI16(const float *x, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16)
+			_mm256_storeu_si256((__m256i *)&y[i], pack(round16(_mm256_loadu_ps(&x[i])), round16(_mm256_loadu_ps(&x[i+8]))));
+		Sse2Kernels::f32ToI16(&x[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void i16ToF32(const INT16 *x, float *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8)
+			_mm256_storeu_ps(&y[i], _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&x[i]))));
+		Sse2Kernels::i16ToF32(&x[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 float absSum(const pcm_frame *x, size_t n) {
+		const __m256i one = _mm256_set1_epi16(1);
+		const __m256  mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+		__m256 acc = _mm256_setzero_ps();
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8)
+			acc = _mm256_add_ps(acc, _mm256_and_ps(mask, _mm256_cvtepi32_ps(_mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)&x[i]), one))));
+
+		return Sse2Kernels::hsum(_mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1))) + Sse2Kernels::absSum(&x[i], n - i);
+	}
+
+	static SIMD_AVX2 bool isSilent(const pcm_frame *x, size_t n) {
+		size_t i = 0;
+
+		for (; i+32 <= n; i += 32) {
+			const __m256i *p = (const __m256i *)&x[i];
+			__m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(&p[0]), _mm256_loadu_si256(&p[1])),
+										_mm256_or_si256(_mm256_loadu_si256(&p[2]), _mm256_loadu_si256(&p[3])));
+			if (!_mm256_testz_si256(v, v))
+				return false;
+		}
+
+		return Sse2Kernels::isSilent(&x[i], n - i);
+	}
+
+	static SIMD_AVX2 float energy(const float *x, size_t n) {
+		__m256 acc = _mm256_setzero_ps();
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m256 v = _mm256_loadu_ps(&x[i]);
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(v, v));
+		}
+
+		return Sse2Kernels::hsum(_mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1))) + Sse2Kernels::energy(&x[i], n - i);
+	}
+
+	static SIMD_AVX2 void rampFill(float *y, float start, float step, UINT32 k0, size_t n) {
+		__m256 k = _mm256_add_ps(_mm256_set1_ps((float)k0), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f)), s = _mm256_set1_ps(step), b = _mm256_set1_ps(start);
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			_mm256_storeu_ps(&y[i], _mm256_add_ps(b, _mm256_mul_ps(s, k)));
+			k = _mm256_add_ps(k, _mm256_set1_ps(8.0f));
+		}
+		for (; i < n; i++)
+			y[i] = start + step*(float)(k0+i);
+	}
+
+	static SIMD_AVX2 void applyGain(const pcm_frame *x, const float *g, pcm_frame *y, size_t n) {
+		const __m256i i0 = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3), i1 = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)&x[i]);
+			__m256  k = _mm256_loadu_ps(&g[i]);
+
+			_mm256_storeu_si256((__m256i *)&y[i], pack(round16(_mm256_mul_ps(_mm256_permutevar8x32_ps(k, i0), lo(v))),
+													   round16(_mm256_mul_ps(_mm256_permutevar8x32_ps(k, i1), hi(v)))));
+		}
+		Sse2Kernels::applyGain(&x[i], &g[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void xfade(const pcm_frame *a, const pcm_frame *b, const float *t, pcm_frame *y, size_t n) {
+		const __m256i i0 = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3), i1 = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+		const __m256  one = _mm256_set1_ps(1.0f);
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m256i u = _mm256_loadu_si256((const __m256i *)&a[i]), v = _mm256_loadu_si256((const __m256i *)&b[i]);
+			__m256  k = _mm256_loadu_ps(&t[i]), k0 = _mm256_permutevar8x32_ps(k, i0), k1 = _mm256_permutevar8x32_ps(k, i1);
+
+			_mm256_storeu_si256((__m256i *)&y[i], pack(round16(_mm256_add_ps(_mm256_mul_ps(k0, lo(u)), _mm256_mul_ps(_mm256_sub_ps(one, k0), lo(v)))),
+													   round16(_mm256_add_ps(_mm256_mul_ps(k1, hi(u)), _mm256_mul_ps(_mm256_sub_ps(one, k1), hi(v))))));
+		}
+		Sse2Kernels::xfade(&a[i], &b[i], &t[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void f32ToPcm(const float *l, const float *r, pcm_frame *y, size_t n) {
+		size_t i = 0;
+
+		// unpack and pack both work within the 128-bit lanes, so the frames come out in order
+		for (; i+8 <= n; i += 8) {
+			__m256i a = round16(_mm256_loadu_ps(&l[i])), b = round16(_mm256_loadu_ps(&r[i]));
+			_mm256_storeu_si256((__m256i *)&y[i], _mm256_packs_epi32(_mm256_unpacklo_epi32(a, b), _mm256_unpackhi_epi32(a, b)));
+		}
+		Sse2Kernels::f32ToPcm(&l[i], &r[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX2 void pcmToF32(const pcm_frame *x, float *l, float *r, size_t n) {
+		size_t i = 0;
+
+		for (; i+8 <= n; i += 8) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)&x[i]);
+			_mm256_storeu_ps(&l[i], _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16)));
+			_mm256_storeu_ps(&r[i], _mm256_cvtepi32_ps(_mm256_srai_epi32(v, 16)));
+		}
+		Sse2Kernels::pcmToF32(&x[i], &l[i], &r[i], n - i);
+	}
+};
+
+
+struct Avx512Kernels {
+	static inline SIMD_AVX512 __m512i round16(__m512 v) {
+		const __m512i sign = _mm512_set1_epi32(0x80000000), half = _mm512_castps_si512(_mm512_set1_ps(0.5f)), one = _mm512_castps_si512(_mm512_set1_ps(1.0f));
+
+		v = _mm512_min_ps(_mm512_max_ps(v, _mm512_set1_ps(-32768.0f)), _mm512_set1_ps(32767.0f));
+		__m512i r = _mm512_cvtps_epi32(v);
+		__m512i s = _mm512_and_si512(_mm512_castps_si512(v), sign);
+		__mmask16 m = _mm512_cmp_ps_mask(_mm512_sub_ps(v, _mm512_cvtepi32_ps(r)), _mm512_castsi512_ps(_mm512_or_si512(s, half)), _CMP_EQ_OQ);
+
+		return _mm512_mask_add_epi32(r, m, r, _mm512_cvtps_epi32(_mm512_castsi512_ps(_mm512_or_si512(s, one))));
+	}
+
+	static SIMD_AVX512 void q15Add(const INT16 *a, const INT16 *b, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+32 <= n; i += 32)
+			_mm512_storeu_si512(&y[i], _mm512_adds_epi16(_mm512_loadu_si512(&a[i]), _mm512_loadu_si512(&b[i])));
+		Avx2Kernels::q15Add(&a[i], &b[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX512 void f32ToI16(const float *x, INT16 *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16)
+			_mm256_storeu_si256((__m256i *)&y[i], _mm512_cvtsepi32_epi16(round16(_mm512_loadu_ps(&x[i]))));
+		Avx2Kernels::f32ToI16(&x[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX512 void i16ToF32(const INT16 *x, float *y, size_t n) {
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16)
+			_mm512_storeu_ps(&y[i], _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)&x[i]))));
+		Avx2Kernels::i16ToF32(&x[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX512 float absSum(const pcm_frame *x, size_t n) {
+		const __m512i mask = _mm512_set1_epi32(0x7FFFFFFF);
+		__m512 acc = _mm512_setzero_ps();
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16) {
+			__m512i v = _mm512_loadu_si512(&x[i]);
+			__m512  s = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_srai_epi32(_mm512_slli_epi32(v, 16), 16), _mm512_srai_epi32(v, 16)));
+			acc = _mm512_add_ps(acc, _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(s), mask)));
+		}
+
+		return _mm512_reduce_add_ps(acc) + Avx2Kernels::absSum(&x[i], n - i);
+	}
+
+	static SIMD_AVX512 bool isSilent(const pcm_frame *x, size_t n) {
+		size_t i = 0;
+
+		for (; i+32 <= n; i += 32) {
+			__m512i v = _mm512_or_si512(_mm512_loadu_si512(&x[i]), _mm512_loadu_si512(&x[i+16]));
+			if (_mm512_test_epi32_mask(v, v) != 0)
+				return false;
+		}
+
+		return Avx2Kernels::isSilent(&x[i], n - i);
+	}
+
+	static SIMD_AVX512 float energy(const float *x, size_t n) {
+		__m512 acc = _mm512_setzero_ps();
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16) {
+			__m512 v = _mm512_loadu_ps(&x[i]);
+			acc = _mm512_add_ps(acc, _mm512_mul_ps(v, v));
+		}
+
+		return _mm512_reduce_add_ps(acc) + Avx2Kernels::energy(&x[i], n - i);
+	}
+
+	static SIMD_AVX512 void f32ToPcm(const float *l, const float *r, pcm_frame *y, size_t n) {
+		const __m512i mask = _mm512_set1_epi32(0xFFFF);
+		size_t i = 0;
+
+		// the rounded values are in the 16-bit range, so a frame is (right << 16) | left
+		for (; i+16 <= n; i += 16) {
+			__m512i a = round16(_mm512_loadu_ps(&l[i])), b = round16(_mm512_loadu_ps(&r[i]));
+			_mm512_storeu_si512(&y[i], _mm512_or_si512(_mm512_slli_epi32(b, 16), _mm512_and_si512(a, mask)));
+		}
+		Avx2Kernels::f32ToPcm(&l[i], &r[i], &y[i], n - i);
+	}
+
+	static SIMD_AVX512 void pcmToF32(const pcm_frame *x, float *l, float *r, size_t n) {
+		size_t i = 0;
+
+		for (; i+16 <= n; i += 16) {
+			__m512i v = _mm512_loadu_si512(&x[i]);
+			_mm512_storeu_ps(&l[i], _mm512_cvtepi32_ps(_mm512_srai_epi32(_mm512_slli_epi32(v, 16), 16)));
+			_mm512_storeu_ps(&r[i], _mm512_cvtepi32_ps(_mm512_srai_epi32(v, 16)));
+		}
+		Avx2Kernels::pcmToF32(&x[i], &l[i], &r[i], n - i);
+	}
+};
+
+
+/* kernel table of one instruction set */
+struct SimdKernels {
+	const char *name;
+	void  (*q15Add)(const INT16 *a, const INT16 *b, INT16 *y, size_t n);
+	void  (*q15Mul)(const INT16 *a, const INT16 *b, INT16 *y, size_t n);
+	void  (*q31Add)(const INT32 *a, const INT32 *b, INT32 *y, size_t n);
+	void  (*q31Mul)(const INT32 *a, const INT32 *b, INT32 *y, size_t n);
+	void  (*i32ToI16)(const INT32 *x, INT16 *y, size_t n);
+	void  (*f32ToI16)(const float *x, INT16 *y, size_t n);
+	void  (*i16ToF32)(const INT16 *x, float *y, size_t n);
+	void  (*f32ToI24)(const float *x, BYTE *y, size_t n);
+	void  (*i24ToF32)(const BYTE *x, float *y, size_t n);
+	float (*absSum)(const pcm_frame *x, size_t n);
+	float (*energy)(const float *x, size_t n);
+	void  (*rampFill)(float *y, float start, float step, UINT32 k0, size_t n);
+	void  (*applyGain)(const pcm_frame *x, const float *g, pcm_frame *y, size_t n);
+	void  (*xfade)(const pcm_frame *a, const pcm_frame *b, const float *t, pcm_frame *y, size_t n);
+	void  (*interleave)(const INT16 *l, const INT16 *r, pcm_frame *y, size_t n);
+	void  (*deinterleave)(const pcm_frame *x, INT16 *l, INT16 *r, size_t n);
+	void  (*f32ToPcm)(const float *l, const float *r, pcm_frame *y, size_t n);
+	void  (*pcmToF32)(const pcm_frame *x, float *l, float *r, size_t n);
+	bool  (*isSilent)(const pcm_frame *x, size_t n);
+};
+
+inline const SimdKernels &simdKernels(simd_level level) {
+	static const SimdKernels k[] = {
+		{ "SSE2", Sse2Kernels::q15Add, Sse2Kernels::q15Mul, Sse2Kernels::q31Add, Sse2Kernels::q31Mul, Sse2Kernels::i32ToI16,
+		  Sse2Kernels::f32ToI16, Sse2Kernels::i16ToF32, Sse2Kernels::f32ToI24, Sse2Kernels::i24ToF32, Sse2Kernels::absSum,
+		  Sse2Kernels::energy, Sse2Kernels::rampFill, Sse2Kernels::applyGain, Sse2Kernels::xfade, Sse2Kernels::interleave,
+		  Sse2Kernels::deinterleave, Sse2Kernels::f32ToPcm, Sse2Kernels::pcmToF32, Sse2Kernels::isSilent },
+		{ "AVX2", Avx2Kernels::q15Add, Avx2Kernels::q15Mul, Avx2Kernels::q31Add, Avx2Kernels::q31Mul, Avx2Kernels::i32ToI16,
+		  Avx2Kernels::f32ToI16, Avx2Kernels::i16ToF32, Sse2Kernels::f32ToI24, Sse2Kernels::i24ToF32, Avx2Kernels::absSum,
+		  Avx2Kernels::energy, Avx2Kernels::rampFill, Avx2Kernels::applyGain, Avx2Kernels::xfade, Sse2Kernels::interleave,
+		  Sse2Kernels::deinterleave, Avx2Kernels::f32ToPcm, Avx2Kernels::pcmToF32, Avx2Kernels::isSilent },
+		{ "AVX-512", Avx512Kernels::q15Add, Avx2Kernels::q15Mul, Avx2Kernels::q31Add, Avx2Kernels::q31Mul, Avx2Kernels::i32ToI16,
+		  Avx512Kernels::f32ToI16, Avx512Kernels::i16ToF32, Sse2Kernels::f32ToI24, Sse2Kernels::i24ToF32, Avx512Kernels::absSum,
+		  Avx512Kernels::energy, Avx2Kernels::rampFill, Avx2Kernels::applyGain, Avx2Kernels::xfade, Sse2Kernels::interleave,
+		  Sse2Kernels::deinterleave, Avx512Kernels::f32ToPcm, Avx512Kernels::pcmToF32, Avx512Kernels::isSilent }
+	};
+
+	return k[level];
+}
+
+/* best instruction set supported by the CPU and enabled by the operating system */
+inline simd_level simdSupported() {
+	static const simd_level level = []() {
+		int r[4];
+
+		__cpuid(r, 0);
+		int leaves = r[0];
+		__cpuid(r, 1);
+		if (leaves < 7 || !(r[2] & (1 << 27)) || !(r[2] & (1 << 28)))		// OSXSAVE and AVX
+			return sse2_level;
+
+		unsigned long long xcr0 = _xgetbv(0);
+		if ((xcr0 & 0x06) != 0x06)											// XMM and YMM state
+			return sse2_level;
+
+		__cpuidex(r, 7, 0);
+		if ((r[1] & (1 << 16)) && (r[1] & (1 << 30)) && (xcr0 & 0xE0) == 0xE0)	// AVX512F, AVX512BW, opmask and ZMM state
+			return avx512_level;
+		return (r[1] & (1 << 5)) ? avx2_level : sse2_level;
+	}();
+
+	return level;
+}
+
+inline const SimdKernels *&simdCurrent() {
+	static const SimdKernels *k = &simdKernels(simdSupported());
+
+	return k;
+}
+
+/* kernels of the selected instruction set */
+inline const SimdKernels &simd() {
+	return *simdCurrent();
+}
+
+/* instruction set of the selected kernels */
+inline simd_level simdLevel() {
+	for (int level = sse2_level; level < avx512_level; level++)
+		if (simdCurrent() == &simdKernels((simd_level)level))
+			return (simd_level)level;
+
+	return avx512_level;
+}
+
+/* use the given instruction set (not above the supported one), call before the processing starts */
+inline bool simdSelect(simd_level level) {
+	if (level > simdSupported())
+		return false;
+	simdCurrent() = &simdKernels(level);
+
+	return true;
+}
+
+/* scalar conversions with the same rounding and saturation, for per-sample code in recursive filters */
+inline INT16 sat16(INT32 x) {
+	return (INT16)_mm_cvtsi128_si32(_mm_packs_epi32(_mm_cvtsi32_si128(x), _mm_setzero_si128()));
+}
+
+inline INT16 sat16(float x) {
+	return Sse2Kernels::sat16(x);
+}
+
+inline INT16 sat16(double x) {
+	__m128d v = _mm_min_sd(_mm_max_sd(_mm_set_sd(x), _mm_set_sd(-32768.0)), _mm_set_sd(32767.0));
+	int     r = _mm_cvtsd_si32(v);								// ties to even
+	double  d = _mm_cvtsd_f64(v) - r;
+
+	return (INT16)(r + (d == 0.5 && x > 0.0) - (d == -0.5 && x < 0.0));
+}
@@ -0,0 +1,154 @@
+/*
+ * spectral.h -- Spectral processing nodes on top of the STFT framework
+ *
+ * NoiseSuppressor  Wiener-like suppression with a minimum tracking noise estimate
+ * SpectralGate     per-bin noise gate with instant opening and a timed release
+ * SpectralEq       equalizer given as a gain per frequency band, interpolated to a per-bin mask
+ */
+
+#pragma once
+#include <windows.h>
+#include <math.h>
+#include "cirbuffer.h"
+#include "stft.h"
+
+using namespace std;
+
+
+class NoiseSuppressor: public Stft {
+public:
+	/* reduction is the maximum attenuation of the noise (in dB) */
+	NoiseSuppressor(float reduction = 12.0f, UINT32 size = STFT_SIZE): Stft(size) {
+		floor_ = powf(10.0f, -reduction/20.0f);
+		rise_  = powf(10.0f, 0.5f*H/FS);				// noise estimate may rise by 5 dB/s
+		p_     = new float[K]; ps_ = new float[K]; noise_ = new float[K]; g_ = new float[K];
+		clear();
+	}
+
+	~NoiseSuppressor() {
+		delete [] p_; delete [] ps_; delete [] noise_; delete [] g_;
+	}
+
+	void reset() {
+		Stft::reset();
+		clear();
+	}
+
+	const char *name() const { return "denoise"; }
+
+protected:
+	void spectral(cfloat *X, UINT32 bins) {
+		cpower(X, p_, bins);
+
+		for (UINT32 k = 0; k < bins; k++) {
+			// smoothed power and its slowly rising minimum as the noise estimate
+			ps_[k]    = fFirst_ ? p_[k] : 0.9f*ps_[k] + 0.1f*p_[k];
+			noise_[k] = min(ps_[k], noise_[k]*rise_ + 1.0f);
+
+			// over-subtraction by 4 compensates the bias of the minimum, smoothed to reduce musical noise
+			float g = max(1.0f - 4.0f*noise_[k]/(ps_[k] + 1e-9f), floor_);
+			g_[k] = 0.5f*g_[k] + 0.5f*g;
+		}
+		fFirst_ = false;
+		cscale(X, g_, bins);
+	}
+
+private:
+	void clear() {
+		fFirst_ = true;
+		for (UINT32 k = 0; k < K; k++) {
+			ps_[k]    = 0.0f;
+			noise_[k] = 1e30f;
+			g_[k]     = 1.0f;
+		}
+	}
+
+	bool   fFirst_;
+	float  floor_, rise_;
+	float *p_, *ps_, *noise_, *g_;
+};
+
+
+class SpectralGate: public Stft {
+public:
+	/* threshold is the bin level (dBFS) that opens the gate, range the attenuation of a closed bin (dB),
+	   release the time to close completely (in s) */
+	SpectralGate(float threshold = -60.0f, float range = 40.0f, float release = 0.1f, UINT32 size = STFT_SIZE): Stft(size) {
+		float full = 32768.0f*N/(float)M_PI;			// bin magnitude of a full scale sine with the sqrt(Hann) window
+
+		thr_   = full*full*powf(10.0f, threshold/10.0f);
+		floor_ = powf(10.0f, -range/20.0f);
+		rel_   = powf(floor_, (float)H/(release*FS));
+		p_     = new float[K]; g_ = new float[K];
+		clear();
+	}
+
+	~SpectralGate() {
+		delete [] p_; delete [] g_;
+	}
+
+	void reset() {
+		Stft::reset();
+		clear();
+	}
+
+	const char *name() const { return "gate"; }
+
+protected:
+	void spectral(cfloat *X, UINT32 bins) {
+		cpower(X, p_, bins);
+
+		for (UINT32 k = 0; k < bins; k++)
+			g_[k] = p_[k] > thr_ ? 1.0f : max(floor_, g_[k]*rel_);
+		cscale(X, g_, bins);
+	}
+
+private:
+	void clear() {
+		for (UINT32 k = 0; k < K; k++)
+			g_[k] = floor_;
+	}
+
+	float  thr_, floor_, rel_;
+	float *p_, *g_;
+};
+
+
+class SpectralEq: public Stft {
+public:
+	/* gains (dB) at the given band center frequencies (Hz, ascending), interpolated on a log frequency scale */
+	SpectralEq(const float *freqs, const float *gains, UINT32 bands, UINT32 size = STFT_SIZE): Stft(size) {
+		mask_ = new float[K];
+
+		for (UINT32 k = 0; k < K; k++) {
+			float f = max((float)k*FS/N, freqs[0]), db;
+			UINT32 b = 0;
+
+			while (b+1 < bands && freqs[b+1] < f) b++;
+			if (b+1 >= bands)
+				db = gains[bands-1];
+			else
+				db = gains[b] + (gains[b+1] - gains[b]) * logf(f/freqs[b]) / logf(freqs[b+1]/freqs[b]);
+			mask_[k] = powf(10.0f, db/20.0f);
+		}
+	}
+
+	~SpectralEq() {
+		delete [] mask_;
+	}
+
+	/* replace the mask with the given linear gain per bin (size/2+1 values) */
+	void setMask(const float *mask) {
+		memcpy(mask_, mask, K*sizeof(float));
+	}
+
+	const char *name() const { return "eq"; }
+
+protected:
+	void spectral(cfloat *X, UINT32 bins) {
+		cscale(X, mask_, bins);
+	}
+
+private:
+	float *mask_;
+};
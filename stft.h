@@ -0,0 +1,107 @@
+/*
+ * stft.h -- Streaming short-time Fourier transform framework
+ *
+ * Weighted overlap-add analysis and resynthesis with a square root Hann window on both
+ * sides. The input is re-blocked internally, so the host may call process() with any
+ * number of frames; a frame is transformed every hop and handed to spectral(), which the
+ * spectral processing nodes override. All buffers are allocated at construction.
+ *
+ * The latency is one frame length (the last hop of a frame is final only after the
+ * frame has been added).
+ */
+
+#pragma once
+#include <windows.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "node.h"
+#include "fft.h"
+
+using namespace std;
+
+#define STFT_SIZE		1024	// default frame length (in samples)
+#define STFT_OVERLAP	4		// default number of frames overlapping a sample
+
+
+class Stft: public DspNode {
+public:
+	/* size is the frame length (power of two), overlap the frame length divided by the hop size (2, 4, 8..) */
+	Stft(UINT32 size = STFT_SIZE, UINT32 overlap = STFT_OVERLAP): N(size), H(size/overlap), K(size/2+1), fft_(size) {
+		in_  = alloc(N); out_ = alloc(N); t_ = alloc(N);
+		wa_  = alloc(N); ws_  = alloc(N);
+		X_   = (cfloat *)_aligned_malloc(K*sizeof(cfloat), 16);
+
+		// periodic sqrt(Hann) analysis and synthesis windows, the overlapped Hann windows sum to N/(2H)
+		for (UINT32 n = 0; n < N; n++) {
+			wa_[n] = (float)sqrt(0.5 - 0.5*cos(2.0*M_PI*n/N));
+			ws_[n] = wa_[n] * 2.0f*H/N;
+		}
+		reset();
+	}
+
+	virtual ~Stft() {
+		_aligned_free(in_); _aligned_free(out_); _aligned_free(t_);
+		_aligned_free(wa_); _aligned_free(ws_);
+		_aligned_free(X_);
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			// up to the end of the current hop
+			n = min(samples - i, H - pos_);
+
+			float *x = &in_[N-H+pos_], *y = &out_[pos_];
+			for (UINT32 j = 0; j < n; j++)
+				x[j] = input[i+j].left;
+			simd().f32ToPcm(y, y, &output[i], n);
+
+			if ((pos_ += n) == H) {
+				frame();
+				pos_ = 0;
+			}
+		}
+	}
+
+	void reset() {
+		memset(in_, 0, N*sizeof(float));
+		memset(out_, 0, N*sizeof(float));
+		pos_ = 0;
+	}
+
+	UINT32 latency() const { return N; }
+
+protected:
+	/* modify the spectrum X[0..bins-1] of the current frame in place */
+	virtual void spectral(cfloat *X, UINT32 bins) = 0;
+
+	UINT32 N, H, K;			// frame length, hop size, number of bins
+
+private:
+	static float *alloc(UINT32 n) {
+		return (float *)_aligned_malloc(n*sizeof(float), 16);
+	}
+
+	/* analysis, spectral processing, resynthesis and overlap-add of the newest frame */
+	void frame() {
+		vmul(in_, wa_, t_, N);
+		fft_.forward(t_, X_);
+		spectral(X_, K);
+		fft_.inverse(X_, t_);
+
+		memmove(out_, &out_[H], (N-H)*sizeof(float));
+		memset(&out_[N-H], 0, H*sizeof(float));
+		for (UINT32 n = 0; n < N; n += 4)
+			_mm_store_ps(&out_[n], _mm_add_ps(_mm_load_ps(&out_[n]), _mm_mul_ps(_mm_load_ps(&t_[n]), _mm_load_ps(&ws_[n]))));
+
+		memmove(in_, &in_[H], (N-H)*sizeof(float));
+	}
+
+	RealFft fft_;
+	float  *in_, *out_, *t_;	// last N input samples, overlap-add accumulator, frame buffer
+	float  *wa_, *ws_;			// analysis and synthesis windows
+	cfloat *X_;
+	UINT32  pos_;				// position within the current hop
+};
@@ -0,0 +1,166 @@
+/*
+ * swap.h -- Processing chain which can be replaced while the audio is running
+ *
+ * A new chain is built and allocated on some other thread and published with one atomic
+ * pointer exchange. The audio thread takes it into use at the start of its next block and
+ * crossfades from the old chain to the new one over a given number of blocks, after which
+ * the old chain is handed back through a queue and deleted on a non real time thread by
+ * collect(). The audio thread itself never allocates, frees or waits.
+ */
+
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include "wavIO.h"
+#include "simd.h"
+#include "node.h"
+#include "params.h"
+
+using namespace std;
+
+#define SWAP_FADE		8		// default crossfade length (in blocks)
+#define SWAP_RETIRED	8		// old chains waiting to be deleted (power of two)
+
+
+class SwapNode: public DspNode {
+public:
+	SwapNode(UINT32 fadeBlocks = SWAP_FADE, UINT32 maxFrames = 4096):
+	  cur_(NULL), old_(NULL), next_(NULL), retiring_(NULL), published_(0), done_(0), fFading_(false), fRun_(false), fadeLen_(fadeBlocks), fade_(fadeBlocks), fadePos_(0), maxFrames_(maxFrames), latency_(0) {
+		scratch_ = new pcm_frame[maxFrames];
+		ramp_    = new float[maxFrames];
+	}
+
+	/* the audio thread must have been stopped */
+	~SwapNode() {
+		collect();
+		delete next_.exchange(NULL);
+		delete retiring_;
+		delete old_;
+		delete cur_;
+		delete [] scratch_;
+		delete [] ramp_;
+	}
+
+	/* control thread: hands the chain over to the node (which deletes it when done), the new
+	   chain is started at the next block boundary after a possible ongoing crossfade */
+	void publish(DspNode *chain) {
+		latency_.store(chain != NULL ? chain->latency() : 0, memory_order_relaxed);
+		published_.fetch_add(1, memory_order_relaxed);
+
+		// a chain published earlier but not yet taken by the audio thread is never used
+		DspNode *p = next_.exchange(chain, memory_order_acq_rel);
+		if (p != NULL) {
+			delete p;
+			done_.fetch_add(1, memory_order_release);
+		}
+	}
+
+	/* control thread (one at a time): deletes the chains the audio thread has finished with, returns their number */
+	int collect() {
+		DspNode *p;
+		int      n = 0;
+
+		while (retired_.pop(p)) {
+			delete p;
+			n++;
+		}
+		return n;
+	}
+
+	/* true while a published chain has not yet been faded in completely */
+	bool swapping() const { return done_.load(memory_order_acquire) != published_.load(memory_order_relaxed); }
+
+	/* crossfade length of the following swaps (in blocks, 0 switches at once), any thread */
+	void setFade(UINT32 blocks) { fadeLen_.store(blocks, memory_order_relaxed); }
+	UINT32 fade() const { return fadeLen_.load(memory_order_relaxed); }
+
+	/* audio thread, at the start of every block of the stream whether the node is run or not: a
+	   published chain is taken into use only here, so that it starts at the same frame whenever
+	   the same stream is processed; the crossfade of a node which has not been run since the
+	   previous call (its output is not heard) is completed at once; true if a chain was taken */
+	bool update() {
+		if (fFading_ && !fRun_)
+			finish();
+		fRun_ = false;
+
+		// hand the old chain over for deletion, retried on the next blocks if the queue is full
+		if (retiring_ != NULL && retired_.push(retiring_))
+			retiring_ = NULL;
+
+		// a new chain is started only after the previous crossfade and hand over are complete
+		if (!fFading_ && retiring_ == NULL) {
+			DspNode *p = next_.exchange(NULL, memory_order_acq_rel);
+
+			if (p != NULL) {
+				old_     = cur_;
+				cur_     = p;
+				fadePos_ = 0;
+				fade_    = fadeLen_.load(memory_order_relaxed);
+				fFading_ = old_ != NULL;					// the first chain starts at once
+				if (!fFading_)
+					done_.fetch_add(1, memory_order_release);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		fRun_ = true;
+
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			n = min(samples - i, maxFrames_);
+			render(cur_, &input[i], &output[i], n);
+
+			if (fFading_ && fadePos_ < fade_) {
+				// t goes from fadePos/fade to (fadePos+1)/fade over the block
+				render(old_, &input[i], scratch_, n);
+				simd().rampFill(ramp_, (fadePos_ + (float)i/samples)/fade_, 1.0f/((float)fade_*samples), 1, n);
+				simd().xfade(&output[i], scratch_, ramp_, &output[i], n);
+			}
+		}
+
+		if (fFading_ && ++fadePos_ >= fade_)
+			finish();
+	}
+
+	void reset() {
+		if (cur_ != NULL)
+			cur_->reset();
+	}
+
+	const char *name() const { return "swap"; }
+
+	/* latency of the most recently published chain */
+	UINT32 latency() const { return latency_.load(memory_order_relaxed); }
+
+private:
+	/* end of the crossfade, the old chain is handed over for deletion */
+	void finish() {
+		if (old_ != NULL && !retired_.push(old_))
+			retiring_ = old_;
+		old_     = NULL;
+		fFading_ = false;
+		done_.fetch_add(1, memory_order_release);
+	}
+
+	/* an empty node passes the signal through */
+	static void render(DspNode *node, const pcm_frame *input, pcm_frame *output, UINT32 n) {
+		if (node != NULL)
+			node->process(input, output, n);
+		else
+			memcpy(output, input, n*sizeof(pcm_frame));
+	}
+
+	DspNode                         *cur_, *old_;		// owned by the audio thread
+	atomic<DspNode *>                next_;				// published, not yet taken into use
+	DspNode                         *retiring_;			// finished, not yet in the queue
+	SpscQueue<DspNode *, SWAP_RETIRED> retired_;		// finished, waiting for collect()
+	atomic<UINT32>                   published_, done_;	// swaps started and completed (or dropped)
+	bool                             fFading_, fRun_;	// crossfading, run since the last update()
+	atomic<UINT32>                   fadeLen_;			// crossfade of the next swaps
+	UINT32                           fade_, fadePos_, maxFrames_;	// crossfade of the current swap
+	atomic<UINT32>                   latency_;
+	pcm_frame                       *scratch_;			// old chain output during the crossfade
+	float                           *ramp_;
+};
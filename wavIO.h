@@ -227,6 +227,16 @@ public:
 		return summary;
 	}
 
+	// number of frames in the data
+	UINT32 getFrameCount() {
+		return myDataSize/sizeof(pcm_frame);
+	}
+
+	// the data as frames (read and written in place)
+	pcm_frame *getFrames() {
+		return (pcm_frame *)myData;
+	}
+
 	// read next buffer
 	bool LoadData(UINT32 bufferFrameCount, BYTE *pData, DWORD *flags) {
 		//*flags = 0;
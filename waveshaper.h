@@ -0,0 +1,226 @@
+/*
+ * waveshaper.h -- Oversampled nonlinear stage
+ *
+ * The signal is upsampled by 2, 4 or 8 with a cascade of half-band interpolators, shaped
+ * with a soft saturation curve at the high rate and decimated back with the mirror image
+ * cascade, so the harmonics generated by the curve above the audio band are filtered out
+ * instead of aliasing back.
+ *
+ * A half-band filter has every other coefficient zero except the center tap 0.5, so both
+ * directions split into two polyphase branches: a short FIR on the even phase and a pure
+ * delay on the odd phase. Only the FIR branch runs at the lower rate, four outputs per SSE
+ * operation. The first stage is the steep one (transition 18..26 kHz), the later stages only
+ * have to reject the images above the already band limited signal and are much shorter.
+ */
+
+#pragma once
+#include <windows.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <emmintrin.h>
+#include "wavIO.h"
+#include "simd.h"
+#include "node.h"
+
+using namespace std;
+
+#define OS_BLOCK	256		// processing block (in samples at the base rate)
+#define OS_STAGES	3		// largest oversampling factor is 2^OS_STAGES
+
+static const UINT32 hbTaps[OS_STAGES]  = { 24, 8, 6 };			// non-zero taps per stage (even phase)
+static const double hbBeta[OS_STAGES]  = { 7.0, 6.0, 6.0 };		// Kaiser window parameters
+
+
+/* half-band interpolator and decimator between two rates, one channel */
+class HalfBand {
+public:
+	/* taps is the length of the FIR branch (even), block the largest number of low rate samples per call */
+	HalfBand(UINT32 taps, double beta, UINT32 block): T(taps) {
+		c_ = alloc(T);
+		u_ = alloc(T-1 + block + 4);
+		e_ = alloc(T-1 + block + 4);
+		o_ = alloc(T-1 + block + 4);
+
+		// Kaiser windowed sinc, odd taps only, normalized so that the even phase sums to one
+		double sum = 0.0;
+		for (UINT32 i = 0; i < T; i++) {
+			double j = 2.0*i - (T-1), r = j/(T-1);
+			c_[i] = (float)(sin(M_PI*j/2.0)/(M_PI*j) * bessel0(beta*sqrt(1.0 - r*r))/bessel0(beta));
+			sum  += c_[i];
+		}
+		for (UINT32 i = 0; i < T; i++)
+			c_[i] = (float)(c_[i]/sum);
+		reset();
+	}
+
+	~HalfBand() {
+		_aligned_free(c_); _aligned_free(u_); _aligned_free(e_); _aligned_free(o_);
+	}
+
+	void reset() {
+		memset(u_, 0, (T-1)*sizeof(float));
+		memset(e_, 0, (T-1)*sizeof(float));
+		memset(o_, 0, (T-1)*sizeof(float));
+	}
+
+	/* delay in high rate samples of one direction */
+	UINT32 delay() const { return T-1; }
+
+	/* x[0..n-1] -> y[0..2n-1], y may be written up to 2*((n+3)&~3) */
+	void up(const float *x, float *y, UINT32 n) {
+		float *h = &u_[T-1];
+
+		memcpy(h, x, n*sizeof(float));
+		for (int k = 0; k < (int)n; k += 4) {
+			__m128 acc = _mm_setzero_ps();
+			for (int i = 0; i < (int)T; i++)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(c_[i]), _mm_loadu_ps(&h[k-i])));
+
+			// odd phase is the center tap (gain 0.5, doubled for the zero stuffing)
+			__m128 d = _mm_loadu_ps(&h[k - (int)T/2 + 1]);
+			_mm_storeu_ps(&y[2*k],   _mm_unpacklo_ps(acc, d));
+			_mm_storeu_ps(&y[2*k+4], _mm_unpackhi_ps(acc, d));
+		}
+		memmove(u_, &u_[n], (T-1)*sizeof(float));
+	}
+
+	/* z[0..2n-1] -> y[0..n-1], y may be written up to (n+3)&~3 */
+	void down(const float *z, float *y, UINT32 n) {
+		const __m128 half = _mm_set1_ps(0.5f);
+		float *e = &e_[T-1], *o = &o_[T-1];
+
+		for (UINT32 k = 0; k < n; k += 4) {
+			__m128 a = _mm_loadu_ps(&z[2*k]), b = _mm_loadu_ps(&z[2*k+4]);
+			_mm_storeu_ps(&e[k], _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(&o[k], _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+		for (int k = 0; k < (int)n; k += 4) {
+			__m128 acc = _mm_loadu_ps(&o[k - (int)T/2]);
+			for (int i = 0; i < (int)T; i++)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(c_[i]), _mm_loadu_ps(&e[k-i])));
+			_mm_storeu_ps(&y[k], _mm_mul_ps(acc, half));
+		}
+		memmove(e_, &e_[n], (T-1)*sizeof(float));
+		memmove(o_, &o_[n], (T-1)*sizeof(float));
+	}
+
+private:
+	static float *alloc(UINT32 n) {
+		float *p = (float *)_aligned_malloc(n*sizeof(float), 16);
+		memset(p, 0, n*sizeof(float));
+		return p;
+	}
+
+	/* modified Bessel function of the first kind, order zero */
+	static double bessel0(double x) {
+		double sum = 1.0, term = 1.0;
+
+		for (int k = 1; k < 32; k++) {
+			term *= (x/(2.0*k)) * (x/(2.0*k));
+			sum  += term;
+		}
+		return sum;
+	}
+
+	UINT32 T;
+	float *c_;					// non-zero coefficients (even phase)
+	float *u_;					// interpolator input history
+	float *e_, *o_;				// decimator even and odd phase histories
+};
+
+
+class Waveshaper: public DspNode {
+public:
+	/* factor is the oversampling factor (1, 2, 4 or 8), drive the input gain to the curve (dB),
+	   level the output gain (dB) */
+	Waveshaper(UINT32 factor = 4, float drive = 12.0f, float level = -3.0f): stages_(0) {
+		while ((1u << stages_) < factor && stages_ < OS_STAGES)
+			stages_++;
+		for (UINT32 s = 0; s < stages_; s++)
+			for (int c = 0; c < 2; c++)
+				hb_[c][s] = new HalfBand(hbTaps[s], hbBeta[s], OS_BLOCK << s);
+		drive_ = powf(10.0f, drive/20.0f)/32768.0f;
+		level_ = powf(10.0f, level/20.0f)*32768.0f;
+		for (int c = 0; c < 2; c++) {
+			x_[c]    = (float *)_aligned_malloc((OS_BLOCK+4)*sizeof(float), 16);
+			os_[c][0] = (float *)_aligned_malloc(((OS_BLOCK << OS_STAGES) + 16)*sizeof(float), 16);
+			os_[c][1] = (float *)_aligned_malloc(((OS_BLOCK << OS_STAGES) + 16)*sizeof(float), 16);
+		}
+	}
+
+	~Waveshaper() {
+		for (int c = 0; c < 2; c++) {
+			for (UINT32 s = 0; s < stages_; s++)
+				delete hb_[c][s];
+			_aligned_free(x_[c]); _aligned_free(os_[c][0]); _aligned_free(os_[c][1]);
+		}
+	}
+
+	void process(const pcm_frame *input, pcm_frame *output, const UINT32 samples) {
+		for (UINT32 i = 0, n; i < samples; i += n) {
+			n = min(samples - i, (UINT32)OS_BLOCK);
+
+			simd().pcmToF32(&input[i], x_[0], x_[1], n);
+			for (int c = 0; c < 2; c++) {
+				// up through the stages, ping-ponging between the two buffers
+				float *p = x_[c], *q;
+				UINT32 m = n;
+				for (UINT32 s = 0; s < stages_; s++, m *= 2) {
+					q = os_[c][s & 1];
+					hb_[c][s]->up(p, q, m);
+					p = q;
+				}
+
+				shape(p, m);
+
+				for (UINT32 s = stages_; s-- > 0; m /= 2) {
+					q = s ? os_[c][(s+1) & 1] : x_[c];
+					hb_[c][s]->down(p, q, m/2);
+					p = q;
+				}
+			}
+			simd().f32ToPcm(x_[0], x_[1], &output[i], n);
+		}
+	}
+
+	void reset() {
+		for (int c = 0; c < 2; c++)
+			for (UINT32 s = 0; s < stages_; s++)
+				hb_[c][s]->reset();
+	}
+
+	/* group delay of the filter cascade rounded to base rate samples */
+	UINT32 latency() const {
+		UINT32 d = 0;
+
+		for (UINT32 s = 0; s < stages_; s++)
+			d += 2*hb_[0][s]->delay() << (stages_ - s - 1);		// up and down, in samples at the highest rate / 2
+
+		return (d + (1 << stages_)/2) >> stages_;
+	}
+
+	UINT32 factor() const { return 1 << stages_; }
+
+	const char *name() const { return "waveshaper"; }
+
+private:
+	/* rational tanh approximation, exact saturation at |x| >= 3 */
+	void shape(float *x, UINT32 n) {
+		const __m128 drive = _mm_set1_ps(drive_), level = _mm_set1_ps(level_);
+		const __m128 lim = _mm_set1_ps(3.0f), c27 = _mm_set1_ps(27.0f), c9 = _mm_set1_ps(9.0f);
+
+		for (UINT32 k = 0; k < n; k += 4) {
+			__m128 v  = _mm_mul_ps(_mm_loadu_ps(&x[k]), drive);
+			v = _mm_min_ps(_mm_max_ps(v, _mm_sub_ps(_mm_setzero_ps(), lim)), lim);
+			__m128 v2 = _mm_mul_ps(v, v);
+			__m128 y  = _mm_div_ps(_mm_mul_ps(v, _mm_add_ps(c27, v2)), _mm_add_ps(c27, _mm_mul_ps(c9, v2)));
+			_mm_storeu_ps(&x[k], _mm_mul_ps(y, level));
+		}
+	}
+
+	UINT32    stages_;
+	HalfBand *hb_[2][OS_STAGES];
+	float     drive_, level_;
+	float    *x_[2];				// base rate block of each channel
+	float    *os_[2][2];			// oversampled ping-pong buffers of each channel
+};
@@ -244,6 +244,8 @@ HRESULT PlayAndRecordAudioStream(MyAudio *pMyAudio) {
 	// (NOTE!: USB A/D & D/A converters needs a little longer period than the given minimum)
     hr = pAudioRenderClient->GetDevicePeriod(NULL, &hnsMinPeriod);
     EXIT_ON_ERROR(hr)
+	if (pMyAudio->GetBlockSize() > 128)
+		buffersize = pMyAudio->GetBlockSize() - 128;	// start from the planned block size
 	do {	// find out buffer period which is 128 byte aligned and larger than the minum device period
 		buffersize               += 128;
 		hnsAlignedBufferDuration  = (UINT32)(buffersize * 10e6 / pwfx->nSamplesPerSec + 0.5);	// convert to 100ns time units
@@ -348,6 +350,7 @@ HRESULT PlayAndRecordAudioStream(MyAudio *pMyAudio) {
 
 			// then clear the whole capture buffer, because render buffer is full
 			printf("[%d](%d,%d)", cnt, numFramesAvailable,alreadyUsed);
+			pMyAudio->CaptureOverrun(numFramesAvailable, alreadyUsed);
 			hr = pAudioCaptureClient->Stop();
 			EXIT_ON_ERROR(hr)
 			hr = pAudioCaptureClient->Reset();